@@ -2,6 +2,6 @@
 
 # clean working directory of DISCOTRESS output files
 
-rm walker.*.dat fpp_properties.dat tp_stats.dat
+rm walker.*.dat fpp_properties.dat tp_stats.dat unif_occprobs.dat unif_fpt.dat spectral_eigvals.dat spectral_eigvecs.dat
 rm committor_AB.dat committor_BA.dat absorption.dat hitting_probs.dat transient_visits.dat node_visits.dat fundamental.dat mfpt.dat stat_prob_gth.dat
 rm kmc.out
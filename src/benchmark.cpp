@@ -0,0 +1,586 @@
+/*
+Benchmark suite for DISCOTRESS, comprising generators for parameterised synthetic metastable networks and a driver that times
+the DISCOTRESS executable for each compatible combination of WRAPPER and TRAJ methods, and for the state reduction procedures.
+
+Usage:
+  benchmark gen <type> <dir> [params...]      write the input files for a synthetic network to directory <dir>
+  benchmark run <discotress> [options]        generate the suite of networks and time each method on each network
+  benchmark check <discotress> [options]      compare the MFPTs estimated by the simulation methods on a linear chain to the exact value
+
+Network types and parameters (defaults in brackets):
+  lattice2d   [L=16] [barrier=4.] [T=1.]          2D lattice with a double-well potential along x
+  lattice3d   [L=8] [barrier=4.] [T=1.]           3D lattice with a double-well potential along x
+  funnel      [nfunnels=4] [size=64] [barrier=3.] [T=1.]  multi-funnel landscape, funnels joined in a chain
+  scalefree   [N=512] [m=2] [alpha=1.] [T=1.]     Barabasi-Albert scale-free graph, hubs are low in energy
+  randreg     [N=512] [d=4] [barrier=2.] [T=1.]   random regular graph with random energies
+  chain       [N=6]                               linear chain with unit rates, one community per node, B and A at the two ends
+
+Options for "run":
+  -n <int>      number of A<-B paths (or equivalent) for each benchmark (default 100)
+  -t <int>      number of threads (default 1)
+  -c <file>     reference benchmark file (as written by a previous run), for detecting performance regressions
+  -o <file>     output file (default benchmark.dat)
+
+Options for "check":
+  -n <int>      number of A<-B paths, and of configurations and trials per interface for FFS (default 20000)
+  -t <int>      number of threads (default 1)
+
+For each network, the following files are written: edge_conns.dat, edge_weights.dat, stat_prob.dat, communities.dat (communities
+ordered by distance from B, A being the highest community), communities_sr.dat (two communities, A and not A, for state reduction),
+commstarg.dat, ntrajs.dat, nodes.A, nodes.B, node.A (single node), node.B (single node). The rates are parameterised by node
+energies E_i and transition state energies E_ij>=max(E_i,E_j), as k_ij = exp(-(E_ij-E_i)/T), so that the Markov chain is reversible,
+with stationary distribution pi_i proportional to exp(-E_i/T).
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <set>
+#include <map>
+#include <queue>
+#include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+/* synthetic network, with energies of nodes and transition states, and a partitioning into communities */
+struct Bench_Network {
+
+    string name;
+    int n_nodes=0;
+    double temp=1.;
+    vector<double> energies;              // energies of nodes
+    vector<pair<int,int>> conns;          // pairs of connected nodes (indexed from 0)
+    vector<double> ts_energies;           // energies of the transition states for the edges
+    vector<int> comms;                    // community IDs of nodes
+    int ncomms=0;
+    vector<int> nodesA, nodesB;           // nodes in the A and B sets (indexed from 0)
+    double min_tesc=0.;                   // minimum mean waiting time of nodes
+
+    void add_edge(int,int,double);
+    void set_comms_by_dist(int);
+    void write(const string&) const;
+    vector<vector<int>> adjacency() const;
+};
+
+/* add an edge between nodes i and j, with the transition state energy higher than both nodes by offset */
+void Bench_Network::add_edge(int i, int j, double offset) {
+    conns.emplace_back(i,j);
+    ts_energies.push_back(max(energies[i],energies[j])+offset);
+}
+
+vector<vector<int>> Bench_Network::adjacency() const {
+    vector<vector<int>> adj(n_nodes);
+    for (const auto &conn: conns) { adj[conn.first].push_back(conn.second); adj[conn.second].push_back(conn.first); }
+    return adj;
+}
+
+/* set the communities as quantiles of the breadth-first search distance from the B set, so that B is in community 0, and set the A
+   set to be the highest community. Exits if the network is not connected */
+void Bench_Network::set_comms_by_dist(int ncomms) {
+    vector<vector<int>> adj=adjacency();
+    vector<int> dist(n_nodes,-1);
+    queue<int> bfs_queue;
+    for (int b: nodesB) { dist[b]=0; bfs_queue.push(b); }
+    while (!bfs_queue.empty()) {
+        int i=bfs_queue.front(); bfs_queue.pop();
+        for (int j: adj[i]) { if (dist[j]<0) { dist[j]=dist[i]+1; bfs_queue.push(j); } }
+    }
+    if (any_of(dist.begin(),dist.end(),[](int d) { return d<0; })) {
+        cout << "benchmark> error: network " << name << " is not connected" << endl; exit(EXIT_FAILURE); }
+    vector<int> order(n_nodes);
+    iota(order.begin(),order.end(),0);
+    stable_sort(order.begin(),order.end(),[&dist](int i, int j) { return dist[i]<dist[j]; });
+    comms.resize(n_nodes); this->ncomms=ncomms;
+    for (int r=0;r<n_nodes;r++) comms[order[r]]=(r*ncomms)/n_nodes;
+    nodesA.clear();
+    for (int i=0;i<n_nodes;i++) { if (comms[i]==ncomms-1) nodesA.push_back(i); }
+}
+
+/* write the network to the input files read by DISCOTRESS */
+void Bench_Network::write(const string &dir) const {
+    filesystem::create_directories(dir);
+    ofstream conns_f(dir+"/edge_conns.dat"), wts_f(dir+"/edge_weights.dat"), pi_f(dir+"/stat_prob.dat");
+    wts_f << fixed << setprecision(12); pi_f << fixed << setprecision(15);
+    for (int e=0;e<conns.size();e++) {
+        int i=conns[e].first, j=conns[e].second;
+        conns_f << i+1 << " " << j+1 << "\n";
+        wts_f << -(ts_energies[e]-energies[i])/temp << " " << -(ts_energies[e]-energies[j])/temp << "\n";
+    }
+    double e_min=*min_element(energies.begin(),energies.end()), z=0.;
+    for (double e: energies) z+=exp(-(e-e_min)/temp);
+    for (double e: energies) pi_f << -(e-e_min)/temp-log(z) << "\n";
+    ofstream comms_f(dir+"/communities.dat"), comms_sr_f(dir+"/communities_sr.dat"), targ_f(dir+"/commstarg.dat"), \
+             ntrajs_f(dir+"/ntrajs.dat");
+    set<int> set_a(nodesA.begin(),nodesA.end());
+    for (int i=0;i<n_nodes;i++) { comms_f << comms[i] << "\n"; comms_sr_f << set_a.count(i) << "\n"; }
+    for (int c=0;c<ncomms;c++) { targ_f << 4 << "\n"; ntrajs_f << 10 << "\n"; }
+    ofstream a_f(dir+"/nodes.A"), b_f(dir+"/nodes.B"), a1_f(dir+"/node.A"), b1_f(dir+"/node.B");
+    for (int a: nodesA) a_f << a+1 << "\n";
+    for (int b: nodesB) b_f << b+1 << "\n";
+    // single endpoint nodes (for the REA), namely the lowest-energy nodes of A and B
+    a1_f << *min_element(nodesA.begin(),nodesA.end(),[this](int i, int j) { return energies[i]<energies[j]; })+1 << "\n";
+    b1_f << *min_element(nodesB.begin(),nodesB.end(),[this](int i, int j) { return energies[i]<energies[j]; })+1 << "\n";
+}
+
+/* compute the minimum mean waiting time of the nodes, used to set the lag time for the linearised transition matrix */
+static void calc_min_tesc(Bench_Network &net) {
+    vector<double> k_esc(net.n_nodes,0.);
+    for (int e=0;e<net.conns.size();e++) {
+        int i=net.conns[e].first, j=net.conns[e].second;
+        k_esc[i]+=exp(-(net.ts_energies[e]-net.energies[i])/net.temp);
+        k_esc[j]+=exp(-(net.ts_energies[e]-net.energies[j])/net.temp);
+    }
+    net.min_tesc=1./(*max_element(k_esc.begin(),k_esc.end()));
+}
+
+/* d-dimensional lattice of side L, with a double-well potential along the first dimension. The B set is the face at x=0 */
+static Bench_Network gen_lattice(int dim, int L, double barrier, double temp, int seed) {
+    Bench_Network net; net.name="lattice"+to_string(dim)+"d"; net.temp=temp;
+    mt19937 gen(seed); uniform_real_distribution<double> unif(0.,1.);
+    net.n_nodes=1; for (int d=0;d<dim;d++) net.n_nodes*=L;
+    net.energies.resize(net.n_nodes);
+    for (int i=0;i<net.n_nodes;i++) {
+        int x=i%L;
+        net.energies[i]=barrier*pow(sin(M_PI*x/static_cast<double>(L-1)),2)+(0.5*unif(gen));
+        if (x==0) net.nodesB.push_back(i);
+    }
+    for (int i=0;i<net.n_nodes;i++) {
+        int stride=1;
+        for (int d=0;d<dim;d++) {
+            if ((i/stride)%L<L-1) net.add_edge(i,i+stride,0.5);
+            stride*=L;
+        }
+    }
+    net.set_comms_by_dist(4);
+    return net;
+}
+
+/* multi-funnel landscape. Each funnel is a random tree with additional random edges, the energy of a node increasing with its depth
+   in the tree. Neighbouring funnels are connected by edges between high-energy nodes, with an additional barrier. The communities are
+   the funnels, B is the bottom of the first funnel and A is the last funnel */
+static Bench_Network gen_funnel(int nfunnels, int size, double barrier, double temp, int seed) {
+    Bench_Network net; net.name="funnel"; net.temp=temp;
+    mt19937 gen(seed); uniform_real_distribution<double> unif(0.,1.);
+    net.n_nodes=nfunnels*size;
+    net.energies.resize(net.n_nodes); net.comms.resize(net.n_nodes); net.ncomms=nfunnels;
+    vector<int> depth(net.n_nodes,0), parent(net.n_nodes,-1);
+    for (int f=0;f<nfunnels;f++) {
+        int base=f*size;
+        for (int j=0;j<size;j++) {
+            int i=base+j;
+            if (j>0) { parent[i]=base+static_cast<int>(unif(gen)*j); depth[i]=depth[parent[i]]+1; }
+            net.energies[i]=-barrier+(0.4*depth[i])+(0.3*unif(gen));
+            net.comms[i]=f;
+            if (f==nfunnels-1) net.nodesA.push_back(i);
+        }
+        for (int j=1;j<size;j++) net.add_edge(base+j,parent[base+j],0.3);
+        for (int m=0;m<size/4;m++) { // additional edges within the funnel
+            int i=base+static_cast<int>(unif(gen)*size), j=base+static_cast<int>(unif(gen)*size);
+            if (i!=j && parent[i]!=j && parent[j]!=i) net.add_edge(i,j,0.3+unif(gen));
+        }
+    }
+    for (int f=0;f<nfunnels-1;f++) { // connect neighbouring funnels via their deepest (highest-energy) nodes
+        for (int c=0;c<2;c++) {
+            int i=f*size+(size-1-c), j=(f+1)*size+(size-1-c);
+            net.add_edge(i,j,barrier);
+        }
+    }
+    net.nodesB.push_back(0);
+    return net;
+}
+
+/* Barabasi-Albert scale-free graph, where each new node attaches to m existing nodes with probability proportional to their degree.
+   The energy of a node decreases with its degree, so that hubs are traps */
+static Bench_Network gen_scalefree(int n, int m, double alpha, double temp, int seed) {
+    Bench_Network net; net.name="scalefree"; net.temp=temp;
+    mt19937 gen(seed); uniform_real_distribution<double> unif(0.,1.);
+    net.n_nodes=n;
+    vector<int> targets; // list of node IDs, each node appearing a number of times equal to its degree
+    set<pair<int,int>> edges;
+    for (int i=0;i<=m;i++) { for (int j=0;j<i;j++) { edges.insert({j,i}); targets.push_back(i); targets.push_back(j); } }
+    for (int i=m+1;i<n;i++) {
+        set<int> nbrs;
+        while (nbrs.size()<m) nbrs.insert(targets[static_cast<int>(unif(gen)*targets.size())]);
+        for (int j: nbrs) { edges.insert({j,i}); targets.push_back(i); targets.push_back(j); }
+    }
+    vector<int> degree(n,0);
+    for (const auto &edge: edges) { degree[edge.first]++; degree[edge.second]++; }
+    net.energies.resize(n);
+    for (int i=0;i<n;i++) net.energies[i]=-alpha*log(static_cast<double>(degree[i]))+(0.5*unif(gen));
+    for (const auto &edge: edges) net.add_edge(edge.first,edge.second,0.5+unif(gen));
+    net.nodesB.push_back(n-1);
+    net.set_comms_by_dist(4);
+    return net;
+}
+
+/* random regular graph of degree d, generated by the configuration model (rejecting self-loops and multiple edges) */
+static Bench_Network gen_randreg(int n, int d, double barrier, double temp, int seed) {
+    Bench_Network net; net.name="randreg"; net.temp=temp;
+    mt19937 gen(seed); uniform_real_distribution<double> unif(0.,1.);
+    if ((n*d)%2!=0) { cout << "benchmark> error: n*d must be even for a random regular graph" << endl; exit(EXIT_FAILURE); }
+    net.n_nodes=n;
+    set<pair<int,int>> edges;
+    for (;;) {
+        vector<int> stubs;
+        for (int i=0;i<n;i++) for (int k=0;k<d;k++) stubs.push_back(i);
+        shuffle(stubs.begin(),stubs.end(),gen);
+        edges.clear();
+        bool valid=true;
+        for (int s=0;s<stubs.size();s+=2) {
+            int i=min(stubs[s],stubs[s+1]), j=max(stubs[s],stubs[s+1]);
+            if (i==j || !edges.insert({i,j}).second) { valid=false; break; }
+        }
+        if (valid) break;
+    }
+    net.energies.resize(n);
+    for (int i=0;i<n;i++) net.energies[i]=barrier*unif(gen);
+    for (const auto &edge: edges) net.add_edge(edge.first,edge.second,0.5*barrier*unif(gen));
+    net.nodesB.push_back(0);
+    net.set_comms_by_dist(4);
+    return net;
+}
+
+/* linear chain of n nodes with unit rates in both directions (equal energies and no barriers). Each node is its own community, B is the
+   first node and A is the last node, so that the communities define a maximal set of interfaces for FFS */
+static Bench_Network gen_chain(int n) {
+    Bench_Network net; net.name="chain"; net.temp=1.;
+    net.n_nodes=n;
+    net.energies.assign(n,0.);
+    for (int i=0;i<n-1;i++) net.add_edge(i,i+1,0.);
+    net.nodesB.push_back(0);
+    net.set_comms_by_dist(n);
+    return net;
+}
+
+/* generate a network of the given type, with parameters read from args (default values are used for any parameters not given) */
+static Bench_Network gen_network(const string &type, const vector<double> &args, int seed=17) {
+    auto arg = [&args](int i, double dflt) { return i<args.size()?args[i]:dflt; };
+    Bench_Network net;
+    if (type=="lattice2d") { net=gen_lattice(2,arg(0,16),arg(1,4.),arg(2,1.),seed);
+    } else if (type=="lattice3d") { net=gen_lattice(3,arg(0,8),arg(1,4.),arg(2,1.),seed);
+    } else if (type=="funnel") { net=gen_funnel(arg(0,4),arg(1,64),arg(2,3.),arg(3,1.),seed);
+    } else if (type=="scalefree") { net=gen_scalefree(arg(0,512),arg(1,2),arg(2,1.),arg(3,1.),seed);
+    } else if (type=="randreg") { net=gen_randreg(arg(0,512),arg(1,4),arg(2,2.),arg(3,1.),seed);
+    } else if (type=="chain") { net=gen_chain(arg(0,6));
+    } else { cout << "benchmark> error: unrecognised network type " << type << endl; exit(EXIT_FAILURE); }
+    calc_min_tesc(net);
+    return net;
+}
+
+/* a single benchmark, namely a combination of WRAPPER and TRAJ methods (or a state reduction procedure) */
+struct Bench_Case {
+    string label;
+    vector<string> keywords; // lines of input.kmc in addition to those common to all cases
+};
+
+/* result of running DISCOTRESS for a single benchmark */
+struct Bench_Result {
+    string network, label;
+    double walltime=0.;
+    long long int n_it=-1, n_steps=-1; // no. of iterations (basin escapes for kPS and MCAMC) and no. of kMC steps (-1 if not known)
+    double peakmem=0.; // peak resident memory (MB)
+    int status=0;
+};
+
+/* the set of benchmarks for a network */
+static vector<Bench_Case> setup_cases(const Bench_Network &net, int npaths) {
+    int maxcomm=0;
+    for (int c=0;c<net.ncomms;c++) maxcomm=max(maxcomm,static_cast<int>(count(net.comms.begin(),net.comms.end(),c)));
+    ostringstream tau_oss; tau_oss << setprecision(6) << 0.9*net.min_tesc;
+    string np=to_string(npaths), nelim=to_string(maxcomm), tau=tau_oss.str();
+    string taure=to_string(1000.*net.min_tesc), trajt=to_string(10000.*net.min_tesc);
+    vector<string> ab{"NODESAFILE nodes.A "+to_string(net.nodesA.size()),"NODESBFILE nodes.B "+to_string(net.nodesB.size()), \
+                      "COMMSFILE communities.dat "+to_string(net.ncomms)};
+    auto with_ab = [&ab](vector<string> kws) { kws.insert(kws.end(),ab.begin(),ab.end()); return kws; };
+    vector<Bench_Case> cases{
+        {"BTOA-BKL",with_ab({"WRAPPER BTOA","TRAJ BKL","BRANCHPROBS","NABPATHS "+np})},
+        {"BTOA-BKL-LAZYTIME",with_ab({"WRAPPER BTOA","TRAJ BKL","BRANCHPROBS","LAZYTIME","NABPATHS "+np})},
+        {"BTOA-KPS",with_ab({"WRAPPER BTOA","TRAJ KPS","BRANCHPROBS","NELIM "+nelim,"KPSKMCSTEPS 10","NABPATHS "+np})},
+        {"BTOA-HYBRID",with_ab({"WRAPPER BTOA","TRAJ HYBRID","BRANCHPROBS","NABPATHS "+np})},
+        {"BTOA-MCAMC",with_ab({"WRAPPER BTOA","TRAJ MCAMC","TAU "+tau,"KPSKMCSTEPS 10","NABPATHS "+np})},
+        {"BTOA-MCAMC-MEANRATE",with_ab({"WRAPPER BTOA","TRAJ MCAMC","MEANRATE","TAU "+tau,"KPSKMCSTEPS 10","NABPATHS "+np})},
+        {"FIXEDT-BKL",with_ab({"WRAPPER FIXEDT","TRAJ BKL","BRANCHPROBS","BATCHWALKERS 64","TRAJT "+trajt,"NABPATHS "+np})},
+        {"WE-BKL",with_ab({"WRAPPER WE","TRAJ BKL","BRANCHPROBS","COMMSTARGFILE commstarg.dat","NWALKERS 4","TAURE "+taure, \
+                           "NABPATHS "+np,"MAXIT 100"})},
+        {"FFS-BKL",with_ab({"WRAPPER FFS","TRAJ BKL","BRANCHPROBS","NWALKERS "+np,"FFSTRIALS "+np,"NABPATHS "+np})},
+        {"NEUS-BKL",with_ab({"WRAPPER NEUS","TRAJ BKL","BRANCHPROBS","NWALKERS 4","TAURE "+taure,"NABPATHS "+np,"MAXIT 100"})},
+        {"MILES-BKL",with_ab({"WRAPPER MILES","TRAJ BKL","BRANCHPROBS","NWALKERS "+np,"NABPATHS 3"})},
+        {"DIMREDN-BKL",{"WRAPPER DIMREDN","TRAJ BKL","BRANCHPROBS","BATCHWALKERS 10","DIMREDUCTION ntrajs.dat","TRAJT "+trajt, \
+                        "TINTVL "+trajt,"DUMPINTVLS","COMMSFILE communities.dat "+to_string(net.ncomms),"NABPATHS 1"}},
+        {"REA",{"WRAPPER REA","TRAJ BKL","BRANCHPROBS","NODESAFILE node.A 1","NODESBFILE node.B 1","NABPATHS "+np}},
+        {"SR-COMMITTOR-MFPT",{"WRAPPER BTOA","TRAJ KPS","BRANCHPROBS","COMMITTOR","MFPT","NODESAFILE nodes.A "+to_string(net.nodesA.size()), \
+                              "NODESBFILE nodes.B "+to_string(net.nodesB.size()),"COMMSFILE communities_sr.dat 2", \
+                              "NELIM "+to_string(net.n_nodes),"NABPATHS 1"}},
+    };
+    return cases;
+}
+
+/* run the DISCOTRESS executable in directory dir, with output redirected to kmc.out, and record the wall time and peak memory */
+static void run_discotress(const string &exe, const string &dir, Bench_Result &result) {
+    auto start=chrono::steady_clock::now();
+    pid_t pid=fork();
+    if (pid==0) { // child process
+        if (chdir(dir.c_str())!=0) _exit(127);
+        int out_fd=open("kmc.out",O_WRONLY|O_CREAT|O_TRUNC,0644);
+        dup2(out_fd,STDOUT_FILENO); dup2(out_fd,STDERR_FILENO); close(out_fd);
+        execl(exe.c_str(),exe.c_str(),static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status; struct rusage usage;
+    wait4(pid,&status,0,&usage);
+    result.walltime=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    result.peakmem=static_cast<double>(usage.ru_maxrss)/1024.; // ru_maxrss is in kB on Linux
+    result.status=WIFEXITED(status)?WEXITSTATUS(status):-1;
+}
+
+/* parse the numbers of iterations (as printed on termination of the simulation) and kMC steps from the output of DISCOTRESS. The number of kMC steps is read from the output if
+   printed, or else is the sum of the path lengths in fpp_properties.dat */
+static void parse_output(const string &dir, Bench_Result &result) {
+    ifstream out_f(dir+"/kmc.out");
+    string line;
+    while (getline(out_f,line)) {
+        size_t pos;
+        if ((pos=line.find(" after "))!=string::npos && line.find(" iterations")!=string::npos) {
+            istringstream iss(line.substr(pos+7)); long long int n_it; string word;
+            if (iss >> n_it >> word && word.rfind("iterations",0)==0) result.n_it=n_it; }
+        if ((pos=line.find("kMC steps: "))!=string::npos) {
+            istringstream iss(line.substr(pos+11)); iss >> result.n_steps; }
+    }
+    if (result.n_steps>=0) return;
+    ifstream fpp_f(dir+"/fpp_properties.dat");
+    if (!fpp_f.good()) return;
+    long long int pathno, k; long double t;
+    result.n_steps=0;
+    while (getline(fpp_f,line)) {
+        istringstream iss(line);
+        if (iss >> pathno >> t >> k) result.n_steps+=k;
+    }
+}
+
+/* read a reference benchmark file, returning a map from network and benchmark labels to the wall time */
+static map<pair<string,string>,double> read_reference(const string &fname) {
+    map<pair<string,string>,double> ref;
+    ifstream ref_f(fname);
+    if (!ref_f.good()) { cout << "benchmark> error: reference file " << fname << " not found" << endl; exit(EXIT_FAILURE); }
+    string line;
+    while (getline(ref_f,line)) {
+        if (line.empty() || line[0]=='#') continue;
+        istringstream iss(line);
+        string network, label; double walltime;
+        if (iss >> network >> label >> walltime) ref[{network,label}]=walltime;
+    }
+    return ref;
+}
+
+/* set up the directory for a benchmark of the network (whose input files have been written to netdir), and return its path */
+static string setup_case_dir(const Bench_Network &net, const string &netdir, const Bench_Case &bcase, int nthreads) {
+    string dir=netdir+"/"+bcase.label;
+    filesystem::remove_all(dir); filesystem::create_directories(dir);
+    for (const char *fname: {"edge_conns.dat","edge_weights.dat","stat_prob.dat","communities.dat","communities_sr.dat", \
+                             "commstarg.dat","ntrajs.dat","nodes.A","nodes.B","node.A","node.B"}) {
+        filesystem::copy_file(netdir+"/"+fname,dir+"/"+fname); }
+    ofstream inp_f(dir+"/input.kmc");
+    inp_f << "NNODES " << net.n_nodes << "\nNEDGES " << net.conns.size() << "\nSEED 17\nNTHREADS " << nthreads << "\n";
+    for (const string &kw: bcase.keywords) inp_f << kw << "\n";
+    return dir;
+}
+
+static void run_suite(const string &exe, int npaths, int nthreads, const string &ref_fname, const string &out_fname) {
+    vector<pair<string,vector<double>>> suite{{"lattice2d",{}},{"lattice3d",{}},{"funnel",{}},{"scalefree",{}},{"randreg",{}}};
+    map<pair<string,string>,double> ref;
+    if (!ref_fname.empty()) ref=read_reference(ref_fname);
+    ofstream out_f(out_fname);
+    out_f << "# network / benchmark / wall time (s) / iterations / iterations per s / kMC steps / kMC steps per s / peak memory (MB) / exit status" << endl;
+    cout << left << setw(11) << "network" << setw(22) << "benchmark" << right << setw(10) << "time (s)" << setw(14) << "iter/s" \
+         << setw(14) << "steps/s" << setw(12) << "mem (MB)" << (ref.empty()?"":"   vs. ref") << endl;
+    int n_regressions=0;
+    for (const auto &spec: suite) {
+        Bench_Network net=gen_network(spec.first,spec.second);
+        string netdir="bench_"+net.name;
+        net.write(netdir);
+        for (const Bench_Case &bcase: setup_cases(net,npaths)) {
+            string dir=setup_case_dir(net,netdir,bcase,nthreads);
+            Bench_Result result; result.network=net.name; result.label=bcase.label;
+            run_discotress(filesystem::absolute(exe).string(),dir,result);
+            parse_output(dir,result);
+            auto rate = [&result](long long int n) { return n>=0?static_cast<double>(n)/result.walltime:-1.; };
+            out_f << left << setw(11) << result.network << setw(22) << result.label << right << fixed << setprecision(4) \
+                  << setw(12) << result.walltime << setw(14) << result.n_it << setw(16) << setprecision(1) << rate(result.n_it) \
+                  << setw(16) << result.n_steps << setw(16) << rate(result.n_steps) << setw(12) << result.peakmem \
+                  << setw(6) << result.status << endl;
+            cout << left << setw(11) << result.network << setw(22) << result.label << right << fixed << setprecision(3) \
+                 << setw(10) << result.walltime << setprecision(1) << setw(14) << rate(result.n_it) << setw(14) << rate(result.n_steps) \
+                 << setw(12) << result.peakmem;
+            if (result.status!=0) cout << "   FAILED (exit status " << result.status << ")";
+            auto it=ref.find({result.network,result.label});
+            if (it!=ref.end() && result.status==0) {
+                double ratio=result.walltime/it->second;
+                cout << setprecision(2) << setw(10) << ratio << "x";
+                if (ratio>1.2 && result.walltime>0.1) { cout << "   REGRESSION"; n_regressions++; }
+            }
+            cout << endl;
+        }
+    }
+    cout << "benchmark> results written to " << out_fname << endl;
+    if (!ref.empty()) cout << "benchmark> no. of performance regressions (>20% slower than reference): " << n_regressions << endl;
+}
+
+/* exact A<-B MFPT of a (small) network, for initial nodes in B weighted by their stationary probabilities. The MFPTs tau_i to A of
+   the nodes not in A are the solution of the linear equations sum_j k_ij (tau_i-tau_j) = 1, solved by Gaussian elimination */
+static double calc_exact_mfpt(const Bench_Network &net) {
+    set<int> set_a(net.nodesA.begin(),net.nodesA.end());
+    vector<int> idx(net.n_nodes,-1); // index of each node not in A in the linear system
+    int n=0;
+    for (int i=0;i<net.n_nodes;i++) { if (!set_a.count(i)) idx[i]=n++; }
+    vector<vector<double>> a(n,vector<double>(n+1,0.));
+    for (int r=0;r<n;r++) a[r][n]=1.;
+    for (int e=0;e<net.conns.size();e++) {
+        for (int d=0;d<2;d++) {
+            int i=d==0?net.conns[e].first:net.conns[e].second, j=d==0?net.conns[e].second:net.conns[e].first;
+            if (idx[i]<0) continue;
+            double k_ij=exp(-(net.ts_energies[e]-net.energies[i])/net.temp);
+            a[idx[i]][idx[i]]+=k_ij;
+            if (idx[j]>=0) a[idx[i]][idx[j]]-=k_ij;
+        }
+    }
+    for (int c=0;c<n;c++) {
+        int piv=c;
+        for (int r=c+1;r<n;r++) { if (abs(a[r][c])>abs(a[piv][c])) piv=r; }
+        swap(a[c],a[piv]);
+        for (int r=c+1;r<n;r++) {
+            double f=a[r][c]/a[c][c];
+            for (int m=c;m<=n;m++) a[r][m]-=f*a[c][m];
+        }
+    }
+    vector<double> tau(n);
+    for (int r=n-1;r>=0;r--) {
+        tau[r]=a[r][n];
+        for (int m=r+1;m<n;m++) tau[r]-=a[r][m]*tau[m];
+        tau[r]/=a[r][r];
+    }
+    double mfpt=0., z=0.;
+    for (int b: net.nodesB) { double w=exp(-net.energies[b]/net.temp); mfpt+=w*tau[idx[b]]; z+=w; }
+    return mfpt/z;
+}
+
+/* run the simulation methods that estimate the A<-B MFPT on a linear chain, and compare the estimates to the exact value. Exits with
+   a nonzero status if any estimate deviates from the exact value by more than the tolerance, which is several times the statistical
+   error for the default number of paths */
+static void run_check(const string &exe, int npaths, int nthreads) {
+    const double tol=0.05; // max. allowed relative deviation from the exact MFPT
+    Bench_Network net=gen_network("chain",{});
+    string netdir="check_"+net.name;
+    net.write(netdir);
+    double mfpt_exact=calc_exact_mfpt(net);
+    string np=to_string(npaths);
+    vector<string> ab{"NODESAFILE nodes.A "+to_string(net.nodesA.size()),"NODESBFILE nodes.B "+to_string(net.nodesB.size()), \
+                      "COMMSFILE communities.dat "+to_string(net.ncomms)};
+    vector<Bench_Case> cases{
+        {"BTOA-BKL",{"WRAPPER BTOA","TRAJ BKL","BRANCHPROBS","NABPATHS "+np}},
+        {"FFS-BKL",{"WRAPPER FFS","TRAJ BKL","BRANCHPROBS","NWALKERS "+np,"FFSTRIALS "+np,"NABPATHS "+np}},
+    };
+    cout << "benchmark> exact A<-B MFPT for " << net.n_nodes << "-node chain: " << mfpt_exact << endl;
+    int n_fail=0;
+    for (Bench_Case &bcase: cases) {
+        bcase.keywords.insert(bcase.keywords.end(),ab.begin(),ab.end());
+        string dir=setup_case_dir(net,netdir,bcase,nthreads);
+        Bench_Result result;
+        run_discotress(filesystem::absolute(exe).string(),dir,result);
+        double mfpt=-1.; // MFPT estimated by the method: mean FPT of the simulated paths, or printed in the output (FFS)
+        string line;
+        if (bcase.label=="FFS-BKL") {
+            ifstream out_f(dir+"/kmc.out");
+            while (getline(out_f,line)) {
+                size_t pos=line.find("MFPT: ");
+                if (pos!=string::npos) mfpt=stod(line.substr(pos+6)); }
+        } else {
+            ifstream fpp_f(dir+"/fpp_properties.dat");
+            long long int pathno; double t, sum_t=0.; int n=0;
+            while (getline(fpp_f,line)) {
+                istringstream iss(line);
+                if (iss >> pathno >> t) { sum_t+=t; n++; } }
+            if (n>0) mfpt=sum_t/n;
+        }
+        double relerr=abs(mfpt-mfpt_exact)/mfpt_exact;
+        bool pass = result.status==0 && mfpt>0. && relerr<=tol;
+        if (!pass) n_fail++;
+        cout << left << setw(22) << bcase.label << right << fixed << setprecision(4) << "MFPT: " << setw(12) << mfpt \
+             << "   rel. deviation: " << setw(8) << relerr << (pass?"   ok":"   FAILED") << defaultfloat << endl;
+    }
+    if (n_fail>0) {
+        cout << "benchmark> " << n_fail << " method(s) deviate from the exact MFPT by more than " << tol*100. << "%" << endl;
+        exit(EXIT_FAILURE); }
+    cout << "benchmark> all MFPT estimates agree with the exact value" << endl;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc<3) {
+        cout << "usage: benchmark gen <type> <dir> [params...]\n       benchmark run <discotress> [-n npaths] [-t nthreads] " \
+             << "[-c reference file] [-o output file]\n       benchmark check <discotress> [-n npaths] [-t nthreads]" << endl;
+        exit(EXIT_FAILURE);
+    }
+    string mode=argv[1];
+    if (mode=="gen") {
+        if (argc<4) { cout << "benchmark> error: must specify network type and output directory" << endl; exit(EXIT_FAILURE); }
+        vector<double> args;
+        for (int i=4;i<argc;i++) args.push_back(stod(argv[i]));
+        Bench_Network net=gen_network(argv[2],args);
+        net.write(argv[3]);
+        cout << "benchmark> wrote network " << net.name << " with " << net.n_nodes << " nodes, " << net.conns.size() << " edges, " \
+             << net.ncomms << " communities, " << net.nodesA.size() << " nodes in A and " << net.nodesB.size() << " nodes in B" \
+             << "\nbenchmark> max. value of TAU for linearised transition matrix: " << net.min_tesc << endl;
+    } else if (mode=="run") {
+        int npaths=100, nthreads=1;
+        string ref_fname, out_fname="benchmark.dat";
+        for (int i=3;i+1<argc;i+=2) {
+            string opt=argv[i];
+            if (opt=="-n") { npaths=stoi(argv[i+1]);
+            } else if (opt=="-t") { nthreads=stoi(argv[i+1]);
+            } else if (opt=="-c") { ref_fname=argv[i+1];
+            } else if (opt=="-o") { out_fname=argv[i+1];
+            } else { cout << "benchmark> error: unrecognised option " << opt << endl; exit(EXIT_FAILURE); }
+        }
+        run_suite(argv[2],npaths,nthreads,ref_fname,out_fname);
+    } else if (mode=="check") {
+        int npaths=20000, nthreads=1;
+        for (int i=3;i+1<argc;i+=2) {
+            string opt=argv[i];
+            if (opt=="-n") { npaths=stoi(argv[i+1]);
+            } else if (opt=="-t") { nthreads=stoi(argv[i+1]);
+            } else { cout << "benchmark> error: unrecognised option " << opt << endl; exit(EXIT_FAILURE); }
+        }
+        run_check(argv[2],npaths,nthreads);
+    } else {
+        cout << "benchmark> error: unrecognised mode " << mode << endl; exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -29,6 +29,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "keywords.h"
 #include "debug_tests.h"
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -66,13 +67,16 @@ Discotress::Discotress () {
     omp_set_num_threads(my_kws.nthreads);
     cout << "discotress> simulation will use max of " << my_kws.nthreads << " threads" << endl;
     long double dummy_randno = Wrapper_Method::rand_unif_met(my_kws.seed); // seed this generator
+    PROF_START(my_kws.profileintvl,my_kws.tracebuf);
+    Mem_Accounting::budget=static_cast<long long int>(my_kws.membudget*1.e6);
+    if (my_kws.membudget>0.) cout << "discotress> memory budget: " << my_kws.membudget << " MB" << endl;
     if (my_kws.debug) debug=true;
 
     // read input files
     cout << "discotress> reading input data files..." << endl;
     const char *conns_fname="edge_conns.dat", *wts_fname="edge_weights.dat", \
                *stat_probs_fname = "stat_prob.dat";
-    vector<pair<int,int>> conns = Read_files::read_two_col<int>(conns_fname,my_kws.n_edges);
+    vector<pair<idx_t,idx_t>> conns = Read_files::read_two_col<idx_t>(conns_fname,my_kws.n_edges);
     vector<pair<long double,long double>> weights = Read_files::read_two_col<long double>(wts_fname,my_kws.n_edges);
     vector<long double> stat_probs = Read_files::read_one_col<long double>(stat_probs_fname,my_kws.n_nodes);
     vector<int> communities, bins;
@@ -81,16 +85,23 @@ Discotress::Discotress () {
         if (my_kws.binsfile!=nullptr) { bins = Read_files::read_one_col<int>(my_kws.binsfile,my_kws.n_nodes);
         } else { bins = communities; } // copy community vector to bin vector
     }
-    vector<int> nodesAvec, nodesBvec;
-    vector<int> ntrajsvec;
-    if (my_kws.wrapper_method!=2) { // simulating the A<-B TPE, read in info on A and B sets
-        nodesAvec = Read_files::read_one_col<int>(my_kws.nodesafile.c_str(),my_kws.nA);
-        nodesBvec = Read_files::read_one_col<int>(my_kws.nodesbfile.c_str(),my_kws.nB);
+    vector<idx_t> nodesAvec, nodesBvec;
+    vector<int> ntrajsvec, commstargvec;
+    vector<pair<vector<idx_t>,vector<idx_t>>> ab_queries;
+    if (my_kws.abqueries) { // batch of state reduction queries, read in info on the A and B sets of each query
+        ab_queries = Read_files::read_ab_queries(my_kws.abqueryfile,my_kws.nqueries);
+        cout << "discotress> computing state reduction quantities for a batch of " << my_kws.nqueries << " A<-B queries" << endl;
+    } else if (my_kws.wrapper_method!=2 && my_kws.wrapper_method!=9) { // simulating the A<-B TPE, read in info on A and B sets
+        nodesAvec = Read_files::read_one_col<idx_t>(my_kws.nodesafile.c_str(),my_kws.nA);
+        nodesBvec = Read_files::read_one_col<idx_t>(my_kws.nodesbfile.c_str(),my_kws.nB);
         cout << "discotress> simulating " << my_kws.nabpaths << " transition paths. Max. no. of iterations: " << my_kws.maxit << endl;
-    } else { // simulating trajectories to obtain data for coarse-graining, read in info on number of trajs for each comm
+    } else if (my_kws.wrapper_method==2) { // simulating trajectories to obtain data for coarse-graining, read in info on number of trajs for each comm
         ntrajsvec = Read_files::read_one_col<int>(my_kws.ntrajsfile,my_kws.ncomms);
         cout << "discotress> simulating trajectories of max time: " << my_kws.trajt << "   for dimensionality reduction" << endl;
     }
+    vector<idx_t> unifnodesvec;
+    if (my_kws.unifnodesfile!=nullptr) unifnodesvec = Read_files::read_one_col<idx_t>(my_kws.unifnodesfile,my_kws.nunifnodes);
+    if (my_kws.wrapper_method==3) commstargvec = Read_files::read_one_col<int>(my_kws.commstargfile,my_kws.ncomms);
     vector<double> init_probs;
     if (my_kws.initcond) init_probs = Read_files::read_one_col<double>(my_kws.initcondfile,my_kws.nB);
 
@@ -106,8 +117,11 @@ Discotress::Discotress () {
     }
     cout << "discotress> no. of nodes: " << ktn->n_nodes << "   in A: " << ktn->nodesA.size() << "   in B: " << ktn->nodesB.size() << endl;
     cout << "discotress> no. of edges: " << ktn->n_edges << "      no. of communities: " << ktn->ncomms << endl;
+    ktn->account_mem(Mem_Accounting::NETWORK);
+    if (my_kws.reversible) ktn->check_detailed_balance();
     if (my_kws.dumpwaittimes) ktn->dumpwaittimes();
     if (my_kws.initcond) ktn->set_initcond(init_probs);
+    if (!my_kws.statereduction) ktn->setup_init_tables();
     if (my_kws.statereduction && my_kws.pathlengths) { // override mean waiting times to represent mean number of steps to exit
         for (vector<Node>::iterator it_nodevec=ktn->nodes.begin();it_nodevec!=ktn->nodes.end();++it_nodevec) {
             it_nodevec->t_esc=1.L; }
@@ -116,8 +130,9 @@ Discotress::Discotress () {
     // set up Traj_Method object (method to propagate trajectories associated with Walker objects)
     cout << "discotress> setting up the object to propagate individual trajectories..." << endl;
     Traj_args traj_args{my_kws.discretetime,my_kws.statereduction,my_kws.tintvl,my_kws.dumpintvls, \
-                        my_kws.seed,my_kws.debug};
+                        my_kws.seed,my_kws.debug,my_kws.skiploops,my_kws.lazytime};
     if (my_kws.traj_method==1) {            // BKL algorithm
+        if (my_kws.nbatch>0) ktn->compile(my_kws.discretetime); // compact representation of network used by batched BKL engine
         if (my_kws.accumprobs) ktn->set_accumprobs();
         BKL *bkl_ptr = new BKL(*ktn,traj_args);
         traj_method_obj = bkl_ptr;
@@ -127,11 +142,18 @@ Discotress::Discotress () {
             SR_args sr_args{my_kws.absorption,my_kws.committor,my_kws.fundamentalirred,my_kws.fundamentalred, \
                             my_kws.gth,my_kws.mfpt};
             kps_ptr->set_statereduction_procs(sr_args);
+            if (my_kws.abqueries) kps_ptr->set_ab_queries(ab_queries);
         }
         traj_method_obj = kps_ptr;
     } else if (my_kws.traj_method==3) {     // MCAMC algorithm
         MCAMC *mcamc_ptr = new MCAMC(*ktn,my_kws.kpskmcsteps,my_kws.meanrate,traj_args);
         traj_method_obj = mcamc_ptr;
+    } else if (my_kws.traj_method==4) {     // hybrid BKL/kPS algorithm
+        int nelim=my_kws.nelim; // if not set, default is to eliminate whole trapping basins
+        if (nelim<=0) nelim=my_kws.adaptivecomms?my_kws.flickwindow:*max_element(ktn->comm_sizes.begin(),ktn->comm_sizes.end());
+        HYBRID *hybrid_ptr = new HYBRID(*ktn,nelim,my_kws.adaptivecomms,my_kws.adaptminrate,my_kws.flickwindow, \
+                                        my_kws.flickfrac,traj_args);
+        traj_method_obj = hybrid_ptr;
     } else {
         throw exception(); // a trajectory method object must be set
     }
@@ -141,13 +163,14 @@ Discotress::Discotress () {
     bool indepcomms=false; // walkers correspond to independent communities or milestones
     if (my_kws.wrapper_method==2 || my_kws.wrapper_method==6) indepcomms=true;
     Wrapper_args wrapper_args{my_kws.nwalkers,ktn->nbins,my_kws.nabpaths,my_kws.tintvl,my_kws.maxit,indepcomms, \
-                              my_kws.adaptivecomms,my_kws.seed,my_kws.debug};
+                              my_kws.adaptivecomms,my_kws.seed,my_kws.debug,my_kws.nbatch,my_kws.relerr,my_kws.minpaths, \
+                              my_kws.ckptpaths,my_kws.restart};
     if (my_kws.wrapper_method==0) {        // standard simulation of A<-B paths, no enhanced sampling
         wrapper_args.nwalkers=my_kws.nthreads;
         BTOA *btoa_ptr = new BTOA(*ktn,wrapper_args);
         wrapper_method_obj = btoa_ptr;
     } else if (my_kws.wrapper_method==1) { // standard simulation of paths of fixed total time, no enhanced sampling
-        if (my_kws.steadystate) wrapper_args.nwalkers=my_kws.nthreads;
+        wrapper_args.nwalkers=my_kws.nthreads; // walkers are indexed by thread number (not used by the batched BKL engine)
         FIXEDT *fixedt_ptr = new FIXEDT(*ktn,my_kws.trajt,my_kws.steadystate,my_kws.ssrec,wrapper_args);
         wrapper_method_obj = fixedt_ptr;
     } else if (my_kws.wrapper_method==2) { // special wrapper to simulate many short nonequilibrium trajectories for dimensionality reduction
@@ -155,15 +178,32 @@ Discotress::Discotress () {
         DIMREDN *dimredn_ptr = new DIMREDN(*ktn,ntrajsvec,my_kws.trajt,wrapper_args);
         wrapper_method_obj = dimredn_ptr;
     } else if (my_kws.wrapper_method==3) { // WE simulation
-        WE *we_ptr = new WE(*ktn,my_kws.taure,wrapper_args);
+        WE *we_ptr = new WE(*ktn,commstargvec,my_kws.taure,wrapper_args);
         wrapper_method_obj = we_ptr;
     } else if (my_kws.wrapper_method==4) { // FFS simulation
+        wrapper_args.nwalkers=my_kws.nthreads; // trajectories are propagated by each thread, NWALKERS is the no. of configurations at interfaces
+        FFS *ffs_ptr = new FFS(*ktn,my_kws.nwalkers,my_kws.ffstrials,my_kws.ffsrelerr,wrapper_args);
+        wrapper_method_obj = ffs_ptr;
     } else if (my_kws.wrapper_method==5) { // NEUS-kMC simulation
+        wrapper_args.nwalkers=my_kws.nwalkers*ktn->ncomms; // NWALKERS walkers are restrained to each community
+        NEUS *neus_ptr = new NEUS(*ktn,my_kws.taure,wrapper_args);
+        wrapper_method_obj = neus_ptr;
     } else if (my_kws.wrapper_method==6) { // milestoning simulation
+        wrapper_args.nwalkers=my_kws.nthreads; // trajectories are propagated by each thread, NWALKERS is the no. of trajectories per milestone
+        MILES *miles_ptr = new MILES(*ktn,my_kws.nwalkers,wrapper_args);
+        wrapper_method_obj = miles_ptr;
     } else if (my_kws.wrapper_method==7) { // recursive enumeration algorithm for k shortest paths problem
         wrapper_args.nwalkers=0; // REA class does not store paths in walkers vector, instead has its own arrays
         REA *rea_ptr = new REA(*ktn,my_kws.discretetime,my_kws.writerea,my_kws.reanotirred,wrapper_args);
         wrapper_method_obj = rea_ptr;
+    } else if (my_kws.wrapper_method==8) { // uniformisation for transient probability distributions and first passage time distribution
+        wrapper_args.nwalkers=0; // UNIF class does not simulate trajectories
+        UNIF *unif_ptr = new UNIF(*ktn,my_kws.discretetime,my_kws.trajt,my_kws.unifeps,unifnodesvec,wrapper_args);
+        wrapper_method_obj = unif_ptr;
+    } else if (my_kws.wrapper_method==9) { // Lanczos algorithm for slowest relaxation modes
+        wrapper_args.nwalkers=0; // SPECTRAL class does not simulate trajectories
+        SPECTRAL *spectral_ptr = new SPECTRAL(*ktn,my_kws.discretetime,my_kws.neigs,my_kws.nlanczos,my_kws.shift,wrapper_args);
+        wrapper_method_obj = spectral_ptr;
     } else {
         throw exception(); // a wrapper method object must be set
     }
@@ -227,6 +267,8 @@ int main(int argc, char** argv) {
     Discotress discotress_obj;
     if (discotress_obj.debug) run_debug_tests(*discotress_obj.ktn);
     discotress_obj.wrapper_method_obj->run_enhanced_kmc(*discotress_obj.ktn,discotress_obj.traj_method_obj);
+    PROF_REPORT();
+    Mem_Accounting::print_report();
 
     cout << "discotress> finished, exiting program normally" << endl;
 
@@ -24,13 +24,148 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
 
 using namespace std;
 
-FFS::FFS(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the communities define the order parameter for FFS: the i-th interface is crossed when a trajectory enters a node of
+   community ID >= i. Hence the initial set B must be contained in community 0 and the target set A in the community of highest ID */
+FFS::FFS(const Network &ktn, int nconfigs, int ntrials, double relerr, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    cout << "ffs> running FFS with parameters:\n  no. of interfaces: " << ktn.ncomms-1 << " \tno. of configurations at first interface: " \
+         << nconfigs << "\n  max. no. of trials per interface: " << ntrials << " \trelative error for stopping trials: " << relerr << endl;
+    this->nconfigs=nconfigs; this->ntrials=ntrials; this->relerr=relerr;
+    for (const Node *node: ktn.nodesB) {
+        if (node->comm_id!=0) {
+            cout << "ffs> error: nodes of the initial set B must belong to community 0" << endl; exit(EXIT_FAILURE); }
+    }
+    for (const Node *node: ktn.nodesA) {
+        if (node->comm_id!=ktn.ncomms-1) {
+            cout << "ffs> error: nodes of the target set A must belong to the community of highest ID" << endl; exit(EXIT_FAILURE); }
+    }
+}
 
 FFS::~FFS() {}
 
+/* main loop of FFS. The A<-B rate constant is the product of the flux through the first interface and the conditional
+   probabilities of reaching each successive interface (the last being A) before returning to B */
 void FFS::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nffs> beginning FFS simulation" << endl;
+    int nintfs=ktn.ncomms-1; // number of interfaces
+    vector<vector<const Node*>> intf_configs(nintfs+1); // configurations (nodes) stored at each interface (the last being A)
+    long double flux=calc_initial_flux(ktn,traj_method_obj,intf_configs[0]);
+    long double rate=flux; // A<-B rate constant, as product of flux and crossing probabilities
+    ofstream ffs_f; ffs_f.open("ffs.dat");
+    ffs_f.setf(ios::right,ios::adjustfield); ffs_f.setf(ios::scientific,ios::floatfield);
+    ffs_f.precision(10);
+    for (int i=0;i<nintfs;i++) {
+        int n_trials=0, n_succ=0;
+        long double p_cross=fire_trials(ktn,traj_method_obj,i+1,intf_configs[i],intf_configs[i+1],n_trials,n_succ);
+        long double p_relerr = n_succ>0?sqrt((1.L-p_cross)/static_cast<long double>(n_succ)):numeric_limits<long double>::infinity();
+        rate*=p_cross;
+        ffs_f << setw(7) << i+1 << setw(12) << n_trials << setw(12) << n_succ << setw(20) << p_cross << setw(20) << p_relerr \
+              << setw(20) << rate << endl;
+        cout << "ffs> interface " << i+1 << " \tno. of trials: " << n_trials << " \tno. of successes: " << n_succ \
+             << " \tcrossing probability: " << p_cross << " \trelative error: " << p_relerr << endl;
+        if (n_succ==0) {
+            cout << "ffs> no trial trajectories from interface " << i+1 << " reached the next interface, increase no. of trials" << endl;
+            break;
+        }
+        vector<const Node*>().swap(intf_configs[i]); // configurations at this interface are no longer needed
+    }
+    ffs_f.close();
+    cout << "ffs> finished FFS simulation. A<-B rate constant: " << rate << " \tMFPT: " << 1.L/rate << endl;
+}
+
+/* initial flux stage. Each thread propagates a trajectory from B, counting the crossings of the first interface by the trajectory
+   having last visited B, and storing the crossing configurations, until the desired number of configurations has been collected.
+   A trajectory that reaches A is recycled to B. Returns the flux through the first interface */
+long double FFS::calc_initial_flux(const Network &ktn, Traj_Method *traj_method_obj, vector<const Node*> &configs) {
+
+    cout << "ffs> initial flux stage" << endl;
+    int n_cross=0; // number of crossings of the first interface
+    long double tot_t=0.L; // total simulation time over all trajectories
+    #pragma omp parallel reduction(+:tot_t)
+    {
+    int x = omp_get_thread_num();
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    Walker &walker=walkers[x];
+    get_initial_node(ktn,walker,seed);
+    bool fromb=true; // trajectory has visited B since the last crossing of the first interface
+    int n_cross_local;
+    do {
+        traj_method_local->kmc_iteration(ktn,walker);
+        if (walker.curr_node->aorb==1) {
+            fromb=true;
+        } else {
+            if (fromb && walker.curr_node->comm_id>0) { // trajectory has crossed the first interface (possibly by entering A)
+                fromb=false;
+                #pragma omp critical
+                configs.push_back(walker.curr_node);
+                #pragma omp atomic
+                n_cross++;
+            }
+            if (walker.curr_node->aorb==-1) { // recycle trajectory to B, retaining the simulation time
+                long double t=walker.t;
+                walker.reset_walker_info(); walker.t=t;
+                get_initial_node(ktn,walker,seed);
+                fromb=true;
+            }
+        }
+        #pragma omp atomic read
+        n_cross_local=n_cross;
+    } while (n_cross_local<nconfigs);
+    tot_t+=walker.t;
+    delete traj_method_local;
+    }
+    long double flux=static_cast<long double>(n_cross)/tot_t;
+    cout << "ffs> no. of crossings of first interface: " << n_cross << " \ttotal time: " << tot_t << " \tflux: " << flux << endl;
+    return flux;
+}
+
+/* fire trial trajectories from randomly chosen configurations at the intf-th interface (i.e. with community ID >= intf) until the
+   next interface (community ID > intf) or A is reached, which is a success, or until B is reached. For the final stage, there is no
+   further interface and success requires reaching A. The final configurations of successful trials are stored. The trials are
+   propagated in parallel, in blocks, and are stopped early when the relative error of the estimated crossing probability falls
+   below the specified value. Returns the crossing probability */
+long double FFS::fire_trials(const Network &ktn, Traj_Method *traj_method_obj, int intf, const vector<const Node*> &configs, \
+        vector<const Node*> &configs_next, int &n_trials, int &n_succ) {
+
+    int blocksz=64*omp_get_max_threads(); // number of trials per block
+    n_trials=0; n_succ=0;
+    while (n_trials<ntrials) {
+        int nblock=min(blocksz,ntrials-n_trials);
+        int n_succ_block=0;
+        #pragma omp parallel reduction(+:n_succ_block)
+        {
+        int x = omp_get_thread_num();
+        Traj_Method *traj_method_local = traj_method_obj->clone();
+        Walker &walker=walkers[x];
+        #pragma omp for schedule(dynamic)
+        for (int j=0;j<nblock;j++) {
+            walker.reset_walker_info(); walker.p=0.L;
+            walker.curr_node=configs[static_cast<int>(rand_unif_met(seed)*configs.size())%configs.size()];
+            walker.prev_node=walker.curr_node;
+            for (;;) { // a configuration that has already crossed the next interface (or is in A) is an immediate success
+                if (walker.curr_node->aorb==-1 || walker.curr_node->comm_id>intf) { // success
+                    n_succ_block++;
+                    #pragma omp critical
+                    configs_next.push_back(walker.curr_node);
+                    break;
+                } else if (walker.curr_node->aorb==1) { break; } // failure
+                traj_method_local->kmc_iteration(ktn,walker);
+            }
+        }
+        delete traj_method_local;
+        }
+        n_trials+=nblock; n_succ+=n_succ_block;
+        if (relerr>0. && n_succ>0) {
+            long double p_cross=static_cast<long double>(n_succ)/static_cast<long double>(n_trials);
+            if (sqrt((1.L-p_cross)/static_cast<long double>(n_succ))<relerr) break;
+        }
+    }
+    return static_cast<long double>(n_succ)/static_cast<long double>(n_trials);
 }
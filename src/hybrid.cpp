@@ -0,0 +1,110 @@
+/*
+File containing functions relating to the hybrid BKL/kPS trajectory method.
+
+The trajectory is propagated using the rejection-free BKL algorithm, and kinetic path sampling (kPS) is used to sample an escape
+trajectory from the current trapping basin only when flickering of the walker within the basin is detected. Thus the expensive graph
+transformation is performed only in regions of the network where the dynamics are metastable.
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "kmc_methods.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+HYBRID::HYBRID(const Network &ktn, int nelim, bool adaptivecomms, double adaptminrate, int flickwindow, double flickfrac, \
+               const Traj_args &traj_args) : KPS(ktn,nelim,0,adaptivecomms,adaptminrate,traj_args) {
+
+    cout << "hybrid> hybrid BKL/kPS parameters:\n  initial length of window for flicker detection: " << flickwindow \
+         << "\tmax. fraction of distinct nodes in window for trapping: " << flickfrac << endl;
+    this->flickwindow=flickwindow; this->flickfrac=flickfrac;
+    window_len=flickwindow;
+    window_nodes.resize(window_len);
+    visit_counts.resize(ktn.n_nodes);
+}
+
+HYBRID::~HYBRID() {}
+
+HYBRID::HYBRID(const HYBRID &hybrid_obj) : KPS(hybrid_obj) {
+    this->flickwindow=hybrid_obj.flickwindow; this->flickfrac=hybrid_obj.flickfrac;
+    this->window_len=hybrid_obj.flickwindow;
+    this->window_nodes.resize(window_len);
+    this->visit_counts.resize(hybrid_obj.visit_counts.size());
+}
+
+/* a single iteration of the hybrid method is either a single BKL step or, if the walker has been detected to be trapped, a kPS
+   escape from the current trapping basin. If the kPS escape trajectory is shorter than the window, then the detection of trapping
+   was a false alarm, and the window length is doubled. If the kPS escape trajectory is much longer than the window, then the walker
+   was trapped for a long time before this was detected, and the window length is halved */
+void HYBRID::kmc_iteration(const Network &ktn, Walker &walker) {
+
+    if (!epsilon) { // first iteration of A<-B path, need to set starting node
+        epsilon = Wrapper_Method::get_initial_node(ktn,walker,seed);
+        if (tintvl>=0.) walker.dump_walker_info(true,0.,walker.curr_node,dumpintvls);
+        next_tintvl=tintvl;
+    }
+    if (trapped) {
+        unsigned long long int k_prev=walker.k;
+        KPS::kmc_iteration(ktn,walker);
+        unsigned long long int n_hops=walker.k-k_prev;
+        if (n_hops<window_len) { window_len=min(2*window_len,16*flickwindow); }
+        else if (n_hops>10*window_len) { window_len=max(window_len/2,flickwindow); }
+        if (debug) cout << "hybrid> kPS escape trajectory of " << n_hops << " hops, window length is now: " << window_len << endl;
+        reset_flicker_stats();
+        return;
+    }
+    bkl_step(walker,seed);
+    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[walker.curr_node->bin_id]=true;
+    epsilon=walker.curr_node;
+    if (epsilon->aorb==-1) return;
+    trapped=update_flicker_stats(epsilon);
+}
+
+/* update the flicker statistics in the sliding window with the newly visited node, and return true if the walker is trapped */
+bool HYBRID::update_flicker_stats(const Node *node) {
+
+    if (n_window==window_len) { // remove the oldest entry from the window
+        if (--visit_counts[window_nodes[window_pos]]==0) n_distinct--;
+    } else {
+        n_window++;
+    }
+    window_nodes[window_pos]=node->node_pos;
+    if (visit_counts[node->node_pos]++==0) n_distinct++;
+    window_pos=(window_pos+1)%window_len;
+    if (!adaptivecomms) {
+        if (node->comm_id==dwell_comm) { comm_dwell++; }
+        else { dwell_comm=node->comm_id; comm_dwell=1; }
+    }
+    return n_window==window_len && n_distinct<=flickfrac*window_len && (adaptivecomms || comm_dwell>=window_len);
+}
+
+/* reset the flicker statistics after a basin escape or when a new path is started, resizing the window if necessary */
+void HYBRID::reset_flicker_stats() {
+
+    for (int i=0;i<n_window;i++) visit_counts[window_nodes[i]]=0;
+    window_nodes.resize(window_len);
+    window_pos=0; n_window=0; n_distinct=0;
+    dwell_comm=-1; comm_dwell=0;
+    trapped=false;
+}
+
+void HYBRID::reset_nodeptrs() {
+    KPS::reset_nodeptrs();
+    reset_flicker_stats();
+}
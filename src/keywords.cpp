@@ -46,9 +46,15 @@ Keywords read_keywords(const char *kw_file) {
         if (vecstr.empty() || vecstr[0][0]=='!') continue; // blank or comment line
         // main keywords
         if (vecstr[0]=="NNODES") {
-            my_kws.n_nodes=stoi(vecstr[1]);
-        } else if (vecstr[0]=="NEDGES") {
-            my_kws.n_edges=stoi(vecstr[1]);
+            if (stoll(vecstr[1])>numeric_limits<idx_t>::max()) {
+                cout << "keywords> error: no. of nodes exceeds range of index type, compile with -DDISCOTRESS_INDEX64" << endl;
+                exit(EXIT_FAILURE); }
+            my_kws.n_nodes=stoll(vecstr[1]);
+        } else if (vecstr[0]=="NEDGES") { // note that the edges vector of a Network has an entry for each direction of an edge
+            if (stoll(vecstr[1])>numeric_limits<idx_t>::max()/2) {
+                cout << "keywords> error: no. of edges exceeds range of index type, compile with -DDISCOTRESS_INDEX64" << endl;
+                exit(EXIT_FAILURE); }
+            my_kws.n_edges=stoll(vecstr[1]);
         } else if (vecstr[0]=="WRAPPER") {
             if (vecstr[1]=="BTOA") {
                 my_kws.wrapper_method=0;
@@ -66,6 +72,10 @@ Keywords read_keywords(const char *kw_file) {
                 my_kws.wrapper_method=6;
             } else if (vecstr[1]=="REA") {
                 my_kws.wrapper_method=7;
+            } else if (vecstr[1]=="UNIF") {
+                my_kws.wrapper_method=8;
+            } else if (vecstr[1]=="SPECTRAL") {
+                my_kws.wrapper_method=9;
             } else { cout << "unrecognised WRAPPER option" << endl; exit(EXIT_FAILURE); }
         } else if (vecstr[0]=="TRAJ") {
             if (vecstr[1]=="BKL") {
@@ -74,6 +84,8 @@ Keywords read_keywords(const char *kw_file) {
                 my_kws.traj_method=2;
             } else if (vecstr[1]=="MCAMC") {
                 my_kws.traj_method=3;
+            } else if (vecstr[1]=="HYBRID") {
+                my_kws.traj_method=4;
             } else { cout << "unrecognised TRAJ option" << endl; exit(EXIT_FAILURE); }
         } else if (vecstr[0]=="NODESAFILE") {
             my_kws.nodesafile=vecstr[1];
@@ -101,14 +113,25 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.initcond=true;
         } else if (vecstr[0]=="MAXIT") {
             my_kws.maxit=stoi(vecstr[1]);
+        } else if (vecstr[0]=="MEMBUDGET") {
+            my_kws.membudget=stod(vecstr[1]);
         } else if (vecstr[0]=="NABPATHS") {
             my_kws.nabpaths=stoi(vecstr[1]);
+        } else if (vecstr[0]=="CHECKPOINT") {
+            my_kws.ckptpaths=stoi(vecstr[1]);
+        } else if (vecstr[0]=="RESTART") {
+            my_kws.restart=true;
+        } else if (vecstr[0]=="RELERR") {
+            my_kws.relerr=stod(vecstr[1]);
+            if (vecstr.size()>2) my_kws.minpaths=stoi(vecstr[2]);
         } else if (vecstr[0]=="TINTVL") {
             my_kws.tintvl=stod(vecstr[1]);
         // optional keywords relating to enhanced sampling methods
         } else if (vecstr[0]=="ADAPTIVECOMMS") {
             my_kws.adaptivecomms=true;
             my_kws.adaptminrate=stod(vecstr[1]);
+        } else if (vecstr[0]=="BATCHWALKERS") {
+            my_kws.nbatch=stoi(vecstr[1]);
         } else if (vecstr[0]=="COMMSTARGFILE") {
             my_kws.commstargfile = new char[vecstr[1].size()+1];
             copy(vecstr[1].begin(),vecstr[1].end(),my_kws.commstargfile);
@@ -117,16 +140,27 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.ntrajsfile = new char[vecstr[1].size()+1];
             copy(vecstr[1].begin(),vecstr[1].end(),my_kws.ntrajsfile);
             my_kws.ntrajsfile[vecstr[1].size()]='\0';
+        } else if (vecstr[0]=="FFSTRIALS") {
+            my_kws.ffstrials=stoi(vecstr[1]);
+            if (vecstr.size()>2) my_kws.ffsrelerr=stod(vecstr[2]);
+        } else if (vecstr[0]=="FLICKER") {
+            my_kws.flickwindow=stoi(vecstr[1]);
+            if (vecstr.size()>2) my_kws.flickfrac=stod(vecstr[2]);
         } else if (vecstr[0]=="KPSKMCSTEPS") {
             my_kws.kpskmcsteps=stoi(vecstr[1]);
         } else if (vecstr[0]=="MEANRATE") {
             my_kws.meanrate=true;
         } else if (vecstr[0]=="NELIM") {
             my_kws.nelim=stoi(vecstr[1]);
+        } else if (vecstr[0]=="NEIGS") {
+            my_kws.neigs=stoi(vecstr[1]);
+            if (vecstr.size()>2) my_kws.nlanczos=stoi(vecstr[2]);
         } else if (vecstr[0]=="NWALKERS") {
             my_kws.nwalkers=stoi(vecstr[1]);
 	} else if (vecstr[0]=="REANOTIRRED") {
 	    my_kws.reanotirred=true;
+        } else if (vecstr[0]=="SHIFTINVERT") {
+            my_kws.shift=stod(vecstr[1]);
 	} else if (vecstr[0]=="STEADYSTATE") {
 	    my_kws.steadystate=true;
 	    my_kws.ssrec=stod(vecstr[1]);
@@ -134,9 +168,22 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.taure=stod(vecstr[1]);
         } else if (vecstr[0]=="TRAJT") {
             my_kws.trajt=stold(vecstr[1]);
+        } else if (vecstr[0]=="UNIFEPS") {
+            my_kws.unifeps=stod(vecstr[1]);
+        } else if (vecstr[0]=="UNIFNODESFILE") {
+            my_kws.unifnodesfile = new char[vecstr[1].size()+1];
+            copy(vecstr[1].begin(),vecstr[1].end(),my_kws.unifnodesfile);
+            my_kws.unifnodesfile[vecstr[1].size()]='\0';
+            my_kws.nunifnodes=stoi(vecstr[2]);
         } else if (vecstr[0]=="WRITEREA") {
             my_kws.writerea=true;
         // keywords for state reduction procedures
+        } else if (vecstr[0]=="ABQUERYFILE") {
+            my_kws.abqueryfile = new char[vecstr[1].size()+1];
+            copy(vecstr[1].begin(),vecstr[1].end(),my_kws.abqueryfile);
+            my_kws.abqueryfile[vecstr[1].size()]='\0';
+            my_kws.nqueries=stoi(vecstr[2]);
+            my_kws.abqueries=true;
         } else if (vecstr[0]=="ABSORPTION") {
             my_kws.absorption=true;
         } else if (vecstr[0]=="COMMITTOR") {
@@ -162,15 +209,25 @@ Keywords read_keywords(const char *kw_file) {
             my_kws.discretetime=true;
         } else if (vecstr[0]=="DUMPWAITTIMES") {
             my_kws.dumpwaittimes=true;
+        } else if (vecstr[0]=="LAZYTIME") {
+            my_kws.lazytime=true;
         } else if (vecstr[0]=="NOLOOP") {
             my_kws.noloop=true;
         } else if (vecstr[0]=="NTHREADS") {
             my_kws.nthreads=stoi(vecstr[1]);
             assert((my_kws.nthreads>0 && my_kws.nthreads<=omp_get_max_threads()));
+        } else if (vecstr[0]=="PROFILEINTVL") {
+            my_kws.profileintvl=stod(vecstr[1]);
+        } else if (vecstr[0]=="REVERSIBLE") {
+            my_kws.reversible=true;
         } else if (vecstr[0]=="SEED") {
             my_kws.seed=stoi(vecstr[1]);
+        } else if (vecstr[0]=="SKIPLOOPS") {
+            my_kws.skiploops=true;
         } else if (vecstr[0]=="TAU") {
             my_kws.tau=stold(vecstr[1]);
+        } else if (vecstr[0]=="TRACE") {
+            my_kws.tracebuf=vecstr.size()>1?stoi(vecstr[1]):65536;
         } else {
             cout << "keywords> error: unrecognised keyword: " << vecstr[0] << endl;
             exit(EXIT_FAILURE);
@@ -184,12 +241,25 @@ Keywords read_keywords(const char *kw_file) {
 
 /* function to check necessary keywords and keyword compatability */
 void Keywords::check_keywords() {
-    if (n_nodes<=0 || n_edges<=0 || ((nA<=0 || nB<=0) && wrapper_method!=2)) {
+    if (n_nodes<=0 || n_edges<=0 || ((nA<=0 || nB<=0) && wrapper_method!=2 && wrapper_method!=9 && !abqueries)) {
         cout << "keywords> error: network parameters not set correctly" << endl; exit(EXIT_FAILURE); }
-    if ((nabpaths<=0 && wrapper_method!=2) || maxit<=0) {
+    if ((nabpaths<=0 && wrapper_method!=2 && wrapper_method!=8 && wrapper_method!=9) || maxit<=0) {
         cout << "keywords> error: termination condition not specified correctly" << endl; exit(EXIT_FAILURE); }
     if (commsfile!=nullptr && ncomms<=1) {
         cout << "keywords> error: there must be at least two communities in the specified partitioning" << endl; exit(EXIT_FAILURE); }
+    if (relerr<0. || (relerr>0. && (wrapper_method!=0 || minpaths<2 || statereduction))) {
+        cout << "keywords> error: early termination based on the relative error of the MFPT requires WRAPPER BTOA" << endl; exit(EXIT_FAILURE); }
+    if (ckptpaths<0 || (restart && ckptpaths==0) || \
+        (ckptpaths>0 && (statereduction || !(wrapper_method==0 || (wrapper_method==1 && traj_method==1))))) {
+        cout << "keywords> error: checkpointing requires WRAPPER BTOA, or WRAPPER FIXEDT with TRAJ BKL" << endl; exit(EXIT_FAILURE); }
+    #ifndef DISCOTRESS_PROFILE
+    if (profileintvl>0. || tracebuf>0) {
+        cout << "keywords> error: PROFILEINTVL and TRACE require compilation with the flag -DDISCOTRESS_PROFILE" << endl; exit(EXIT_FAILURE); }
+    #endif
+    if (membudget<0.) {
+        cout << "keywords> error: invalid memory budget" << endl; exit(EXIT_FAILURE); }
+    if (tracebuf<0) {
+        cout << "keywords> error: invalid size of the buffer for trace events" << endl; exit(EXIT_FAILURE); }
     if (dumpintvls && tintvl<=0.) {
         cout << "keywords> error: invalid time interval for dumping trajectory data" << endl; exit(EXIT_FAILURE); }
     if (traj_method<=0 || wrapper_method<0) {
@@ -198,10 +268,14 @@ void Keywords::check_keywords() {
         cout << "keywords> error: if reading in transition probs for DTMC or otherwise not using branching probs, must specify tau as lag time" << endl;
         exit(EXIT_FAILURE); }
     // set the purpose of the computation to be a state reduction procedure and not a dynamical simulation, if appropriate
+    if (abqueries && (nqueries<=0 || !(committor || mfpt) || absorption || fundamentalred || fundamentalirred || gth || initcond)) {
+        cout << "keywords> error: a batch of A<-B queries computes only committor probabilities and/or MFPTs" << endl; exit(EXIT_FAILURE); }
     if (committor || absorption || fundamentalred || fundamentalirred || mfpt || gth) {
         assert(nabpaths==1);
         if (wrapper_method!=0 || traj_method!=2) {
             cout << "keywords> error: to perform a state reduction computation, must set WRAPPER BTOA and TRAJ KPS" << endl; exit(EXIT_FAILURE); }
+        if (abqueries) { // A and B sets are read from the query file, and all intermediate nodes are eliminated irrespective of NELIM
+            statereduction=true; nthreads=1; return; }
         if (ncomms!=2) {
             cout << "keywords> error: a state reduction computation uses only two communities (namely, not A and A)" << endl; exit(EXIT_FAILURE); }
         if ((gth || fundamentalirred) && nA!=1) {
@@ -222,25 +296,41 @@ void Keywords::check_keywords() {
             cout << "keywords> error: simulation of fixed-time paths not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==2) { // special wrapper method to propagate trajectories required for dimensionality reduction
         if (ntrajsfile==nullptr || trajt<=0. || commsfile==nullptr || meanrate || initcondfile || \
-            traj_method==1 || nA!=0 || nB!=0 || !dumpintvls) {
+            (traj_method==1 && nbatch==0) || nA!=0 || nB!=0 || !dumpintvls) {
             cout << "keywords> error: dimensionality reduction simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==3) { // WE simulation
-        if (taure<=0. || (commsfile!=nullptr && !adaptivecomms) || nwalkers<1 || \
-            (commstargfile!=nullptr && !adaptivecomms) || traj_method!=1) {
+        if (taure<=0. || commsfile==nullptr || commstargfile==nullptr || adaptivecomms || nwalkers<1 || \
+            nB<1 || traj_method!=1) {
             cout << "keywords> error: WE simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==4) { // FFS simulation
-        if (commsfile==nullptr) {
+        if (commsfile==nullptr || ncomms<2 || nwalkers<1 || ffstrials<1 || ffsrelerr<0. || adaptivecomms || \
+            nA<1 || nB<1 || traj_method!=1) {
             cout << "keywords> error: FFS simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==5) { // NEUS simulation
-        if (commsfile==nullptr || traj_method!=1 || nwalkers<1) {
+        if (commsfile==nullptr || traj_method!=1 || nwalkers<1 || taure<=0. || adaptivecomms || nA<1 || nB<1) {
             cout << "keywords> error: NEUS simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==6) { // milestoning simulation
-        if (commsfile==nullptr || nwalkers<1) {
+        if (commsfile==nullptr || nwalkers<1 || adaptivecomms || nA<1 || nB<1 || traj_method!=1) {
             cout << "keywords> error: milestoning simulation not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (wrapper_method==7) { // recursive enumeration algorithm for k shortest paths
         if (nA!=1 || nB!=1 || nabpaths<1 || (discretetime && !noloop) || (!discretetime && !branchprobs)) {
             cout << "keywords> error: REA k shortest paths computation not specified correctly" << endl; exit(EXIT_FAILURE); }
+    } else if (wrapper_method==8) { // uniformisation for transient probability distributions
+        if (nA<1 || nB<1 || trajt<=0. || tintvl<=0. || trajt<tintvl || unifeps<=0. || accumprobs || \
+            (discretetime && noloop) || (unifnodesfile!=nullptr && nunifnodes<1)) {
+            cout << "keywords> error: uniformisation computation not specified correctly" << endl; exit(EXIT_FAILURE); }
+    } else if (wrapper_method==9) { // Lanczos algorithm for slowest relaxation modes
+        if (!reversible || neigs<1 || (nlanczos>0 && nlanczos<neigs) || shift<0. || accumprobs || (discretetime && noloop)) {
+            cout << "keywords> error: spectral analysis not specified correctly" << endl; exit(EXIT_FAILURE); }
     }
+    if (nbatch<0 || (nbatch>0 && (traj_method!=1 || !(wrapper_method==1 || wrapper_method==2) || steadystate))) {
+        cout << "keywords> error: batched BKL engine can only be used with TRAJ BKL, and WRAPPER FIXEDT or DIMREDN" << endl; exit(EXIT_FAILURE); }
+    if (skiploops && (!discretetime || noloop || wrapper_method!=0 || !(traj_method==1 || traj_method==2))) {
+        cout << "keywords> error: skipping self-loops requires DISCRETETIME without NOLOOP, WRAPPER BTOA and TRAJ BKL or KPS" << endl;
+        exit(EXIT_FAILURE); }
+    if (lazytime && (discretetime || wrapper_method!=0 || traj_method!=1 || tintvl>=0. || dumpintvls)) {
+        cout << "keywords> error: lazy sampling of path times requires a CTMC, WRAPPER BTOA and TRAJ BKL, with no time-resolved output" << endl;
+        exit(EXIT_FAILURE); }
     // check specification of trajectory method is valid
     if (traj_method==1) { // BKL algorithm
         // ...
@@ -248,7 +338,39 @@ void Keywords::check_keywords() {
         if ((commsfile==nullptr && !adaptivecomms) || nelim<=0) {
             cout << "keywords> error: kPS algorithm not specified correctly" << endl; exit(EXIT_FAILURE); }
     } else if (traj_method==3) { // MCAMC algorithm
-        if (branchprobs || noloop) {
+        if (branchprobs || noloop || commsfile==nullptr || adaptivecomms) {
             cout << "keywords> error: MCAMC algorithm not specified correctly" << endl; exit(EXIT_FAILURE); }
+    } else if (traj_method==4) { // hybrid BKL/kPS algorithm
+        if ((commsfile==nullptr && !adaptivecomms) || flickwindow<=1 || flickfrac<=0. || flickfrac>=1. || \
+            !(wrapper_method==0 || wrapper_method==1)) {
+            cout << "keywords> error: hybrid BKL/kPS algorithm not specified correctly" << endl; exit(EXIT_FAILURE); }
+    }
+}
+
+/* read the A and B sets for a batch of state reduction queries. Each line of the file has the format:
+   <name of file with IDs of nodes in A> <no. of nodes in A> <name of file with IDs of nodes in B> <no. of nodes in B> */
+vector<pair<vector<idx_t>,vector<idx_t>>> Read_files::read_ab_queries(const char *inpfname, int nqueries) {
+
+    string line;
+    ifstream inp_f;
+    if (!ifstream(inpfname).good()) throw exception(); // check file exists
+    inp_f.open(inpfname);
+    vector<pair<vector<idx_t>,vector<idx_t>>> ab_queries;
+    while (getline(inp_f,line)) {
+        vector<string> vecstr;
+        istringstream iss(line);
+        copy(istream_iterator<string>(iss),istream_iterator<string>(),back_inserter(vecstr));
+        if (vecstr.empty()) continue;
+        if (vecstr.size()!=4) {
+            cout << "keywords> error: each line of file " << inpfname << " must specify the files and sizes for an A and a B set" << endl;
+            exit(EXIT_FAILURE); }
+        ab_queries.emplace_back(make_pair(read_one_col<idx_t>(vecstr[0].c_str(),stoll(vecstr[1])), \
+                                          read_one_col<idx_t>(vecstr[2].c_str(),stoll(vecstr[3]))));
+    }
+    inp_f.close();
+    if (ab_queries.size()!=nqueries) {
+        cout << "keywords> error: no. of queries in file " << inpfname << " not consistent with specified input" << endl;
+        throw exception();
     }
+    return ab_queries;
 }
@@ -31,6 +31,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <typeinfo>
 #include <iostream>
 #include <omp.h>
+#include "network.h"
 
 using namespace std;
 
@@ -42,11 +43,13 @@ struct Keywords {
         if (commstargfile) delete[] commstargfile;
         if (binsfile) delete[] binsfile;
         if (ntrajsfile) delete[] ntrajsfile;
+        if (abqueryfile) delete[] abqueryfile;
+        if (unifnodesfile) delete[] unifnodesfile;
     }
 
     /* main keywords (see documentation). Here, -1 represents a value that must be set if the parameter is mandatory given
        the combination of chosen keywords. Values of 0 are default values that are valid in any case */
-    int n_nodes=0, n_edges=0; // "NNODES" / "NEDGES" number of nodes / number of (bidirectional) edges in Markov chain
+    idx_t n_nodes=0, n_edges=0; // "NNODES" / "NEDGES" number of nodes / number of (bidirectional) edges in Markov chain
     /* choice of enhanced sampling method to wrap simulation of a trajectory ensemble */
     int wrapper_method=-1;    // "WRAPPER" enhanced sampling method (note that there is no default)
     /* choice of kinetic Monte Carlo method to propagate individual trajectories */
@@ -62,29 +65,47 @@ struct Keywords {
     bool dumpintvls=false;    // "DUMPINTVLS" trajectory data is dumped at fixed time intervals
     char *initcondfile=nullptr; // "INITCOND" name of file where nonequilibrium initial probs of nodes in B are specified
     int maxit=numeric_limits<int>::max(); // "MAXIT" maximum number of iterations of the relevant standard or enhanced kMC algorithm
+    double membudget=0.;      // "MEMBUDGET" memory budget (MB) for the main data structures (kPS subnetworks are reduced in size to fit)
     int nabpaths=-1;          // "NABPATHS" target number of complete A-B paths to simulate
     double tintvl=-1.;        // "TINTVL" time interval for writing trajectory data
+    int ckptpaths=0;          // "CHECKPOINT" number of paths (or blocks of walkers if BATCHWALKERS) between writing checkpoint files
+    bool restart=false;       // "RESTART" restart the simulation from the checkpoint file
+    double relerr=0.;         // "RELERR" target relative error of the MFPT, at which the simulation of A<-B paths is terminated (BTOA)
+    int minpaths=32;          // "RELERR" min. number of A<-B paths to simulate before the relative error is checked
 
     // optional keywords pertaining to enhanced sampling methods
+    int nbatch=0;             // "BATCHWALKERS" number of walkers propagated in lockstep by each thread with the batched BKL engine (FIXEDT and DIMREDN)
     bool adaptivecomms=false; // "ADAPTIVECOMMS" communities for resampling (WE-kMC) or trapping basins (kPS) are determined on-the-fly
     double adaptminrate=0.;   // "ADAPTIVECOMMS" minimum transition rate to include in the BFS procedure to define a community on-the-fly
     char *commstargfile=nullptr; // "COMMSTARGFILE" name of file where target number of trajectories in each community is defined (WE-kMC)
     char *ntrajsfile=nullptr; // "DIMREDUCTION" name of file where number of short trajectories to be ran from each community are defined
+    int ffstrials=-1;         // "FFSTRIALS" max number of trial trajectories fired from each interface (FFS)
+    double ffsrelerr=0.;      // "FFSTRIALS" trials from an interface stop when the relative error of the crossing probability is below this value (FFS)
+    int flickwindow=100;      // "FLICKER" initial length of the window of BKL steps used to detect trapping of the walker (HYBRID)
+    double flickfrac=0.2;     // "FLICKER" walker is trapped if at most this fraction of the window are distinct nodes (HYBRID)
     int kpskmcsteps=0;        // "KPSKMCSTEPS" number of BKL kMC steps after a trapping basin escape (kPS or MCAMC)
     bool meanrate=false;      // "MEANRATE" use the approximate mean rate method in MCAMC, instead of the exact FPTA method (default)
-    int nelim=-1;             // "NELIM" maximum number of states to be eliminated from any trapping basin (kPS)
+    int nelim=-1;             // "NELIM" maximum number of states to be eliminated from any trapping basin (kPS and HYBRID)
+    int neigs=0;              // "NEIGS" number of eigenpairs (slowest relaxation modes) to be computed (SPECTRAL)
+    int nlanczos=0;           // "NEIGS" number of Lanczos vectors before a restart (SPECTRAL). Default is max(2*neigs,neigs+20)
     int nwalkers=-1;          // "NWALKERS" for certain enhanced sampling (WRAPPER) methods, number of independent trajectories on the network. For
                               //      certain other enhanced sampling methods, this parameter is ignored and overriden to a default value
     bool reanotirred=false;   // "REANOTIRRED" prevents throwing of errors when a candidate path cannot be found in the REA (expected behaviour for
                               //      reducible, but not irreducible, Markov chains)
+    double shift=0.;          // "SHIFTINVERT" shift for the shift-invert Lanczos algorithm, zero if not used (SPECTRAL)
     bool steadystate=false;   // "STEADYSTATE" indicates that a small number of trajectories are to be used to estimate steady state dynamical properties
     double ssrec=0.;          // "STEADYSTATE" time interval after which the trajectory is considered to be equilibriated and recording of steady state
                               //      A<-B transition path ensemble statistics begins
     double taure=0.;          // "TAURE" time between resampling ensemble of trajectories (WE)
     long double trajt=0.;     // "TRAJT" max time for trajectories (when simulating trajectories of fixed total time)
+    double unifeps=1.E-10;    // "UNIFEPS" max. truncation error of the Poisson series over all time intervals (UNIF)
+    char *unifnodesfile=nullptr; // "UNIFNODESFILE" name of file containing IDs of nodes for which occupation probabilities are written (UNIF)
+    int nunifnodes=0;         // "UNIFNODESFILE" number of nodes for which occupation probabilities are written (UNIF)
     bool writerea=false;      // "WRITEREA" if WRAPPER REA, write trajectory data for the k shortest paths to output files
 
     // keywords for state reduction methods
+    char *abqueryfile=nullptr; // "ABQUERYFILE" name of file listing the A and B sets for a batch of state reduction queries
+    int nqueries=0;           // "ABQUERYFILE" number of A<-B queries in the batch
     bool absorption=false;    // "ABSORPTION" specifies that an absorption probability calculation is to be performed
     bool committor=false;     // "COMMITTOR" specifies that a committor probability calculation is to be performed instead of a kPS simulation
     bool fundamentalirred=false; // "FUNDAMENTALIRRED" specifies that the fundamental matrix of an irreducible Markov chain is to be computed
@@ -100,14 +121,20 @@ struct Keywords {
     bool discretetime=false;  // "DISCRETETIME" edge weights are read in as transition probabilities (instead of log transition rates). The provided
                               //                edge weights therefore represent a discrete-time Markov chain (DTMC) at lag time tau
     bool dumpwaittimes=false; // "DUMPWAITTIMES" print waiting times for nodes to file "meanwaitingtimes.dat"
+    bool lazytime=false;      // "LAZYTIME" (for a CTMC) record numbers of steps from nodes and sample the total path time only when A is hit
     bool noloop=false;        // "NOLOOP" (for a DTMC) renormalize lag times for nodes and outgoing transition probabilities to subsume self-loops
     int nthreads=omp_get_max_threads(); // number of threads to use in parallel calculations
+    double profileintvl=-1.;  // "PROFILEINTVL" interval of wall time (s) for writing the profile report (requires -DDISCOTRESS_PROFILE)
+    bool reversible=false;    // "REVERSIBLE" the Markov chain satisfies detailed balance, which is validated when the network is set up
+    int tracebuf=0;           // "TRACE" size of the ring buffer of trace events for each thread (requires -DDISCOTRESS_PROFILE)
     int seed=17;              // "SEED" seed for random number generators
+    bool skiploops=false;     // "SKIPLOOPS" (for a DTMC) sample the number of consecutive self-loop transitions in a single BKL step
     long double tau=-1.;      // "TAU" lag time (DTMC) or mean waiting time in linearised transition matrix (CTMC if not using branching probabilities)
 
     // implicitly set switches
     bool initcond=false;      // "INITCOND" specifies if a nonequilibrium initial condition for the nodes in set B has been set
     bool statereduction=false; // is true when the purpose of the computation is to perform a state reduction procedure
+    bool abqueries=false;     // is true when a batch of A<-B state reduction queries share a single graph transformation
 
     void check_keywords();    // function to check that keyword specification is appropriate
 };
@@ -120,7 +147,7 @@ class Read_files {
 
     // read a two-column file
     template <typename T>
-    static vector<pair<T,T>> read_two_col(const char *inpfname, int nlines=0) {
+    static vector<pair<T,T>> read_two_col(const char *inpfname, idx_t nlines=0) {
 
     string line;
     ifstream inp_f;
@@ -134,6 +161,8 @@ class Read_files {
         if (vecstr.size()!=2) { exit(EXIT_FAILURE); }
         if (typeid(T)==typeid(int)) {
             vec_data.emplace_back(make_pair(stoi(vecstr[0]),stoi(vecstr[1])));
+        } else if (typeid(T)==typeid(long long int)) {
+            vec_data.emplace_back(make_pair(stoll(vecstr[0]),stoll(vecstr[1])));
         } else if (typeid(T)==typeid(double)) {
             vec_data.emplace_back(make_pair(stod(vecstr[0]),stod(vecstr[1])));
         } else if (typeid(T)==typeid(long double)) {
@@ -152,7 +181,7 @@ class Read_files {
 
     // read a one-column file
     template <typename T>
-    static vector<T> read_one_col(const char *inpfname, int nlines=0) {
+    static vector<T> read_one_col(const char *inpfname, idx_t nlines=0) {
 
     string line;
     vector<T> vec_data;
@@ -162,6 +191,8 @@ class Read_files {
     while (getline(inp_f,line)) {
         if (typeid(T)==typeid(int)) {
             vec_data.emplace_back(stoi(line));
+        } else if (typeid(T)==typeid(long long int)) {
+            vec_data.emplace_back(stoll(line));
         } else if (typeid(T)==typeid(double)) {
             vec_data.emplace_back(stod(line));
         } else if (typeid(T)==typeid(long double)) {
@@ -178,6 +209,8 @@ class Read_files {
     return vec_data;
     }
 
+    static vector<pair<vector<idx_t>,vector<idx_t>>> read_ab_queries(const char*,int); // read the A and B sets for a batch of queries
+
 };
 
 #endif
@@ -21,11 +21,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "kmc_methods.h"
 #include <random>
 #include <queue>
+#include <map>
+#include <numeric>
 #include <string>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <filesystem>
 
 using namespace std;
 
@@ -33,6 +37,7 @@ Walker::~Walker() {}
 
 /* write trajectory data to walker file */
 void Walker::dump_walker_info(bool newpath, long double time, const Node *the_node, bool intvl) {
+    PROF_SCOPE(PROF_OUTPUT);
     if (curr_node==nullptr) throw exception();
     ofstream walker_f;
     string walker_fname="walker."+to_string(this->walker_id)+"."+to_string(this->path_no)+".dat";
@@ -48,6 +53,7 @@ void Walker::dump_walker_info(bool newpath, long double time, const Node *the_no
 
 /* append first passage path properties to file */
 void Walker::dump_fpp_properties() {
+    PROF_SCOPE(PROF_OUTPUT);
     ofstream pathprops_f;
     pathprops_f.open("fpp_properties.dat",ios_base::app);
     pathprops_f.setf(ios::right,ios::adjustfield); pathprops_f.setf(ios::scientific,ios::floatfield);
@@ -65,7 +71,9 @@ void Walker::reset_walker_info() {
 Wrapper_Method::Wrapper_Method(const Wrapper_args &wrapper_args) {
     this->nabpaths=wrapper_args.nabpaths; this->tintvl=wrapper_args.tintvl;
     this->maxit=wrapper_args.maxit; this->adaptivecomms=wrapper_args.adaptivecomms;
-    this->seed=wrapper_args.seed; this->debug=wrapper_args.debug;
+    this->seed=wrapper_args.seed; this->debug=wrapper_args.debug; this->nbatch=wrapper_args.nbatch;
+    this->mfptrelerr=wrapper_args.relerr; this->minpaths=wrapper_args.minpaths;
+    this->ckptpaths=wrapper_args.ckptpaths; this->restart=wrapper_args.restart;
     if (wrapper_args.nwalkers==0) return; // nwalkers=0 for REA, where walkers, visitations, committors etc vectors are not used
     walkers.resize(wrapper_args.nwalkers);
     for (int i=0;i<wrapper_args.nwalkers;i++) {
@@ -84,100 +92,92 @@ Wrapper_Method::Wrapper_Method(const Wrapper_args &wrapper_args) {
 Wrapper_Method::~Wrapper_Method() {}
 
 /* sample an initial node (from the B set) and set this node as the starting node of the walker.
-   In dimensionality reduction calculations, the B set is not specified. Therefore, instead, a set of nodes constituting the
-   community with the same ID as the walker ID is constructed. */
+   In dimensionality reduction calculations, the B set is not specified. Therefore, instead, the initial node is sampled from
+   the community with the same ID as the walker ID. The probability distributions are precomputed as alias tables (see
+   Network::setup_init_tables()), so that the initial node is sampled in constant time. */
 const Node *Wrapper_Method::get_initial_node(const Network &ktn, Walker &walker, int seed) {
 
+    const Alias_Table *init_table; // table for the probability distribution of the set of possible initial nodes
+    if (!ktn.nodesB.empty()) { init_table=&ktn.init_tables[0];
+    } else if (walker.walker_id>=0 && walker.walker_id<ktn.init_tables.size()) { init_table=&ktn.init_tables[walker.walker_id];
+    } else { throw Network::Network_exception(); }
     const Node *node_b=nullptr; // sampled starting node
-    long double pi_B = -numeric_limits<long double>::infinity(); // (log) occupation probability of all nodes in initial set B
-    vector<pair<const Node*,double>> b_probs;
-    set<const Node*> nodesinB;
-    if (!ktn.nodesB.empty()) {
-        nodesinB = ktn.nodesB;
+    if (init_table->nodes.size()==1) { // there is only one node in the starting set
+        node_b=init_table->nodes[0];
     } else {
-        for (int i=0;i<ktn.n_nodes;i++) {
-            if (ktn.nodes[i].comm_id==walker.walker_id) nodesinB.insert(&ktn.nodes[i]); }
-    }
-    b_probs.resize(nodesinB.size()); // accumulated probs of selecting starting node
-    set<const Node*>::iterator it_set = nodesinB.begin();
-    if (nodesinB.size()==1) { // there is only one node in the starting set
-        node_b=*it_set;
-        pi_B=(*it_set)->pi;
-    } else if (!ktn.initcond) { // no initial condition was set, choose node in set B in proportion to stationary probs
-        while (it_set!=nodesinB.end()) {
-            pi_B = log(exp(pi_B)+exp((*it_set)->pi));
-            it_set++; }
-        it_set = nodesinB.begin();
-        double cum_prob=0.;
-        while (it_set!=nodesinB.end()) {
-            cum_prob += exp((*it_set)->pi-pi_B);
-            b_probs.push_back(make_pair((*it_set),cum_prob));
-            it_set++; }
-    } else { // choose node in set B in proportion to specified initial condition probs
-        pi_B=0.L; // for specified initial condition, sum of probabilities should be unity
-        double cum_prob=0.; int i=0;
-        while (it_set!=nodesinB.end()) {
-            cum_prob += ktn.init_probs[i];
-            b_probs.push_back(make_pair(*it_set,cum_prob));
-            i++; it_set++;
-        }
-    }
-    if (node_b==nullptr) { // if there was more than one node in B, sample the initial node
-        double rand_no = Wrapper_Method::rand_unif_met(seed);
-        vector<pair<const Node*,double>>::iterator it_vec = b_probs.begin();
-        while (it_vec!=b_probs.end()) {
-            if ((*it_vec).second>=rand_no) { node_b=(*it_vec).first; break; }
-            it_vec++; }
-        if (it_vec==b_probs.end()) node_b=(*it_vec).first;
+        node_b=init_table->sample(Wrapper_Method::rand_unif_met(seed));
     }
     if (node_b==nullptr) throw exception();
     walker.curr_node=&(*node_b);
     walker.prev_node=walker.curr_node;
-    walker.p=-1.L*(node_b->pi-pi_B); // factor in path probability corresponding to initial occupation of node
+    walker.p=-1.L*(node_b->pi-init_table->pi_set); // factor in path probability corresponding to initial occupation of node
     if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[node_b->bin_id]=true;
     return node_b;
 }
 
+/* set up a block of nwalk walkers with the given walker ID and consecutive path numbers starting from first_path_no, to be
+   propagated in lockstep by the batched BKL engine */
+void Wrapper_Method::setup_batch(vector<Walker> &batch, int walker_id, int first_path_no, int nwalk, int nbins) {
+    batch.resize(nwalk);
+    for (int i=0;i<nwalk;i++) {
+        batch[i] = {walker_id:walker_id,path_no:first_path_no+i,k:0,t:0.L,p:-numeric_limits<double>::infinity(),s:0.L};
+        batch[i].prev_node=nullptr; batch[i].curr_node=nullptr;
+        batch[i].visited.assign(nbins,false);
+    }
+}
+
 /* function to set the Traj_Method member function to propagate individual trajectories */
 void Wrapper_Method::set_standard_kmc(void(*kmcfuncptr)(Walker&)) {
     kmc_func = kmcfuncptr;
 }
 
-/* use breadth-first search (BFS) procedure to find a community on-the-fly, based on a maximum size of the community
-   and a specified transition rate cutoff */
-vector<int> Wrapper_Method::find_comm_onthefly(const Network &ktn, const Node *init_node, \
-        double adaptminrate, int maxsz) {
+/* constructor for Sparse_BFS engine; the rate threshold is stored as a log rate so that the exp() of edges is not needed */
+Sparse_BFS::Sparse_BFS(idx_t n_nodes, double adaptminrate) {
+    epochs.resize(n_nodes,0); flags.resize(n_nodes); n_comm_edges.resize(n_nodes);
+    log_minrate = adaptminrate>0.?log(static_cast<long double>(adaptminrate)):-numeric_limits<long double>::infinity();
+}
 
-    vector<int> nodes_in_comm(ktn.n_nodes); // store flags indicating if node is of community or is part of absorbing boundary
-    queue<int> nbr_queue; // queue of node IDs to visit in the BFS procedure
-    nbr_queue.push(init_node->node_id);
-    int nv=0; // number of nodes in the community being built up
-    while (!nbr_queue.empty() && nv<maxsz) {
-        int curr_node_id = nbr_queue.front();
+/* BFS from the initial node, adding nodes connected by a transition of rate greater than the threshold to the community until the
+   maximum size is reached. Nodes adjacent to the community that are not themselves in the community form the absorbing boundary.
+   The numbers of community nodes, boundary nodes and edges of the corresponding subnetwork are updated incrementally. If comm_id is
+   non-negative, only nodes of the pre-defined community with this ID are added to the community */
+void Sparse_BFS::find_comm(const Network &ktn, const Node *init_node, int maxsz, int comm_id) {
+
+    if (++epoch==0) { fill(epochs.begin(),epochs.end(),0); epoch=1; } // epoch counter has wrapped around
+    touched.clear();
+    N_B=0; N_c=0; N_e=0;
+    queue<idx_t> nbr_queue; // queue of node positions to visit in the BFS procedure
+    nbr_queue.push(init_node->node_pos);
+    epochs[init_node->node_pos]=epoch; flags[init_node->node_pos]=3; n_comm_edges[init_node->node_pos]=0;
+    touched.push_back(init_node->node_pos); N_c++;
+    while (!nbr_queue.empty() && N_B<maxsz) {
+        idx_t curr_pos = nbr_queue.front();
         nbr_queue.pop();
-        nodes_in_comm[curr_node_id-1]=2; nv++; // indicates that node is part of the current community
-        const Node *nodeptr = &ktn.nodes[curr_node_id-1];
-        const Edge *edgeptr = nodeptr->top_from;
+        // node moves from the absorbing boundary to the community
+        N_c--; N_e-=n_comm_edges[curr_pos];
+        flags[curr_pos]=2; N_B++; N_e+=ktn.nodes[curr_pos].udeg;
+        const Edge *edgeptr = ktn.nodes[curr_pos].top_from;
         while (edgeptr!=nullptr) {
-            if (edgeptr->deadts || nodes_in_comm[edgeptr->to_node->node_id-1]==2) { // removed edge or node already in comm
+            idx_t nbr_pos = edgeptr->to_node->node_pos;
+            if (edgeptr->deadts || flag(nbr_pos)==2) { // removed edge or node already in comm
                 edgeptr=edgeptr->next_from; continue; }
-            if (exp(edgeptr->k)>adaptminrate && edgeptr->to_node->aorb!=-1) { // queue neighbouring node to be added into community
-                if (nodes_in_comm[edgeptr->to_node->node_id-1]==0) { // node is not already queued
-                    nbr_queue.push(edgeptr->to_node->node_id);
-                }
+            if (flag(nbr_pos)==0) { // mark node as belonging to absorbing boundary (for now)
+                epochs[nbr_pos]=epoch; flags[nbr_pos]=3; n_comm_edges[nbr_pos]=0;
+                touched.push_back(nbr_pos); N_c++;
+                if (edgeptr->k>log_minrate && edgeptr->to_node->aorb!=-1 && \
+                    (comm_id<0 || edgeptr->to_node->comm_id==comm_id)) { // queue neighbouring node to be added into community
+                    nbr_queue.push(nbr_pos); }
             }
-            // mark node as belonging to absorbing boundary (for now)
-            nodes_in_comm[edgeptr->to_node->node_id-1]=3;
+            if (!edgeptr->rev_edge->deadts) { n_comm_edges[nbr_pos]++; N_e++; }
             edgeptr=edgeptr->next_from;
         }
     }
-    return nodes_in_comm;
 }
 
 /* Increment number of A<-B and B<-B paths simulated. If desired, update the vectors containing counts needed to
    calculate transition path statistics for bins */
 void Wrapper_Method::update_tp_stats(Walker &walker, bool abpath, bool update) {
-    n_traj++; if (abpath) n_ab++;
+    n_traj++; if (abpath) { n_ab++; PROF_COUNT(PROF_PATHS,1); }
     if (!update) return;
     int i=0; // bin ID
     for (bool bin_visit: walker.visited) {
@@ -190,6 +190,32 @@ void Wrapper_Method::update_tp_stats(Walker &walker, bool abpath, bool update) {
     fill(walker.visited.begin(),walker.visited.end(),false);
 }
 
+/* update the online estimators with the properties of a completed A<-B path, and check if the target relative error of the MFPT
+   has been reached */
+void Wrapper_Method::update_path_estimators(const Walker &walker) {
+    fpt_est.add(walker.t); len_est.add(static_cast<long double>(walker.k));
+    prob_est.add(walker.p); ent_est.add(walker.s);
+    if (mfptrelerr>0. && n_ab>=minpaths && fpt_est.rel_err()<=mfptrelerr) {
+        #pragma omp atomic write
+        converged=true; // read by other threads outside the critical section in which this function is called
+    }
+}
+
+/* print the online estimates of the means and standard deviations of first passage path properties, and 95% confidence intervals
+   for the means */
+void Wrapper_Method::write_path_estimators() {
+    if (fpt_est.n==0) return;
+    cout << "wrapper_method> online estimates (mean, 95% CI, std. dev.) for properties of " << fpt_est.n << " A<-B paths:" << endl;
+    vector<pair<string,const Online_Estimator*>> ests{{"time:       ",&fpt_est},{"length:     ",&len_est}, \
+                                                      {"log prob.:  ",&prob_est},{"entropy:    ",&ent_est}};
+    cout << scientific << setprecision(6);
+    for (const auto &est: ests) {
+        cout << "  " << est.first << setw(16) << est.second->mean << "  +/- " << setw(14) << 1.96L*est.second->std_err() \
+             << setw(16) << sqrt(est.second->var()) << endl;
+    }
+    cout << defaultfloat;
+}
+
 /* calculate the transition path statistics for bins from the observed counts during the simulation */
 void Wrapper_Method::calc_tp_stats(int nbins) {
     cout << "wrapper_method> calculating transition path statistics for bins" << endl;
@@ -208,15 +234,221 @@ void Wrapper_Method::write_tp_stats(int nbins) {
     for (int i=0;i<nbins;i++) {
         tpstats_f << setw(7) << i << setw(20) << ab_successes[i] << setw(20) << ab_failures[i];
         tpstats_f << fixed << setprecision(12);
-        tpstats_f << setw(26) << visitations[i] << setw(20) << committors[i] << endl;
+        tpstats_f << setw(26) << visitations[i] << setw(20) << committors[i];
+        // standard errors of the visitation and committor probabilities, which are estimated from Bernoulli trials (one per path)
+        double se_vis = n_ab>0?sqrt(visitations[i]*(1.-visitations[i])/static_cast<double>(n_ab)):0.;
+        double se_comm = ab_successes[i]+ab_failures[i]>0? \
+            sqrt(committors[i]*(1.-committors[i])/static_cast<double>(ab_successes[i]+ab_failures[i])):0.;
+        tpstats_f << setw(20) << se_vis << setw(20) << se_comm << endl;
     }
 }
 
+/* add an observation to the online estimator */
+void Online_Estimator::add(long double x) {
+    n++;
+    long double delta=x-mean;
+    mean+=delta/static_cast<long double>(n);
+    m2+=delta*(x-mean);
+    curr_sum+=x; curr_n++;
+    if (curr_n<batch_size) return;
+    batch_sums.push_back(curr_sum);
+    curr_sum=0.L; curr_n=0;
+    if (batch_sums.size()<maxbatches) return;
+    for (int i=0;i<maxbatches/2;i++) batch_sums[i]=batch_sums[2*i]+batch_sums[(2*i)+1]; // merge neighbouring batches
+    batch_sums.resize(maxbatches/2);
+    batch_size*=2;
+}
+
+/* sample variance */
+long double Online_Estimator::var() const {
+    if (n<2) return numeric_limits<long double>::infinity();
+    return m2/static_cast<long double>(n-1);
+}
+
+/* batch means estimate of the standard error of the mean, using the completed batches */
+long double Online_Estimator::std_err() const {
+    int nb=batch_sums.size();
+    if (nb<2) return numeric_limits<long double>::infinity();
+    long double bmean=0.L, bvar=0.L;
+    for (long double bsum: batch_sums) bmean+=bsum/static_cast<long double>(batch_size);
+    bmean/=static_cast<long double>(nb);
+    for (long double bsum: batch_sums) bvar+=pow((bsum/static_cast<long double>(batch_size))-bmean,2);
+    bvar/=static_cast<long double>(nb-1);
+    return sqrt(bvar/static_cast<long double>(nb));
+}
+
+/* relative error of the mean, defined as the half-width of the 95% confidence interval divided by the mean */
+long double Online_Estimator::rel_err() const {
+    return 1.96L*std_err()/abs(mean);
+}
+
+/* functions to write and read values and vectors of values in binary format, used for checkpoint files */
+template <typename T>
+static void write_bin(ofstream &f, const T &val) { f.write(reinterpret_cast<const char*>(&val),sizeof(T)); }
+
+template <typename T>
+static void write_bin(ofstream &f, const vector<T> &vec) {
+    write_bin(f,vec.size());
+    f.write(reinterpret_cast<const char*>(vec.data()),vec.size()*sizeof(T));
+}
+
+static void write_bin(ofstream &f, const string &str) {
+    write_bin(f,str.size()); f.write(str.data(),str.size());
+}
+
+static void write_bin(ofstream &f, const Online_Estimator &est) {
+    write_bin(f,est.n); write_bin(f,est.mean); write_bin(f,est.m2); write_bin(f,est.batch_sums);
+    write_bin(f,est.batch_size); write_bin(f,est.curr_sum); write_bin(f,est.curr_n);
+}
+
+template <typename T>
+static void read_bin(ifstream &f, T &val) { f.read(reinterpret_cast<char*>(&val),sizeof(T)); }
+
+template <typename T>
+static void read_bin(ifstream &f, vector<T> &vec) {
+    size_t n; read_bin(f,n); vec.resize(n);
+    f.read(reinterpret_cast<char*>(vec.data()),n*sizeof(T));
+}
+
+static void read_bin(ifstream &f, string &str) {
+    size_t n; read_bin(f,n); str.resize(n); f.read(&str[0],n);
+}
+
+static void read_bin(ifstream &f, Online_Estimator &est) {
+    read_bin(f,est.n); read_bin(f,est.mean); read_bin(f,est.m2); read_bin(f,est.batch_sums);
+    read_bin(f,est.batch_size); read_bin(f,est.curr_sum); read_bin(f,est.curr_n);
+}
+
+static const char ckpt_fname[]="checkpoint.bin";
+static const int ckpt_version=2;
+
+/* save the state of the random number stream of the calling thread, to be written to the checkpoint file */
+void Wrapper_Method::save_rng_state() {
+    ostringstream rng_oss; rng_oss << rng(seed);
+    rng_states[omp_get_thread_num()]=rng_oss.str();
+}
+
+/* restore the state of the random number stream of the calling thread, as read from the checkpoint file */
+void Wrapper_Method::restore_rng_state() {
+    istringstream rng_iss(rng_states[omp_get_thread_num()]); rng_iss >> rng(seed);
+}
+
+/* write the state of the simulation to the checkpoint file, when all threads have completed the paths (or blocks of walkers)
+   numbered up to pathno. The state comprises the transition path statistics, the online estimators, the states of the walkers, the
+   states of the random number streams of the threads, and any additional accumulators of the wrapper method. The sizes of the
+   fpp_properties.dat file and of the trajectory files of walkers that are part-way along a path are also recorded, so that any data
+   written after the checkpoint can be discarded on restart. The checkpoint is written to a temporary file that then replaces the
+   previous checkpoint, so that a valid checkpoint file always exists if the job is killed */
+void Wrapper_Method::write_checkpoint(int pathno, const vector<long double> &accums) {
+    PROF_SCOPE(PROF_OUTPUT);
+    if (debug) cout << "wrapper_method> writing checkpoint after " << pathno << " paths" << endl;
+    uintmax_t fpp_size = filesystem::exists("fpp_properties.dat")?filesystem::file_size("fpp_properties.dat"):0;
+    string tmp_fname=string(ckpt_fname)+".tmp";
+    ofstream ckpt_f(tmp_fname,ios::binary|ios::trunc);
+    write_bin(ckpt_f,ckpt_version); write_bin(ckpt_f,seed); write_bin(ckpt_f,nabpaths); write_bin(ckpt_f,ckptpaths);
+    write_bin(ckpt_f,pathno); write_bin(ckpt_f,n_ab); write_bin(ckpt_f,n_traj); write_bin(ckpt_f,converged);
+    write_bin(ckpt_f,ab_successes); write_bin(ckpt_f,ab_failures);
+    write_bin(ckpt_f,fpt_est); write_bin(ckpt_f,len_est); write_bin(ckpt_f,prob_est); write_bin(ckpt_f,ent_est);
+    write_bin(ckpt_f,walkers.size());
+    for (const Walker &walker: walkers) { // the walker is part-way along a path if the current node is set
+        write_bin(ckpt_f,walker.path_no);
+        write_bin(ckpt_f,walker.curr_node!=nullptr?walker.curr_node->node_pos:-1);
+        write_bin(ckpt_f,walker.prev_node!=nullptr?walker.prev_node->node_pos:-1);
+        write_bin(ckpt_f,walker.k); write_bin(ckpt_f,walker.t); write_bin(ckpt_f,walker.p); write_bin(ckpt_f,walker.s);
+        write_bin(ckpt_f,vector<char>(walker.visited.begin(),walker.visited.end()));
+        string walker_fname="walker."+to_string(walker.walker_id)+"."+to_string(walker.path_no)+".dat";
+        uintmax_t walker_size = (walker.curr_node!=nullptr && filesystem::exists(walker_fname))?filesystem::file_size(walker_fname):0;
+        write_bin(ckpt_f,walker_size);
+    }
+    write_bin(ckpt_f,rng_states.size());
+    for (const string &rng_state: rng_states) write_bin(ckpt_f,rng_state);
+    write_bin(ckpt_f,accums); write_bin(ckpt_f,fpp_size);
+    ckpt_f.close();
+    if (!ckpt_f) { cout << "wrapper_method> error: could not write checkpoint file" << endl; exit(EXIT_FAILURE); }
+    filesystem::rename(tmp_fname,ckpt_fname);
+}
+
+/* read the state of the simulation from the checkpoint file, and return the number of the next path (or block of walkers) to be
+   simulated. The simulation parameters and the number of threads must be the same as when the checkpoint file was written */
+int Wrapper_Method::read_checkpoint(const Network &ktn, vector<long double> &accums) {
+    cout << "wrapper_method> restarting simulation from checkpoint file " << ckpt_fname << endl;
+    ifstream ckpt_f(ckpt_fname,ios::binary);
+    if (!ckpt_f.good()) { cout << "wrapper_method> error: checkpoint file not found" << endl; exit(EXIT_FAILURE); }
+    int version, ckpt_seed, ckpt_nabpaths, ckpt_ckptpaths, pathno;
+    read_bin(ckpt_f,version); read_bin(ckpt_f,ckpt_seed); read_bin(ckpt_f,ckpt_nabpaths); read_bin(ckpt_f,ckpt_ckptpaths);
+    if (version!=ckpt_version || ckpt_seed!=seed || ckpt_nabpaths!=nabpaths || ckpt_ckptpaths!=ckptpaths) {
+        cout << "wrapper_method> error: checkpoint file is incompatible with the simulation parameters" << endl; exit(EXIT_FAILURE); }
+    read_bin(ckpt_f,pathno); read_bin(ckpt_f,n_ab); read_bin(ckpt_f,n_traj); read_bin(ckpt_f,converged);
+    read_bin(ckpt_f,ab_successes); read_bin(ckpt_f,ab_failures);
+    read_bin(ckpt_f,fpt_est); read_bin(ckpt_f,len_est); read_bin(ckpt_f,prob_est); read_bin(ckpt_f,ent_est);
+    size_t nwalkers, nthreads;
+    read_bin(ckpt_f,nwalkers);
+    if (nwalkers!=walkers.size()) {
+        cout << "wrapper_method> error: checkpoint file was written with a different number of threads" << endl; exit(EXIT_FAILURE); }
+    for (Walker &walker: walkers) {
+        idx_t curr_pos, prev_pos;
+        vector<char> visited;
+        uintmax_t walker_size;
+        read_bin(ckpt_f,walker.path_no); read_bin(ckpt_f,curr_pos); read_bin(ckpt_f,prev_pos);
+        read_bin(ckpt_f,walker.k); read_bin(ckpt_f,walker.t); read_bin(ckpt_f,walker.p); read_bin(ckpt_f,walker.s);
+        read_bin(ckpt_f,visited); read_bin(ckpt_f,walker_size);
+        if (!ckpt_f || visited.size()!=walker.visited.size() || curr_pos>=ktn.n_nodes || prev_pos>=ktn.n_nodes) {
+            cout << "wrapper_method> error: checkpoint file is corrupted" << endl; exit(EXIT_FAILURE); }
+        walker.curr_node = curr_pos>=0?&ktn.nodes[curr_pos]:nullptr;
+        walker.prev_node = prev_pos>=0?&ktn.nodes[prev_pos]:nullptr;
+        copy(visited.begin(),visited.end(),walker.visited.begin());
+        string walker_fname="walker."+to_string(walker.walker_id)+"."+to_string(walker.path_no)+".dat";
+        if (walker.curr_node!=nullptr && filesystem::exists(walker_fname)) filesystem::resize_file(walker_fname,walker_size);
+    }
+    read_bin(ckpt_f,nthreads);
+    if (nthreads!=rng_states.size()) {
+        cout << "wrapper_method> error: checkpoint file was written with a different number of threads" << endl; exit(EXIT_FAILURE); }
+    for (string &rng_state: rng_states) read_bin(ckpt_f,rng_state);
+    uintmax_t fpp_size;
+    read_bin(ckpt_f,accums); read_bin(ckpt_f,fpp_size);
+    if (!ckpt_f) { cout << "wrapper_method> error: checkpoint file is corrupted" << endl; exit(EXIT_FAILURE); }
+    if (filesystem::exists("fpp_properties.dat")) filesystem::resize_file("fpp_properties.dat",fpp_size);
+    cout << "wrapper_method> continuing from path " << pathno << ", with " << n_ab << " A<-B paths simulated" << endl;
+    return pathno;
+}
+
+/* random number generator for the calling thread. Each thread has its own random number stream, which is shared by all functions that
+   draw random numbers (so that the state of the stream can be saved in a checkpoint file) */
+default_random_engine &Wrapper_Method::rng(int seed) {
+    static thread_local default_random_engine generator(seed+omp_get_thread_num());
+    return generator;
+}
+
 /* draw a uniform random number between 0 and 1, used in Metropolis conditions etc. */
 long double Wrapper_Method::rand_unif_met(int seed) {
-    static default_random_engine generator(seed);
     static uniform_real_distribution<long double> unif_real_distrib(0.L,1.L);
-    return unif_real_distrib(generator);
+    return unif_real_distrib(rng(seed));
+}
+
+/* solve the dense linear system of equations Ax=b by Gaussian elimination with partial pivoting. The vector b is overwritten by
+   the solution x. Returns false if the matrix is (numerically) singular */
+bool Wrapper_Method::solve_linear_system(vector<vector<long double>> a, vector<long double> &b) {
+
+    int n=b.size();
+    long double max_elem=0.L; // magnitude of largest element, used to scale the tolerance for singularity
+    for (const auto &row: a) { for (const long double elem: row) max_elem=max(max_elem,fabs(elem)); }
+    for (int i=0;i<n;i++) {
+        int pivot=i;
+        for (int j=i+1;j<n;j++) { if (fabs(a[j][i])>fabs(a[pivot][i])) pivot=j; }
+        if (!(fabs(a[pivot][i])>max_elem*n*numeric_limits<long double>::epsilon())) return false;
+        swap(a[i],a[pivot]); swap(b[i],b[pivot]);
+        for (int j=i+1;j<n;j++) {
+            long double factor=a[j][i]/a[i][i];
+            if (factor==0.L) continue;
+            for (int k=i;k<n;k++) a[j][k]-=factor*a[i][k];
+            b[j]-=factor*b[i];
+        }
+    }
+    for (int i=n-1;i>=0;i--) {
+        for (int k=i+1;k<n;k++) b[i]-=a[i][k]*b[k];
+        b[i]/=a[i][i];
+    }
+    return true;
 }
 
 /* Wrapper_Method corresponding to simulation of A<-B paths (using chosen trajectory propagation method) with no enhanced sampling method */
@@ -231,12 +463,27 @@ void BTOA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "\n\nbtoa> beginning simulation of A<-B paths with no enhanced sampling method" << endl;
     n_ab=0; n_traj=0; int n_it=0;
+    int pathno_start=0; // number of the first path to be simulated (nonzero if restarting from a checkpoint)
+    rng_states.resize(omp_get_max_threads());
+    if (restart) {
+        vector<long double> accums;
+        pathno_start=read_checkpoint(ktn,accums);
+        n_it=static_cast<int>(accums[0]);
+    }
+    int seg_size = ckptpaths>0?ckptpaths:nabpaths; // paths are simulated in segments, with a checkpoint file written after each segment
     #pragma omp parallel
     {
     int x = omp_get_thread_num();
     Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
-    #pragma omp for
-    for (int pathno=0;pathno<nabpaths;pathno++) {
+    if (restart) restore_rng_state();
+    for (int seg_start=pathno_start;seg_start<nabpaths;seg_start+=seg_size) {
+    #pragma omp for schedule(static) nowait
+    for (int pathno=seg_start;pathno<min(seg_start+seg_size,nabpaths);pathno++) {
+        bool conv;
+        #pragma omp atomic read
+        conv=converged;
+        if (conv) continue; // target relative error of the MFPT has been reached, no new paths are started
+        TRACE_SCOPE("path");
         for (;;) {
             if (n_it>maxit) break; // quack this leaves walker files that are not complete A<-B trajectories
             bool donebklsteps=false;
@@ -247,8 +494,14 @@ void BTOA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
             n_it++;
             check_if_endpoint:
                 if (walkers[x].curr_node->aorb==-1 || walkers[x].curr_node->aorb==1) { // traj has reached absorbing macrostate A or has returned to B
+                    TRACE_MARK(t_crit);
                     #pragma omp critical
+                    {
+                    TRACE_SINCE("critical_wait",t_crit);
+                    TRACE_SCOPE("update_tp_stats");
                     update_tp_stats(walkers[x],walkers[x].curr_node->aorb==-1,!adaptivecomms);
+                    if (walkers[x].curr_node->aorb==-1) update_path_estimators(walkers[x]);
+                    }
                     if (walkers[x].curr_node->aorb==-1) { // transition path, reset walker
                         walkers[x].reset_walker_info();
                         walkers[x].path_no += walkers.size();
@@ -264,9 +517,20 @@ void BTOA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
             goto check_if_endpoint;
         }
     }
+    TRACE_BARRIER(); // wait until all threads have completed the paths of this segment
+    if (ckptpaths>0) {
+        save_rng_state();
+        TRACE_BARRIER();
+        #pragma omp single
+        write_checkpoint(min(seg_start+seg_size,nabpaths),{static_cast<long double>(n_it)});
+    }
+    }
+    delete traj_method_local;
     }
     cout << "\nbtoa> simulation terminated after " << n_it << " iterations. Simulated " \
          << n_ab << " transition paths" << endl;
+    if (converged) cout << "btoa> target relative error of the MFPT was reached: " << fpt_est.rel_err() << endl;
+    write_path_estimators();
     if (!traj_method_obj->statereduction && !adaptivecomms) calc_tp_stats(ktn.nbins); // calc committor and visitation probs for bins and write to file
 }
 
@@ -286,38 +550,103 @@ void FIXEDT::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj)
 
     cout << "\n\nfixedt> beginning simulation of paths of fixed time" << endl;
     n_ab=0; int n_it=0;
+    if (nbatch>0) { // propagate blocks of independent trajectories in lockstep with the batched BKL engine
+        unsigned long long int n_steps=0; // total number of kMC steps
+        int nblocks = (nabpaths+nbatch-1)/nbatch;
+        int blockno_start=0; // number of the first block to be simulated (nonzero if restarting from a checkpoint)
+        rng_states.resize(omp_get_max_threads());
+        if (restart) {
+            vector<long double> accums;
+            blockno_start=read_checkpoint(ktn,accums);
+            n_steps=static_cast<unsigned long long int>(accums[0]);
+        }
+        int seg_size = ckptpaths>0?ckptpaths:nblocks; // blocks are simulated in segments, with a checkpoint file written after each segment
+        #pragma omp parallel
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone();
+        vector<Walker> batch;
+        if (restart) restore_rng_state();
+        for (int seg_start=blockno_start;seg_start<nblocks;seg_start+=seg_size) {
+        #pragma omp for schedule(static) nowait // blocks are assigned to threads, and hence to random number streams, deterministically
+        for (int blockno=seg_start;blockno<min(seg_start+seg_size,nblocks);blockno++) {
+            TRACE_SCOPE("block");
+            setup_batch(batch,0,blockno*nbatch,min(nbatch,nabpaths-(blockno*nbatch)),ktn.nbins);
+            unsigned long long int n_steps_block = traj_method_local->kmc_batch(ktn,batch,trajt,false);
+            #pragma omp atomic
+            n_steps += n_steps_block;
+        }
+        TRACE_BARRIER();
+        if (ckptpaths>0) {
+            save_rng_state();
+            TRACE_BARRIER();
+            #pragma omp single
+            write_checkpoint(min(seg_start+seg_size,nblocks),{static_cast<long double>(n_steps)});
+        }
+        }
+        delete traj_method_local;
+        }
+        cout << "fixedt> simulated " << nabpaths << " paths in blocks of " << nbatch << " walkers. Total no. of kMC steps: " \
+             << n_steps << endl;
+        return;
+    }
     int noahits=0; // number of times that the A (target) set is hit
     long double tot_trajt=0.L; // total time spent collecting A<-B steady state path statistics
-    bool fromb; // if true, indicates that the trajectory segment is traveling having last occupied B and not A
+    int n_paths=0; // number of completed paths
+    // for each walker, indicates that the trajectory segment is traveling having last occupied B and not A
+    vector<char> fromb(walkers.size(),false);
+    vector<double> next_tintvls(walkers.size()); // next times for dumping trajectory data of the walkers, saved in checkpoints
+    rng_states.resize(omp_get_max_threads());
+    if (restart) {
+        vector<long double> accums;
+        n_paths=read_checkpoint(ktn,accums);
+        n_it=static_cast<int>(accums[0]); noahits=static_cast<int>(accums[1]); tot_trajt=accums[2];
+        for (int i=0;i<walkers.size();i++) { fromb[i]=accums[3+(2*i)]!=0.L; next_tintvls[i]=accums[4+(2*i)]; }
+    }
+    int n_done=0; // number of threads that have completed all of their paths
     #pragma omp parallel
     {
-    int x = omp_get_thread_num();
+    int x = omp_get_thread_num(); // the walker of each thread simulates the paths numbered x, x+nthreads, x+(2*nthreads), ...
     Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
-    #pragma omp for
-    for (int pathno=0;pathno<nabpaths;pathno++) {
-	if (steadystate && ssrec>0.) { fromb=false; // for transition path stats, only count traj segment starting from B when equilibriation time period has passed
-	} else if (ssrec>0.) { fromb=true; }
-        while (walkers[x].t<trajt) { // continue simulation of trajectory until desired time is reached
-	    if (n_it>maxit) break; // quack this leaves walker files that do not meet the specified fixed trajectory time
+    if (restart) { restore_rng_state(); traj_method_local->set_next_tintvl(next_tintvls[x]); }
+    bool done=false;
+    for (;;) { // trajectories are simulated in segments of CHECKPOINT iterations per thread, with a checkpoint file written after each segment
+    int seg_it=0; // number of iterations in the current segment
+    while (!done && !(ckptpaths>0 && seg_it>=ckptpaths)) {
+        if (walkers[x].path_no>=nabpaths) {
+            done=true;
+            #pragma omp atomic
+            n_done++;
+            break;
+        }
+        if (walkers[x].curr_node==nullptr) { // start of path
+	    if (steadystate && ssrec>0.) { fromb[x]=false; // for transition path stats, only count traj segment starting from B when equilibriation time period has passed
+	    } else if (ssrec>0.) { fromb[x]=true; }
+        }
+        if (walkers[x].t<trajt && !(n_it>maxit)) { // continue simulation of trajectory until desired time is reached
+            // quack exceeding maxit leaves walker files that do not meet the specified fixed trajectory time
 	    bool donebklsteps=false;
             traj_method_local->kmc_iteration(ktn,walkers[x]);
 	    traj_method_local->dump_traj(walkers[x],false,false);
 	    cout << "node is now: " << walkers[x].curr_node->node_id << endl;
             #pragma omp atomic
 	    n_it++;
+            seg_it++;
             check_if_endpoint: // if STEADYSTATE keyword is set, check collection of transition path bin statistics
 	        if (ktn.nbins>0 && steadystate && walkers[x].t>ssrec) { // equilibriation period has passed, bin statistics can be recorded
 		if (walkers[x].curr_node->aorb==-1) {
-		    if (fromb) cout << "    TRAJ PASSED FROM B TO A" << endl;
-		    if (fromb) update_tp_stats(walkers[x],true,true); // trajectory segment has hit A from B; record bin statistics
-		    fromb=false; // traj segment is now transitioning from A, not B (so bin stats should not be recorded until the traj hits B again)
+		    if (fromb[x]) cout << "    TRAJ PASSED FROM B TO A" << endl;
+		    if (fromb[x]) { // trajectory segment has hit A from B; record bin statistics
+                        #pragma omp critical
+                        update_tp_stats(walkers[x],true,true);
+                    }
+		    fromb[x]=false; // traj segment is now transitioning from A, not B (so bin stats should not be recorded until the traj hits B again)
 		    if (walkers[x].prev_node->aorb!=-1) { // hit A from outside A; counts towards estimate of steady-state MFPT
 	                #pragma omp atomic
 			noahits++;
 		    }
 		} else if (walkers[x].curr_node->aorb==1) { // trajectory segment is in B; reset vector of visited states
 		    cout << "    TRAJ IN B" << endl;
-		    fromb=true; // the trajectory segment is starting from B, so bin statistics should be recorded
+		    fromb[x]=true; // the trajectory segment is starting from B, so bin statistics should be recorded
                     fill(walkers[x].visited.begin(),walkers[x].visited.end(),false);
 		    walkers[x].visited[walkers[x].curr_node->bin_id]=true;
 		}
@@ -331,14 +660,35 @@ void FIXEDT::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj)
 		goto check_if_endpoint;
 	    }
 */
+            continue;
         }
+        #pragma omp atomic
 	tot_trajt += walkers[x].t-ssrec; // increment total time spent collecting trajectory statistics
+        #pragma omp atomic
+        n_paths++;
 	// reset trajectory
 	walkers[x].reset_walker_info();
 	walkers[x].path_no += walkers.size();
 	if (ktn.nbins>0) fill(walkers[x].visited.begin(),walkers[x].visited.end(),false);
 	traj_method_local->reset_nodeptrs();
     }
+    TRACE_BARRIER(); // wait until all threads have completed the iterations of this segment
+    if (ckptpaths==0) break;
+    int n_done_local; // all threads read the no. of finished threads before any thread begins the next segment
+    #pragma omp atomic read
+    n_done_local=n_done;
+    next_tintvls[x]=traj_method_local->get_next_tintvl();
+    save_rng_state();
+    TRACE_BARRIER();
+    #pragma omp single
+    {
+    vector<long double> accums{static_cast<long double>(n_it),static_cast<long double>(noahits),tot_trajt};
+    for (int i=0;i<walkers.size();i++) { accums.push_back(fromb[i]?1.L:0.L); accums.push_back(next_tintvls[i]); }
+    write_checkpoint(n_paths,accums);
+    }
+    if (n_done_local==walkers.size()) break;
+    }
+    delete traj_method_local;
     }
     cout << "fixedt> simulation terminated after " << n_it << " iterations" << endl;
     if (steadystate) {
@@ -364,12 +714,38 @@ DIMREDN::~DIMREDN() {}
 void DIMREDN::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
     cout << "\n\ndimredn> beginning simulation to obtain trajectory data for dimensionality reduction" << endl;
+    if (nbatch>0) { // propagate blocks of trajectories initialised from the same community in lockstep with the batched BKL engine
+        vector<pair<int,int>> blocks; // community ID and first path number for each block of trajectories
+        for (int i=0;i<ktn.ncomms;i++) {
+            for (int j=0;j<ntrajsvec[i];j+=nbatch) blocks.push_back(make_pair(i,j)); }
+        unsigned long long int n_steps=0; // total number of kMC steps
+        #pragma omp parallel
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone();
+        vector<Walker> batch;
+        #pragma omp for schedule(dynamic) nowait
+        for (int blockno=0;blockno<blocks.size();blockno++) {
+            TRACE_SCOPE("block");
+            int comm_id=blocks[blockno].first, first_path_no=blocks[blockno].second;
+            setup_batch(batch,comm_id,first_path_no,min(nbatch,ntrajsvec[comm_id]-first_path_no),ktn.nbins);
+            unsigned long long int n_steps_block = traj_method_local->kmc_batch(ktn,batch,trajt,true);
+            #pragma omp atomic
+            n_steps += n_steps_block;
+        }
+        TRACE_BARRIER();
+        delete traj_method_local;
+        }
+        cout << "dimredn> simulated " << blocks.size() << " blocks of up to " << nbatch << " trajectories. Total no. of kMC steps: " \
+             << n_steps << endl;
+        return;
+    }
     #pragma omp parallel for default(shared)
     for (int i=0;i<ktn.ncomms;i++) {
         Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
         #pragma omp critical
         cout << "dimredn> thread no.: " << omp_get_thread_num() << "  handling walker: " << walkers[i].walker_id << endl;
         while (walkers[i].path_no<ntrajsvec[walkers[i].walker_id]) {
+            TRACE_SCOPE("path");
             while (walkers[i].t<=trajt) {
                 traj_method_local->kmc_iteration(ktn,walkers[i]);
                 traj_method_local->dump_traj(walkers[i],false,false,trajt);
@@ -388,6 +764,7 @@ void DIMREDN::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj)
 /* constructor for Traj_Method class */
 Traj_Method::Traj_Method(const Traj_args &traj_args) {
     this->discretetime=traj_args.discretetime; this->statereduction=traj_args.statereduction;
+    this->skiploops=traj_args.skiploops; this->lazytime=traj_args.lazytime;
     this->tintvl=traj_args.tintvl; this->dumpintvls=traj_args.dumpintvls;
     this->seed=traj_args.seed; this->debug=traj_args.debug;
 }
@@ -397,26 +774,35 @@ Traj_Method::~Traj_Method() {}
 /* copy constructor for Traj_Method class */
 Traj_Method::Traj_Method(const Traj_Method &traj_method_obj) {
     this->discretetime=traj_method_obj.discretetime; this->statereduction=traj_method_obj.statereduction;
+    this->skiploops=traj_method_obj.skiploops; this->lazytime=traj_method_obj.lazytime;
     this->tintvl=traj_method_obj.tintvl; this->dumpintvls=traj_method_obj.dumpintvls;
     this->seed=traj_method_obj.seed; this->debug=traj_method_obj.debug;
+    this->bkl_step=traj_method_obj.bkl_step;
 }
 
 void Traj_Method::dump_traj(Walker &walker, bool transnpath, bool newpath, long double maxtime) {
-    if (!transnpath && !newpath && tintvl>0. && walker.t<next_tintvl && walker.t<maxtime) return;
-    if (tintvl>=0. && dumpintvls && (walker.t>=next_tintvl || walker.t>maxtime)) {
-        walker.dump_walker_info(newpath,next_tintvl,walker.prev_node,true);
+    dump_traj(walker,transnpath,newpath,maxtime,next_tintvl);
+}
+
+/* dump walker info, where next_t is the next time for dumping trajectory data for this walker, and is updated */
+void Traj_Method::dump_traj(Walker &walker, bool transnpath, bool newpath, long double maxtime, double &next_t) {
+    if (transnpath && lazytime) sample_lazy_time(walker);
+    if (!transnpath && !newpath && tintvl>0. && walker.t<next_t && walker.t<maxtime) return;
+    if (tintvl>=0. && dumpintvls && (walker.t>=next_t || walker.t>maxtime)) {
+        walker.dump_walker_info(newpath,next_t,walker.prev_node,true);
     } else if (tintvl>=0. && (transnpath || !dumpintvls || walker.t>maxtime)) {
         walker.dump_walker_info(newpath,walker.t,walker.curr_node,dumpintvls);
     }
     if (transnpath) { walker.dump_fpp_properties(); return; }
     if (walker.t>maxtime) return;
-    if (tintvl>0. && walker.t>=next_tintvl) { // reached time interval for dumping trajectory data, calc next interval
-        while (walker.t>=next_tintvl) next_tintvl+=tintvl;
+    if (tintvl>0. && walker.t>=next_t) { // reached time interval for dumping trajectory data, calc next interval
+        while (walker.t>=next_t) next_t+=tintvl;
     }
 }
 
 BKL::BKL(const Network &ktn, const Traj_args &traj_args) : Traj_Method(traj_args) {
     cout << "bkl> constructing object for BKL simulation" << endl;
+    bkl_step=BKL::select_bkl(discretetime,ktn.accumprobs,skiploops,lazytime);
 }
 
 BKL::~BKL() {}
@@ -430,12 +816,113 @@ void BKL::kmc_iteration(const Network &ktn, Walker &walker) {
         if (tintvl>=0.) walker.dump_walker_info(true,0.,walker.curr_node,dumpintvls);
         next_tintvl=tintvl;
     }
-    BKL::bkl(walker,discretetime,ktn.accumprobs,seed);
+    bkl_step(walker,seed);
+    if (lazytime) { // record the step from the previously occupied node, the waiting time is sampled when the path is complete
+        if (lazy_counts.empty()) lazy_counts.resize(ktn.n_nodes,0);
+        if (lazy_counts[walker.prev_node->node_pos]++==0) lazy_touched.push_back(walker.prev_node);
+    }
     if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[walker.curr_node->bin_id]=true;
 }
 
+/* the sum of m exponentially distributed waiting times with mean t_esc follows a gamma distribution with shape m and scale t_esc.
+   Hence the time along the path, given the numbers of steps from each node, is sampled exactly using a single gamma random number
+   for each distinct value of the mean waiting time (i.e. a single random number for a linearised transition matrix). The counts
+   are then cleared for the next path */
+void BKL::sample_lazy_time(Walker &walker) {
+    if (lazy_touched.empty()) return;
+    default_random_engine &generator = Wrapper_Method::rng(seed);
+    map<long double,unsigned long long int> tesc_counts; // no. of steps from nodes with each distinct mean waiting time
+    for (const Node *node: lazy_touched) {
+        tesc_counts[node->t_esc]+=lazy_counts[node->node_pos];
+        lazy_counts[node->node_pos]=0;
+    }
+    lazy_touched.clear();
+    for (const auto &tesc_count: tesc_counts) {
+        gamma_distribution<long double> gamma_distrib(static_cast<long double>(tesc_count.second),tesc_count.first);
+        walker.t+=gamma_distrib(generator);
+    }
+}
+
+/* propagate a block of independent walkers in lockstep using the BKL algorithm, until the time for each walker reaches maxtime.
+   If pastmaxtime is true, walkers are instead propagated until the time exceeds maxtime, and trajectory data is dumped as for a
+   single walker in the DIMREDN wrapper. At each sweep over the walkers that remain active, the random numbers for selecting
+   transitions and sampling waiting times are drawn for the whole block, and transitions are selected using the compact array-based
+   representation of the network. Returns the total number of kMC steps taken by the walkers of the block */
+unsigned long long int BKL::kmc_batch(const Network &ktn, vector<Walker> &batch, long double maxtime, bool pastmaxtime) {
+
+    if (ktn.cktn==nullptr) throw Network::Network_exception();
+    PROF_SCOPE(PROF_BKL);
+    const Compiled_Network &cktn = *ktn.cktn;
+    default_random_engine &generator = Wrapper_Method::rng(seed);
+    uniform_real_distribution<double> unif_real_distrib(0.,1.);
+    int n_active=batch.size();   // number of walkers in the block that have not yet reached the maximum time
+    vector<int> active(n_active); // indices of active walkers
+    iota(active.begin(),active.end(),0);
+    vector<idx_t> pos(n_active);  // positions of currently occupied nodes
+    vector<double> next_t(n_active,tintvl); // next times for dumping trajectory data
+    vector<double> rand_sel(n_active), rand_t(n_active); // random numbers for selecting transitions / sampling waiting times
+    long double dumpmaxtime = pastmaxtime?maxtime:numeric_limits<long double>::infinity();
+    for (int i=0;i<n_active;i++) {
+        if (batch[i].curr_node==nullptr) {
+            Wrapper_Method::get_initial_node(ktn,batch[i],seed);
+            if (tintvl>=0.) batch[i].dump_walker_info(true,0.,batch[i].curr_node,dumpintvls);
+        }
+        pos[i]=batch[i].curr_node->node_pos;
+    }
+    unsigned long long int n_steps=0;
+    while (n_active>0) {
+        for (int j=0;j<n_active;j++) rand_sel[j]=unif_real_distrib(generator);
+        if (!discretetime) {
+            for (int j=0;j<n_active;j++) rand_t[j]=1.-unif_real_distrib(generator);
+            for (int j=0;j<n_active;j++) rand_t[j]=-log(rand_t[j]); // exponential variates with unit mean
+        }
+        for (int j=0;j<n_active;j++) {
+            int i=active[j];
+            idx_t l=cktn.offsets[pos[i]], l_max=cktn.offsets[pos[i]+1]-1;
+            while (l<l_max && !(cktn.cum_t[l]>rand_sel[j])) l++; // last transition is chosen if sum of probs is less than unity
+            Walker &walker=batch[i];
+            walker.prev_node=walker.curr_node;
+            if (!discretetime) { walker.t += cktn.t_esc[pos[i]]*rand_t[j];
+            } else { walker.t += cktn.t_esc[pos[i]]; }
+            pos[i]=cktn.to_pos[l];
+            walker.curr_node=&ktn.nodes[pos[i]];
+            walker.k++; walker.p -= cktn.log_t[l]; walker.s += cktn.ds[l];
+            dump_traj(walker,false,false,dumpmaxtime,next_t[i]);
+        }
+        n_steps += n_active;
+        PROF_COUNT(PROF_BKL_STEPS,n_active);
+        // remove walkers that have reached the maximum time from the list of active walkers
+        int n_remain=0;
+        for (int j=0;j<n_active;j++) {
+            const Walker &walker=batch[active[j]];
+            if (walker.t<maxtime || (pastmaxtime && !(walker.t>maxtime))) active[n_remain++]=active[j];
+        }
+        n_active=n_remain;
+    }
+    return n_steps;
+}
+
+/* return the BKL kernel specialised for the type of Markov chain (continuous- or discrete-time) and for the storage of the
+   transition probabilities (cumulative or not), so that these checks are not made at every step of a trajectory. If skiploops,
+   the kernel for a DTMC samples the number of consecutive self-loop transitions in a single step */
+void (*BKL::select_bkl(bool discretetime, bool accumprobs, bool skiploops, bool lazytime))(Walker&,int) {
+    if (discretetime && skiploops) {
+        if (accumprobs) return &BKL::bkl_skiploops<true>;
+        return &BKL::bkl_skiploops<false>;
+    } else if (discretetime) {
+        if (accumprobs) return &BKL::bkl<true,true>;
+        return &BKL::bkl<true,false>;
+    } else if (lazytime) {
+        if (accumprobs) return &BKL::bkl<false,true,true>;
+        return &BKL::bkl<false,false,true>;
+    }
+    if (accumprobs) return &BKL::bkl<false,true>;
+    return &BKL::bkl<false,false>;
+}
+
 /* function to take a single kMC step (i.e. propagate trajectory by one internode transition) using the BKL algorithm */
-void BKL::bkl(Walker &walker, bool discretetime, bool accumprobs, int seed) {
+template<bool DISCRETETIME,bool ACCUMPROBS,bool LAZYTIME>
+void BKL::bkl(Walker &walker, int seed) {
     double rand_no = Wrapper_Method::rand_unif_met(seed); // random number used to select transition
     Edge *edgeptr = nullptr;
     long double t; // transition probability of accepted move
@@ -443,7 +930,7 @@ void BKL::bkl(Walker &walker, bool discretetime, bool accumprobs, int seed) {
     if (!(prev_cum_t>rand_no)) {
         edgeptr = walker.curr_node->top_from;
         while (edgeptr!=nullptr) {
-            if (accumprobs) { // transition probability values are cumulative
+            if constexpr (ACCUMPROBS) { // transition probability values are cumulative
                 if (edgeptr->t>rand_no) { t=edgeptr->t-prev_cum_t; break; }
                 prev_cum_t = edgeptr->t;
             } else { // transition probability values are not cumulative
@@ -465,15 +952,66 @@ void BKL::bkl(Walker &walker, bool discretetime, bool accumprobs, int seed) {
     }
     // update path quantities
     walker.k++; // dynamical activity (no. of steps)
+    PROF_COUNT(PROF_BKL_STEPS,1);
     walker.p += -1.L*log(t); // log path probability
     if (edgeptr!=nullptr) { // trajectory has advanced to another node (not self-loop transtion), non-zero contribution to path entropy flow
-        if (!discretetime) { walker.s += edgeptr->rev_edge->k-edgeptr->k;
-        } else if (!accumprobs) { walker.s += log(edgeptr->rev_edge->t/edgeptr->t); } // entropy flow
+        if constexpr (!DISCRETETIME) { walker.s += edgeptr->rev_edge->k-edgeptr->k;
+        } else if constexpr (!ACCUMPROBS) { walker.s += log(edgeptr->rev_edge->t/edgeptr->t); } // entropy flow
     }
     // sample transition time
-    if (!discretetime) { // continuous-time with non-uniform (branching) or uniform (linearised transn prob mtx) waiting times for nodes
+    if constexpr (LAZYTIME) { // waiting times are sampled collectively when the path is complete (steps are counted in BKL::kmc_iteration)
+    } else if constexpr (!DISCRETETIME) { // continuous-time with non-uniform (branching) or uniform (linearised transn prob mtx) waiting times for nodes
         walker.t += -1.L*walker.prev_node->t_esc*log(Wrapper_Method::rand_unif_met(seed)); // recall for linearised transn prob mtx, t_esc should have been set to tau
     } else { // discrete-time
         walker.t += walker.prev_node->t_esc; // recall for discrete-time transn prob mtx, t_esc should have been set to tau
     }
 }
+
+/* function to propagate a trajectory on a DTMC until the walker leaves the currently occupied node. The number of consecutive
+   self-loop transitions m follows a geometric distribution, P(m) = T_ii^m (1-T_ii), and is sampled by inversion. The transition
+   from the node is then selected in proportion to the transition probabilities T_ij/(1-T_ii). The path quantities are updated
+   exactly as for m+1 individual steps of the BKL algorithm */
+template<bool ACCUMPROBS>
+void BKL::bkl_skiploops(Walker &walker, int seed) {
+    const Node *node = walker.curr_node;
+    long double factor; // equal to (1-T_{ii})
+    if constexpr (ACCUMPROBS) { factor = 1.L-node->t;
+    } else { factor = Network::calc_gt_factor(*node); }
+    if (!(factor>0.L)) {
+        cout << "bkl> error: node " << node->node_id << " is absorbing, cannot skip self-loop transitions" << endl; exit(EXIT_FAILURE); }
+    // sample the number of self-loop transitions
+    unsigned long long int nloops=0;
+    if (node->t>0.L) {
+        long double log_tii = log1p(-factor); // (log) self-loop transition probability
+        long double m = floor(log(1.L-Wrapper_Method::rand_unif_met(seed))/log_tii);
+        if (!(m<static_cast<long double>(numeric_limits<unsigned long long int>::max()))) throw exception();
+        nloops = static_cast<unsigned long long int>(m);
+        walker.p += -1.L*static_cast<long double>(nloops)*log_tii;
+    }
+    // select the transition from the node, conditional on leaving the node
+    long double rand_no = Wrapper_Method::rand_unif_met(seed)*factor;
+    Edge *edgeptr = node->top_from, *last_edge = nullptr;
+    long double t=0.L; // transition probability of accepted move
+    long double cum_t=0.L; // accumulated transition probability (excluding the self-loop)
+    while (edgeptr!=nullptr) {
+        if (!(edgeptr->deadts || edgeptr->t==0.L)) {
+            if constexpr (ACCUMPROBS) { t=edgeptr->t-node->t-cum_t; // transition probability values are cumulative
+            } else { t=edgeptr->t; }
+            cum_t += t; last_edge=edgeptr;
+            if (cum_t>rand_no) break;
+        }
+        edgeptr=edgeptr->next_from;
+    }
+    if (edgeptr==nullptr) { // roundoff error in accumulated probabilities, select the last available transition
+        if (last_edge==nullptr) throw exception();
+        edgeptr=last_edge;
+    }
+    walker.prev_node = walker.curr_node;
+    walker.curr_node = edgeptr->to_node;
+    // update path quantities
+    walker.k += nloops+1;
+    PROF_COUNT(PROF_BKL_STEPS,nloops+1);
+    walker.p += -1.L*log(t);
+    if constexpr (!ACCUMPROBS) walker.s += log(edgeptr->rev_edge->t/edgeptr->t); // self-loops do not contribute to entropy flow
+    walker.t += static_cast<long double>(nloops+1)*node->t_esc;
+}
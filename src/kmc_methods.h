@@ -23,9 +23,13 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define __KMC_METHODS_H_INCLUDED__
 
 #include "network.h"
+#include "profile.h"
 #include <limits>
 #include <utility>
 #include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
 #include <typeinfo>
 #include <iomanip>
@@ -55,19 +59,20 @@ struct Walker {
     long double s; // entropy flow along path
     const Node *prev_node, *curr_node; // pointers to nodes previously and currently occupied by the walker
     vector<bool> visited;  // element is true when the corresponding bin has been visited along the trajectory
+    long double w=1.L; // statistical weight of the walker (used in WE)
 };
 
 /* arguments to be passed to Wrapper_Method object (base class for methods to handle set of trajectories) constructor */
 struct Wrapper_args {
     int nwalkers; int nbins; int nabpaths; double tintvl; int maxit; bool indepcomms; bool adaptivecomms;
-    int seed; bool debug;
+    int seed; bool debug; int nbatch; double relerr; int minpaths; int ckptpaths; bool restart;
 };
 
 /* arguments to be passed to Traj_Method object (base class for methods to propagate individual trajectories) */
 struct Traj_args {
     bool discretetime; bool statereduction;
     double tintvl; bool dumpintvls;
-    int seed; bool debug;
+    int seed; bool debug; bool skiploops; bool lazytime;
 };
 
 /* arguments for state reduction procedures, is a member of a Traj_Method object but only used in KPS derived class */
@@ -77,6 +82,45 @@ struct SR_args{
     bool gth; bool mfpt;
 };
 
+/* sparse breadth-first search (BFS) engine to find a community on-the-fly. The flags of nodes are stamped with the number
+   of the current search (epoch), so that they are not reset between searches, and the nodes flagged in the current search
+   are recorded in a touched list. Hence the cost of a search scales with the size of the community found, not the network */
+struct Sparse_BFS {
+    vector<idx_t> touched;      // positions of nodes flagged in the current search (in order of flagging)
+    int N_B=0, N_c=0, N_e=0;    // numbers of community nodes, absorbing boundary nodes, and edges of the subnetwork
+
+    Sparse_BFS()=default;
+    Sparse_BFS(idx_t,double);
+    void find_comm(const Network&,const Node*,int,int=-1); // find community containing the initial node, with max allowed size (and optionally within a given pre-defined community)
+    /* flag of node (community=2, absorbing boundary=3, otherwise 0) in the current search */
+    inline int flag(idx_t pos) const { return epochs[pos]==epoch?flags[pos]:0; }
+
+    private:
+    vector<unsigned int> epochs; // epoch of search in which the flag of each node was last set
+    vector<int> flags;          // flag of each node (valid only if the corresponding epoch is the current epoch)
+    vector<int> n_comm_edges;   // number of edges from an absorbing boundary node to the community nodes
+    unsigned int epoch=0;       // number of the current search
+    long double log_minrate;    // log of min. allowed transition rate, compared directly with the log rates of edges
+};
+
+/* online estimator for the mean and variance of a quantity, updated as each observation is made. The variance is computed by Welford's
+   algorithm, and the standard error of the mean is estimated by the method of batch means. The observations are grouped into at most
+   maxbatches batches, and when this number is reached, neighbouring batches are merged so that the batch size is doubled */
+struct Online_Estimator {
+
+    static const int maxbatches=64;
+    unsigned long long int n=0; // number of observations
+    long double mean=0.L, m2=0.L; // running mean and sum of squared deviations from the mean
+    vector<long double> batch_sums; // sums of observations in completed batches
+    unsigned long long int batch_size=1;
+    long double curr_sum=0.L; unsigned long long int curr_n=0; // sum of observations and number of observations in current batch
+
+    void add(long double);
+    long double var() const;
+    long double std_err() const;
+    long double rel_err() const;
+};
+
 /* abstract class for wrapper (trajectory handling) enhanced sampling methods */
 class Wrapper_Method {
 
@@ -96,6 +140,21 @@ class Wrapper_Method {
     bool debug;                 // debug printing on/off
     vector<Walker> walkers;     // list of independent trajectories (walkers) on the network
     void (*kmc_func)(Walker&);  // function pointer to kMC algorithm for propagating the trajectory   
+    int nbatch;                 // number of walkers propagated in lockstep by each thread with the batched BKL engine (0 if not used)
+    double mfptrelerr;          // target relative error of the MFPT, simulation terminates early when this is reached (0 if not used)
+    int minpaths;               // min. number of A<-B paths before the early termination condition is checked
+    bool converged=false;       // the target relative error of the MFPT has been reached
+    Online_Estimator fpt_est, len_est, prob_est, ent_est; // online estimators for first passage time, path length, path probability and entropy flow
+    int ckptpaths;              // number of paths (or blocks of walkers) simulated between writing checkpoint files (0 if not used)
+    bool restart;               // the simulation is restarted from the checkpoint file
+    vector<string> rng_states;  // serialised states of the random number streams of the threads, at the last checkpoint
+
+    void save_rng_state();      // called by each thread to save its random number stream
+    void restore_rng_state();   // called by each thread to restore its random number stream
+    void write_checkpoint(int,const vector<long double>&); // write the state of the simulation to the checkpoint file
+    int read_checkpoint(const Network&,vector<long double>&); // read the state of the simulation from the checkpoint file
+
+    void setup_batch(vector<Walker>&,int,int,int,int); // set up a block of walkers to be propagated in lockstep
 
     public:
 
@@ -104,11 +163,14 @@ class Wrapper_Method {
     virtual void run_enhanced_kmc(const Network&,Traj_Method*)=0; // pure virtual function
     static const Node *get_initial_node(const Network&, Walker&,int); // sample an initial node
     void set_standard_kmc(void(*)(Walker&)); // function to set the kmc_std_method
-    static vector<int> find_comm_onthefly(const Network&,const Node*,double,int); // find a community on-the-fly based on max allowed rate and size
     void update_tp_stats(Walker&,bool,bool); // update the transition path statistics, depends on if the path is a transn path or is unreactive
+    void update_path_estimators(const Walker&); // update the online estimators for first passage path properties
+    void write_path_estimators(); // print the online estimates for first passage path properties
     void calc_tp_stats(int);    // calculate the transition path statistics from the observed counts
     void write_tp_stats(int);   // write transition path statistics to file
+    static default_random_engine &rng(int=19); // random number generator for the calling thread
     static long double rand_unif_met(int=19); // draw uniform random number between 0 and 1
+    static bool solve_linear_system(vector<vector<long double>>,vector<long double>&); // solve a dense linear system of equations
 
     template <typename T>
     static void write_vec(const vector<T>& vec, string fname, int precision=30) {
@@ -166,13 +228,14 @@ class WE : public Wrapper_Method {
     private:
 
     double taure; // time interval between checking communities and resampling trajectories
-    double adaptminrate;
+    vector<int> commstargs; // target number of walkers in each community
 
-    void we_resampling();
+    void we_resampling(const Network&);
+    void resample_comm(const vector<int>&,int,vector<Walker>&);
 
     public:
 
-    WE(const Network&,double,const Wrapper_args&);
+    WE(const Network&,const vector<int>&,double,const Wrapper_args&);
     ~WE();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -182,11 +245,16 @@ class FFS : public Wrapper_Method {
 
     private:
 
-    // ...
+    int nconfigs;   // number of configurations to be collected at the first interface in the initial flux stage
+    int ntrials;    // max. number of trial trajectories fired from each interface
+    double relerr;  // trials from an interface are stopped early when the relative error of the crossing probability is below this value
+
+    long double calc_initial_flux(const Network&,Traj_Method*,vector<const Node*>&);
+    long double fire_trials(const Network&,Traj_Method*,int,const vector<const Node*>&,vector<const Node*>&,int&,int&);
 
     public:
 
-    FFS(const Network&,const Wrapper_args&);
+    FFS(const Network&,int,int,double,const Wrapper_args&);
     ~FFS();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -194,9 +262,26 @@ class FFS : public Wrapper_Method {
 /* non-equilibrium umbrella sampling kMC */
 class NEUS : public Wrapper_Method {
 
+    private:
+
+    int nwalkers_comm; // number of walkers restrained to each community (region)
+    double taure;      // time interval between updates of the region weights and entry point distributions
+    vector<bool> active_comms;  // indicates that the region contains nodes not in A, and therefore has walkers
+    vector<long double> comm_wts; // weights of regions
+    vector<long double> comm_times; // total time simulated by the walkers restrained to each region
+    vector<vector<unsigned long long int>> n_exits; // numbers of exits from each region to each other region (including recycling)
+    vector<unsigned long long int> n_exits_a; // numbers of exits from each region into A
+    vector<unordered_map<long long int,unsigned long long int>> entries; // for each region, counts of entry points, keyed by
+        // (source region ID)*(no. of nodes)+(position of entry node)
+    vector<Alias_Table> entry_tables; // tables to sample the entry points of each region, weighted by the current region weights
+
+    void update_weights();
+    void update_entry_tables(const Network&);
+    long double calc_flux_a();
+
     public:
 
-    NEUS(const Network&,const Wrapper_args&);
+    NEUS(const Network&,double,const Wrapper_args&);
     ~NEUS();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -204,9 +289,29 @@ class NEUS : public Wrapper_Method {
 /* milestoning kMC */
 class MILES : public Wrapper_Method {
 
+    private:
+
+    int ntrajs;     // number of trajectories launched from each milestone
+    int nmiles;     // number of milestones, including the initial set B (first) and the target set A (last)
+    int ncomms;     // number of communities
+    unordered_map<int,int> mile_ids; // map from ID of pair of adjacent communities to milestone ID
+    vector<pair<int,int>> mile_comms; // pairs of adjacent communities defining each milestone
+    vector<Alias_Table> start_tables; // tables to sample the starting nodes of trajectories launched from each milestone
+    vector<vector<unsigned long long int>> n_hits; // numbers of trajectories launched from each milestone that hit each other milestone
+    vector<long double> lifetimes; // mean times for trajectories launched from each milestone to hit another milestone
+    vector<int> n_launched; // numbers of trajectories launched from each milestone
+    vector<unordered_map<long long int,unsigned long long int>> hit_points; // for each milestone, counts of nodes at which the
+        // milestone was hit, keyed by (ID of milestone from which the trajectory was launched)*(no. of nodes)+(position of node)
+
+    int get_mile_id(int,int,int) const;
+    void launch_trajs(const Network&,Traj_Method*);
+    vector<long double> calc_mfpts();
+    void update_start_tables(const Network&);
+    void write_miles_info(const vector<long double>&);
+
     public:
 
-    MILES(const Network&,const Wrapper_args&);
+    MILES(const Network&,int,const Wrapper_args&);
     ~MILES();
     void run_enhanced_kmc(const Network&,Traj_Method*);
 };
@@ -223,6 +328,7 @@ class REA : public Wrapper_Method {
     vector<vector<Walker>> shortest_paths; // k-th shortest paths to all nodes of the network
     vector<vector<pair<const Walker*,const Edge*>>> candidate_paths; // pointers to possible candidates for next shortest path to each node of the network
     vector<bool> nomorecands; // if Markov chain is not irreducible, record nodes for which no more candidate paths are available
+    long long int sp_bytes, cp_bytes; // memory of the tables of shortest and candidate paths (bytes)
 
     void dijkstra(const Network&);
     void next_path(const Node&,int);
@@ -237,34 +343,112 @@ class REA : public Wrapper_Method {
     void run_enhanced_kmc(const Network&, Traj_Method*);
 };
 
+/* deterministic computation of the transient (time-dependent) occupation probabilities and first passage time distribution by
+   uniformisation. The transition matrix of the uniformised chain is stored in compressed sparse row format, by incoming edges */
+class UNIF : public Wrapper_Method {
+
+    private:
+
+    bool discretetime;
+    long double trajt;          // final time of the time grid
+    double unifeps;             // max. truncation error of the Poisson series, over all time intervals
+    long double lambda;         // uniformisation rate (CTMC), or inverse lag time (DTMC)
+    vector<idx_t> in_offsets;   // position of the first incoming transition to each node in the in_from and in_p arrays
+    vector<idx_t> in_from;      // positions of the nodes from which incoming transitions originate
+    vector<double> in_p, p_diag; // probabilities of incoming transitions, and of self-transitions, of the uniformised chain
+    vector<double> p_absorb;    // probability that a transition of the uniformised chain from a node is to a node in A
+    vector<double> p_init;      // initial occupation probability distribution (over nodes in B)
+    vector<idx_t> out_nodes;    // positions of nodes for which occupation probabilities are written
+    long long int mtx_bytes;    // memory of the uniformised transition matrix (bytes)
+    unsigned long long int n_matvec=0; // total no. of matrix-vector products
+
+    void matvec(const vector<double>&,const vector<double>&,vector<double>&,vector<double>&,const Network&);
+    static void poisson_weights(long double,double,int&,int&,vector<double>&);
+    void write_grid_point(ofstream&,ofstream&,long double,const vector<double>&,const vector<double>&,const Network&);
+
+    public:
+
+    UNIF(const Network&,bool,long double,double,const vector<idx_t>&,const Wrapper_args&);
+    ~UNIF();
+    void run_enhanced_kmc(const Network&, Traj_Method*);
+};
+
+/* spectral analysis of a reversible Markov chain, by the Lanczos algorithm applied to the matrix L, which is the negative of the
+   rate matrix (CTMC) or the identity minus the transition matrix (DTMC), symmetrised using the stationary distribution. The
+   eigenvalues of L of smallest magnitude are the relaxation rates of the slowest dynamical modes */
+class SPECTRAL : public Wrapper_Method {
+
+    private:
+
+    bool discretetime;
+    int neigs;                  // number of eigenpairs to be computed
+    int nlanczos;               // dimension of the Krylov subspace (no. of Lanczos vectors) before a restart
+    double shift;               // shift for the shift-invert operator (zero if the operator is not inverted)
+    long double lambda;         // largest diagonal element of L, used to scale the operator if not inverted
+    long double tau;            // lag time (DTMC)
+    static constexpr double tol=1.E-10; // tolerance on the (relative) residual norms of the eigenpairs, and of the CG solver
+    vector<idx_t> offsets;      // position of the first off-diagonal element of each row of L in the cols and vals arrays
+    vector<idx_t> cols;         // column indices of the off-diagonal elements of L
+    vector<double> vals, diag;  // off-diagonal and diagonal elements of L
+    vector<double> sqrt_pi;     // square roots of the stationary probabilities
+    long long int basis_bytes;  // memory of the matrix L and of the Lanczos vectors (bytes)
+    unsigned long long int n_op=0, n_cg=0; // total no. of applications of the operator, and of iterations of the CG solver
+
+    void apply_l(const vector<double>&,vector<double>&) const;
+    void apply_op(const vector<double>&,vector<double>&);
+    void solve_cg(const vector<double>&,vector<double>&);
+    static double dot(const vector<double>&,const vector<double>&);
+    static void sym_eigen(vector<vector<double>>&,vector<double>&,vector<vector<double>>&);
+
+    public:
+
+    SPECTRAL(const Network&,bool,int,int,double,const Wrapper_args&);
+    ~SPECTRAL();
+    void run_enhanced_kmc(const Network&, Traj_Method*);
+};
+
 /* abstract class for methods to propagate individual trajectories */
 class Traj_Method {
 
     protected:
 
     bool discretetime;          // transition probabilities represent a discrete-time Markov chain
+    bool skiploops;             // for a DTMC, sample the number of consecutive self-loop transitions in a single step
+    bool lazytime;              // for a CTMC, the waiting times are not sampled at each step, only the total path time is sampled when A is hit
     double tintvl;              // time interval for dumping trajectory data
     double next_tintvl;         // next time for dumping trajectory data
     bool dumpintvls;            // specifies that trajectory data is to be dumped at the time intervals
     int seed;
     bool debug;
+    void (*bkl_step)(Walker&,int)=nullptr; // BKL kernel specialised for the type of Markov chain, selected on construction
+
+    void dump_traj(Walker&,bool,bool,long double,double&); // as below, but with a separate next time for dumping data for the walker
 
     public:
 
     Traj_Method(const Traj_args&);
     virtual ~Traj_Method();
     Traj_Method(const Traj_Method&);
-    virtual Traj_Method* clone() {}
+    virtual Traj_Method* clone()=0;
     void dump_traj(Walker&,bool,bool,long double=numeric_limits<long double>::infinity()); // call function to dump walker info and then update next_tintvl;
+    double get_next_tintvl() const { return next_tintvl; } // the next time for dumping trajectory data is saved in checkpoints
+    void set_next_tintvl(double next_t) { next_tintvl=next_t; }
     virtual void kmc_iteration(const Network&,Walker&)=0;
     virtual void do_bkl_steps(const Network&,Walker&,long double=numeric_limits<long double>::infinity()) {} // dummy function overridden in KPS and MCAMC to do BKL steps after a basin escape
     virtual void reset_nodeptrs() {} // dummy function overridden in KPS and MCAMC to reset basin and absorbing node pointers when A is hit
+    virtual void sample_lazy_time(Walker&) {} // dummy function overridden in BKL to sample the path time when A is hit (LAZYTIME)
+    virtual unsigned long long int kmc_batch(const Network&,vector<Walker>&,long double,bool) { throw exception(); } // overridden in BKL
     bool statereduction=false;    // purpose of the computation is to perform a state reduction procedure, not a simulation
 };
 
 /* rejection-free algorithm of Bortz, Kalos and Lebowitz (aka n-fold way algorithm) */
 class BKL : public Traj_Method {
 
+    private:
+
+    vector<unsigned long long int> lazy_counts; // no. of steps from each node (indexed by node_pos) whose waiting times are not yet sampled (LAZYTIME)
+    vector<const Node*> lazy_touched;           // nodes with nonzero counts on the current path (in order of first visit)
+
     public:
 
     BKL(const Network&,const Traj_args&);
@@ -272,54 +456,108 @@ class BKL : public Traj_Method {
     BKL(const BKL&);
     BKL* clone() { return new BKL(*this); } // NB this calls copy constructor for BKL
     void kmc_iteration(const Network&,Walker&);
-    static void bkl(Walker&,bool,bool,int);
+    unsigned long long int kmc_batch(const Network&,vector<Walker>&,long double,bool);
+    void sample_lazy_time(Walker&);
+    template<bool DISCRETETIME,bool ACCUMPROBS,bool LAZYTIME=false> static void bkl(Walker&,int);
+    template<bool ACCUMPROBS> static void bkl_skiploops(Walker&,int);
+    static void (*select_bkl(bool,bool,bool=false,bool=false))(Walker&,int);
+};
+
+/* graph transformation of a community, computed by the first walker to be trapped in the community and cached for use in kPS. The
+   original, L and U subnetworks are only read during an escape, and so are shared by all walkers, whereas the transformed subnetwork
+   accumulates the numbers of kMC hops and is copied for each escape */
+struct KPS_GT_Basin {
+    unique_ptr<Network> ktn_kps_gt, ktn_kps_orig, ktn_l, ktn_u; // transformed, original, L and U subnetworks
+    vector<idx_t> basin_nodes; // positions of the nodes of the subnetwork in the full network (sorted)
+    vector<int> basin_flags; // basin IDs of these nodes (eliminated=1, transient noneliminated=2, absorbing boundary=3)
+    vector<idx_t> eliminated_nodes; // IDs of eliminated nodes (in order)
+    unordered_map<idx_t,int> nodemap; // map of node IDs from original network to subnetwork
+    int N, N_B, N_c, N_e; // numbers of eliminated nodes, basin nodes, absorbing boundary nodes and edges of the subnetwork
+};
+
+/* cache entry for the graph transformation of a community. The entry is empty if the graph transformation could not be cached, in which
+   case it is performed for every escape from the community */
+struct KPS_GT_Slot {
+    once_flag once;
+    unique_ptr<KPS_GT_Basin> basin;
 };
 
 /* kinetic path sampling (kPS)
-   Note that the number of kMC self-hops/transition hops are stored in the Node and Edge data structures,
-   respectively, of the subnetwork stored via the ktn_kps pointer. */
+   Note that the number of kMC self-hops/transition hops are stored in the kPS-only fields (KPS_Fields) for the nodes
+   and edges, respectively, of the subnetwork stored via the ktn_kps pointer. */
 class KPS : public Traj_Method {
 
     private:
 
     Network *ktn_kps=nullptr; // pointer to the subnetwork of the TN that kPS internally uses and transforms
     Network *ktn_kps_orig=nullptr; // pointer to the original subnetwork of the TN
-    Network *ktn_kps_gt=nullptr; // pointer to the graph-transformed subnetwork (used if recycling GT of a basin)
     Network *ktn_l=nullptr, *ktn_u=nullptr; // pointers to Network objects used in LU-style decomposition of transition matrix
     vector<int> basin_ids; // used to indicate the set to which each node belongs for the current kPS iteration
         // (eliminated=1, transient noneliminated=2, absorbing boundary=3, absorbing nonboundary=0)
-    vector<int> eliminated_nodes; // vector of IDs of eliminated nodes (in order)
-    unordered_map<int,int> nodemap; // map of node IDs from original network to subnetwork
-    int nelim;      // maximum number of nodes of a trapping basin to be eliminated
+    vector<idx_t> basin_nodes; // positions of nodes with nonzero basin IDs, sorted (used to reset basin IDs sparsely)
+    Sparse_BFS bfs; // engine to find the basin on-the-fly if communities are defined adaptively or the basin size is limited by memory
+    bool bfsbasin=false; // the current basin was found by the BFS engine (and not as a whole pre-defined community)
+    bool recyclegt=false; // the graph transformation of each community is performed only once and cached
+    bool gt_cached=false; // the original, L and U subnetworks of the current basin are owned by the cache
+    shared_ptr<vector<KPS_GT_Slot>> gt_basins; // cached graph transformations for each community, shared by copies of the object
+    vector<idx_t> eliminated_nodes; // vector of IDs of eliminated nodes (in order)
+    unordered_map<idx_t,int> nodemap; // map of node IDs from original network to subnetwork
     int N_c;        // number of nodes connected to the eliminated states of the current trapping basin
     int N, N_B;     // number of eliminated nodes / total number of nodes for the currently active trapping basin
     int N_e;        // number of edges in the subnetwork
-    const Node *alpha=nullptr, *epsilon=nullptr; // final and initial microstates of current escape trajectory
-        // NB these pointers point to nodes in the original network, passed as the arg to kmc_iteration()
-    bool adaptivecomms;
     double adaptminrate; // maximum allowed rate in finding a community on-the-fly
     int kpskmcsteps; // number of kMC steps to run after each kPS trapping basin escape trajectory sampled
     SR_args sr_args{false,false,false,false,false,false}; // object containing bool values specifying which state reduction procedures to perform
     vector<long double> mfpt_vals; // vector of MFPTs (elem is non-zero for non-absorbing nodes)
+    vector<pair<vector<idx_t>,vector<idx_t>>> ab_queries; // IDs of nodes in the A and B sets for a batch of state reduction queries
     long double mu; // sum of (unnormalised) stationary probabilities in GTH algorithm
 
+    /* accessors for the kPS-only fields of the nodes and edges of the subnetwork pointed to by ktn_kps */
+    inline unsigned long long int &hops(const Node *node) { return ktn_kps->kps_fields->node_h[node->node_pos]; }
+    inline unsigned long long int &hops(const Edge *edge) { return ktn_kps->kps_fields->edge_h[edge->edge_id]; }
+    inline real_t &dtrans(const Node *node) { return ktn_kps->kps_fields->node_dt[node->node_pos]; }
+    inline real_t &dtrans(const Edge *edge) { return ktn_kps->kps_fields->edge_dt[edge->edge_id]; }
+    inline idx_t &gt_label(const Edge *edge) { return ktn_kps->kps_fields->edge_label[edge->edge_id]; }
+    inline char &gt_flag(const Node *node) { return ktn_kps->kps_fields->node_flag[node->node_pos]; }
+
+    /* kernels for the hot loops of kPS, specialised for debug printing (DEBUG) and for state reduction computations (SR),
+       and selected once by select_kernels() */
+    long double (KPS::*iterative_reverse_randomisation)()=nullptr;
+    Node *(KPS::*sample_absorbing_node)()=nullptr;
+    void (KPS::*gt_iteration)(Node*)=nullptr;
+    vector<pair<Node*,Edge*>> (KPS::*undo_gt_iteration)(Node*)=nullptr;
+
     void setup_basin_sets(const Network&,Walker&,bool);
-    long double iterative_reverse_randomisation();
-    Node *sample_absorbing_node();
+    long long int gt_mem_estimate(long long int,long long int,long long int) const;
+    void limit_basin_size(const Network&);
+    template<bool DEBUG,bool SR> long double iterative_reverse_randomisation_kernel();
+    template<bool DEBUG> Node *sample_absorbing_node_kernel();
     void graph_transformation(const Network&);
-    void gt_iteration(Node*);
-    vector<pair<Node*,Edge*>> undo_gt_iteration(Node*);
+    void get_gt_basin(const Network&,Walker&);
+    KPS_GT_Basin *cache_gt_basin();
+    template<bool DEBUG,bool SR> void gt_iteration_kernel(Node*);
+    template<bool DEBUG,bool SR> vector<pair<Node*,Edge*>> undo_gt_iteration_kernel(Node*);
+    template<bool DEBUG,bool SR> void set_kernels();
+    void select_kernels();
     void update_path_quantities(Walker&,long double,const Node*);
     Network *get_subnetwork(const Network&,bool);
     void do_bkl_steps(const Network&,Walker&,long double=numeric_limits<long double>::infinity());
-    void reset_nodeptrs();
     void calc_committor(const Network&);
     void calc_absprobs(); void calc_mfpt(); void calc_gth();
     void calc_fundamentalred(const Network&);
+    void calc_batch_queries(const Network&);
     void write_renormalised_probs(string);
     void rewrite_stat_probs(const Network&);
     static long double committor_boundary_node(const Network&,int,const vector<long double>,int);
 
+    protected:
+
+    int nelim;      // maximum number of nodes of a trapping basin to be eliminated
+    const Node *alpha=nullptr, *epsilon=nullptr; // final and initial microstates of current escape trajectory
+        // NB these pointers point to nodes in the original network, passed as the arg to kmc_iteration()
+    bool adaptivecomms;
+    void reset_nodeptrs();
+
     public:
 
     KPS(const Network&,int,int,bool,double,const Traj_args&);
@@ -327,6 +565,7 @@ class KPS : public Traj_Method {
     KPS(const KPS&);
     KPS* clone() { return new KPS(*this); }
     void set_statereduction_procs(const SR_args&);
+    void set_ab_queries(const vector<pair<vector<idx_t>,vector<idx_t>>>&);
     void kmc_iteration(const Network&,Walker&);
     static void reset_kmc_hop_counts(Network&);
     static long double gamma_distribn(unsigned long long int,long double,int);
@@ -336,7 +575,59 @@ class KPS : public Traj_Method {
     static void test_ktn(const Network&);
 };
 
+/* hybrid method that propagates the trajectory by BKL, and switches to kPS only when the walker is detected to be trapped. The flicker
+   statistics of the walker are monitored over a sliding window of the most recent BKL steps: the walker is considered trapped when few
+   distinct nodes are visited within the window and (if the communities are not determined adaptively) the window is spent entirely within
+   the current community. The window length is adapted on-the-fly according to the lengths of the kPS escape trajectories */
+class HYBRID : public KPS {
+
+    private:
+
+    int flickwindow;           // initial (and minimum) length of sliding window of BKL steps used to detect trapping
+    double flickfrac;          // walker is trapped if the fraction of distinct nodes visited in the window does not exceed this value
+    int window_len;            // current length of the sliding window
+    int window_pos=0, n_window=0; // position of the next entry in the (circular) window / number of entries in the window
+    int n_distinct=0;          // number of distinct nodes visited in the window
+    int dwell_comm=-1, comm_dwell=0; // current community and number of consecutive BKL steps spent in it
+    bool trapped=false;        // flag indicates that the next iteration is a kPS basin escape
+    vector<idx_t> window_nodes; // positions of nodes visited in the window
+    vector<idx_t> visit_counts; // number of visits to each node in the window, indexed by node position
+
+    bool update_flicker_stats(const Node*);
+    void reset_flicker_stats();
+    void do_bkl_steps(const Network&,Walker&,long double=numeric_limits<long double>::infinity()) {} // BKL steps are handled in kmc_iteration
+    void reset_nodeptrs();
+
+    public:
+
+    HYBRID(const Network&,int,bool,double,int,double,const Traj_args&);
+    ~HYBRID();
+    HYBRID(const HYBRID&);
+    HYBRID* clone() { return new HYBRID(*this); }
+    void kmc_iteration(const Network&,Walker&);
+};
+
 /* Monte Carlo with absorbing Markov chains (MCAMC) */
+/* factorisation of the absorbing Markov chain for a trapping basin (community), computed once and cached for use in MCAMC */
+struct MCAMC_Basin {
+    vector<const Node*> trans_nodes, abs_nodes; // transient (basin) and absorbing (boundary) nodes
+    unordered_map<idx_t,int> trans_idcs; // map from position of node in the network to index of transient node
+    // FPTA: for the spectral decomposition of the transient block, T=D^{-1/2}VLV^TD^{1/2}, where D is the diagonal matrix of stationary probs
+    vector<long double> evals; // eigenvalues (diagonal of L)
+    vector<vector<long double>> evecs_l; // D^{-1/2}V
+    vector<long double> evecs_sum; // V^TD^{1/2}1
+    vector<vector<long double>> evecs_abs; // V^TD^{1/2} multiplied by the transient-absorbing block
+    // MEANRATE: mean number of steps to absorption and cumulative absorption probabilities, for each transient node
+    vector<long double> mean_steps;
+    vector<vector<long double>> absprobs;
+};
+
+/* cache entry for the factorisation of a community, which is computed by the first walker to visit the community */
+struct MCAMC_Basin_Slot {
+    once_flag once;
+    unique_ptr<MCAMC_Basin> basin;
+};
+
 class MCAMC : public Traj_Method {
 
     private:
@@ -344,6 +635,12 @@ class MCAMC : public Traj_Method {
     int kpskmcsteps; // number of kMC steps to run after each MCAMC trapping basin escape trajectory sampled
     bool meanrate; // if True, use (approximate) mean rate method, else use (exact) FPTA method
     const Node *alpha=nullptr, *epsilon=nullptr; // final and initial microstates of current escape trajectory
+    shared_ptr<vector<MCAMC_Basin_Slot>> basins; // cached factorisations for each community, shared by copies of the object
+
+    const MCAMC_Basin &get_basin(const Network&,int);
+    MCAMC_Basin *factorise_basin(const Network&,int);
+    const Node *sample_escape_fpta(const MCAMC_Basin&,int,unsigned long long int&);
+    const Node *sample_escape_meanrate(const MCAMC_Basin&,int,unsigned long long int&);
 
     public:
 
@@ -43,6 +43,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <cmath>
 #include <random>
 #include <numeric>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
@@ -58,22 +59,33 @@ KPS::KPS(const Network &ktn, int nelim, int kpskmcsteps, bool adaptivecomms, dou
     this->nelim=nelim; this->kpskmcsteps=kpskmcsteps;
     this->adaptivecomms=adaptivecomms; this->adaptminrate=adaptminrate;
     basin_ids.resize(ktn.n_nodes);
+    recyclegt = !adaptivecomms && !statereduction && ktn.ncomms>0;
+    if (recyclegt) gt_basins = make_shared<vector<KPS_GT_Slot>>(ktn.ncomms);
+    if (adaptivecomms || Mem_Accounting::budget>0) bfs=Sparse_BFS(ktn.n_nodes,adaptminrate);
+    bkl_step=BKL::select_bkl(discretetime,ktn.accumprobs);
+    select_kernels();
 }
 
 /* destructor for KPS class */
 KPS::~KPS() {
-    if (ktn_kps!=nullptr) delete ktn_kps; if (ktn_kps_orig!=nullptr) delete ktn_kps_orig;
-    if (ktn_kps_gt!=nullptr) delete ktn_kps_gt;
-    if (ktn_l!=nullptr) delete ktn_l; if (ktn_u!=nullptr) delete ktn_u;
+    if (ktn_kps!=nullptr) delete ktn_kps;
+    if (!gt_cached) { // otherwise the original, L and U subnetworks are owned by the cache
+        if (ktn_kps_orig!=nullptr) delete ktn_kps_orig;
+        if (ktn_l!=nullptr) delete ktn_l; if (ktn_u!=nullptr) delete ktn_u;
+    }
     if (sr_args.mfpt) mfpt_vals.clear();
 }
 
 /* copy constructor for KPS class */
 KPS::KPS(const KPS &kps_obj) : Traj_Method(kps_obj) {
     this->nelim=kps_obj.nelim; this->kpskmcsteps=kps_obj.kpskmcsteps;
-    this->adaptivecomms=false; this->adaptminrate=-1.;
+    this->adaptivecomms=kps_obj.adaptivecomms; this->adaptminrate=kps_obj.adaptminrate;
     if (kps_obj.statereduction) this->set_statereduction_procs(kps_obj.sr_args);
+    this->ab_queries=kps_obj.ab_queries;
     this->basin_ids.resize(kps_obj.basin_ids.size());
+    this->recyclegt=kps_obj.recyclegt; this->gt_basins=kps_obj.gt_basins;
+    if (adaptivecomms || Mem_Accounting::budget>0) this->bfs=Sparse_BFS(kps_obj.basin_ids.size(),adaptminrate);
+    select_kernels();
 }
 
 /* call to this function indicates that the purpose fo the computation is state reduction to calculate exact dynamical quantities, and not
@@ -83,18 +95,45 @@ void KPS::set_statereduction_procs(const SR_args &sr_args) {
     this->sr_args.absorption=sr_args.absorption; this->sr_args.committor=sr_args.committor;
     this->sr_args.fundamentalirred=sr_args.fundamentalirred; this->sr_args.fundamentalred=sr_args.fundamentalred;
     this->sr_args.gth=sr_args.gth; this->sr_args.mfpt=sr_args.mfpt;
+    select_kernels();
+}
+
+/* set the pointers to the kPS kernels specialised for the given compile-time flags */
+template<bool DEBUG,bool SR>
+void KPS::set_kernels() {
+    iterative_reverse_randomisation=&KPS::iterative_reverse_randomisation_kernel<DEBUG,SR>;
+    sample_absorbing_node=&KPS::sample_absorbing_node_kernel<DEBUG>;
+    gt_iteration=&KPS::gt_iteration_kernel<DEBUG,SR>;
+    undo_gt_iteration=&KPS::undo_gt_iteration_kernel<DEBUG,SR>;
+}
+
+/* select the kPS kernels once, so that the debug and state reduction flags are not checked in the inner loops of the
+   graph transformation and iterative reverse randomisation procedures */
+void KPS::select_kernels() {
+    if (debug) {
+        if (statereduction) { set_kernels<true,true>(); } else { set_kernels<true,false>(); }
+    } else {
+        if (statereduction) { set_kernels<false,true>(); } else { set_kernels<false,false>(); }
+    }
+}
+
+/* set the A and B sets for a batch of state reduction queries, which share a single graph transformation of the
+   nodes that do not belong to any of the endpoint sets */
+void KPS::set_ab_queries(const vector<pair<vector<idx_t>,vector<idx_t>>> &ab_queries) {
+    cout << "kps> state reduction procedures are to be performed for a batch of " << ab_queries.size() << " A<-B queries" << endl;
+    this->ab_queries=ab_queries;
 }
 
 void KPS::test_ktn(const Network &ktn) {
     cout << "debug> ktn info: no. of nodes: " << ktn.n_nodes << " no. of edges: " << ktn.n_edges << endl;
-    for (int i=0;i<ktn.n_nodes;i++) {
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
         cout << "node: " << ktn.nodes[i].node_id << endl;
-        if (!ktn.nodes[i].eliminated) cout << "  to: " << ktn.nodes[i].node_id << "  t: " << ktn.nodes[i].t << "  h: " << ktn.nodes[i].h << endl;
+        if (!ktn.nodes[i].eliminated) cout << "  to: " << ktn.nodes[i].node_id << "  t: " << ktn.nodes[i].t << "  h: " << ktn.kps_fields->node_h[i] << endl;
         Edge *edgeptr = ktn.nodes[i].top_from;
         while (edgeptr!=nullptr) {
             if (!edgeptr->deadts && !edgeptr->to_node->eliminated) {
                 cout << "  to: " << edgeptr->to_node->node_id << "  t: " << edgeptr->t \
-                     << "  h: " << edgeptr->h << endl; }
+                     << "  h: " << ktn.kps_fields->edge_h[edgeptr->edge_id] << endl; }
             edgeptr = edgeptr->next_from;
         }
     }
@@ -104,32 +143,33 @@ void KPS::test_ktn(const Network &ktn) {
 /* perform a single kPS basin escape iteration */
 void KPS::kmc_iteration(const Network &ktn, Walker &walker) {
 
-    if (!(!adaptivecomms && ktn.ncomms==2 && ktn_kps_orig!=nullptr)) { // for a two-state problem, only need to setup basin and do GT once
+    if (!ab_queries.empty()) { calc_batch_queries(ktn); return; } // the computation is a batch of state reduction queries
+    TRACE_SCOPE("escape");
+
+    if (!recyclegt) {
         setup_basin_sets(ktn,walker,true);
         graph_transformation(ktn);
-    } else {
+    } else { // the GT of each community is performed only once
         setup_basin_sets(ktn,walker,false); // get the new initial node without updating the definition of the basin
+        get_gt_basin(ktn,walker);
     }
     if (statereduction && !sr_args.fundamentalirred && !sr_args.mfpt && !sr_args.gth) {
         return;
     } else if (!statereduction) {
-        Node *dummy_alpha = sample_absorbing_node();
+        Node *dummy_alpha = (this->*sample_absorbing_node)();
         alpha = &ktn.nodes[dummy_alpha->node_id-1];
     }
-    long double t_traj = iterative_reverse_randomisation();
+    long double t_traj = (this->*iterative_reverse_randomisation)();
     if (statereduction) {
         if (sr_args.mfpt) calc_mfpt();
         if (sr_args.gth) calc_gth();
         return;
     }
     update_path_quantities(walker,t_traj,alpha);
+    PROF_COUNT(PROF_ESCAPES,1);
     delete ktn_kps; ktn_kps=nullptr;
-    if (!(!adaptivecomms && ktn.ncomms==2)) {
-        delete ktn_kps_orig; ktn_kps_orig=nullptr;
-        delete ktn_l; delete ktn_u; ktn_l=nullptr; ktn_u=nullptr;
-    } else { // restore the graph transformed subnetwork
-        ktn_kps = new Network(*ktn_kps_gt);
-    }
+    if (!gt_cached) { delete ktn_kps_orig; delete ktn_l; delete ktn_u; }
+    ktn_kps_orig=nullptr; ktn_l=nullptr; ktn_u=nullptr; gt_cached=false;
     epsilon=alpha; alpha=nullptr;
 }
 
@@ -140,9 +180,10 @@ void KPS::kmc_iteration(const Network &ktn, Walker &walker) {
 void KPS::do_bkl_steps(const Network &ktn, Walker &walker, long double maxtime) {
 
     if (adaptivecomms) return;
+    PROF_SCOPE(PROF_BKL);
     int n_kmcit=0;
     while ((n_kmcit<kpskmcsteps || ktn.comm_sizes[epsilon->comm_id]>nelim) && walker.t<maxtime) { // quack force BKL simulation to continue if active community is large
-        BKL::bkl(walker,discretetime,ktn.accumprobs,seed);
+        bkl_step(walker,seed);
         alpha=walker.curr_node;
         if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[alpha->bin_id]=true;
         if (alpha->comm_id!=epsilon->comm_id || walker.t>maxtime) { // traj data is not dumped unless comm changes, regardless of tintvl, except if (DIMREDN) max time is exceeded
@@ -160,6 +201,7 @@ void KPS::reset_nodeptrs() {
 /* Reset data of previous kPS iteration and find the microstates of the current trapping basin */
 void KPS::setup_basin_sets(const Network &ktn, Walker &walker, bool get_new_basin) {
 
+    PROF_SCOPE(PROF_SETUP_BASIN);
     if (debug) cout << "\nkps> setting up basin sets" << endl;
     bool newpath=false;
     if (statereduction) { // not simulating a trajectory, set epsilon to any node not in A
@@ -174,24 +216,29 @@ void KPS::setup_basin_sets(const Network &ktn, Walker &walker, bool get_new_basi
     }
     if (!get_new_basin) return; // the basin is not to be updated
     N_c=0; N=0; N_B=0; N_e=0;
-    fill(basin_ids.begin(),basin_ids.end(),0); // reset basin IDs (zero flag indicates absorbing nonboundary node)
+    bfsbasin=adaptivecomms;
+    // reset basin IDs of the nodes of the previous basin (zero flag indicates absorbing nonboundary node)
+    for (idx_t pos: basin_nodes) basin_ids[pos]=0;
+    basin_nodes.clear();
     if (!adaptivecomms) { // basin IDs are based on community IDs
         // find all nodes of the current occupied pre-set community, mark these nodes as transient noneliminated
         if (debug) cout << "basin nodes:" << endl;
-        for (int i=0;i<ktn.n_nodes;i++) {
+        for (idx_t i=0;i<ktn.n_nodes;i++) {
             if (ktn.nodes[i].comm_id==epsilon->comm_id) {
                 if (debug) cout << "  " << i+1;
-                basin_ids[i]=2; N_B++; N_e+=ktn.nodes[i].udeg; }
+                basin_ids[i]=2; N_B++; N_e+=ktn.nodes[i].udeg;
+                basin_nodes.push_back(i); }
         }
         if (debug) cout << endl << "absorbing nodes:" << endl;
         // find all absorbing boundary nodes
-        for (int i=0;i<ktn.n_nodes;i++) {
-            if (basin_ids[i]!=2) continue;
+        for (int k=0;k<N_B;k++) {
+            idx_t i=basin_nodes[k];
             Edge *edgeptr = ktn.nodes[i].top_from;
             while (edgeptr!=nullptr) {
                 if (edgeptr->deadts) { edgeptr=edgeptr->next_from; continue; }
                 if (edgeptr->to_node->comm_id!=epsilon->comm_id && !basin_ids[edgeptr->to_node->node_id-1]) {
                     basin_ids[edgeptr->to_node->node_id-1]=3; // flag absorbing boundary node
+                    basin_nodes.push_back(edgeptr->to_node->node_id-1);
                     N_c++;
                     if (debug) cout << "  " << edgeptr->to_node->node_id;
                 }
@@ -200,24 +247,14 @@ void KPS::setup_basin_sets(const Network &ktn, Walker &walker, bool get_new_basi
             }
         }
         if (debug) cout << endl;
-    } else {
-        vector<int> nodes_in_comm = Wrapper_Method::find_comm_onthefly(ktn,epsilon,adaptminrate,nelim);
-        basin_ids=nodes_in_comm;
-        for (int i=0;i<ktn.n_nodes;i++) {
-            if (basin_ids[i]==2) {
-                N_B++; N_e+=ktn.nodes[i].udeg;
-                
-            } else if (basin_ids[i]==3) {
-                N_c++; int N_e_add=0;
-                Edge *edgeptr = ktn.nodes[i].top_from;
-                while (edgeptr!=nullptr) {
-                    if (!edgeptr->deadts && basin_ids[edgeptr->to_node->node_id-1]==2) N_e_add++;
-                    edgeptr=edgeptr->next_from;
-                }
-                N_e+=N_e_add;
-            }
-        }
+        if (Mem_Accounting::budget>0 && !statereduction) limit_basin_size(ktn);
+    } else { // sparse BFS from the initial node, visits only the basin and its boundary
+        bfs.find_comm(ktn,epsilon,nelim);
+        for (idx_t pos: bfs.touched) basin_ids[pos]=bfs.flag(pos);
+        basin_nodes=bfs.touched;
+        N_B=bfs.N_B; N_c=bfs.N_c; N_e=bfs.N_e;
     }
+    sort(basin_nodes.begin(),basin_nodes.end()); // subnetwork nodes are in the same order as in the full network
     eliminated_nodes.clear(); nodemap.clear();
     eliminated_nodes.reserve(!(N_B>nelim)?N_B:nelim);
     if (debug) {
@@ -229,22 +266,61 @@ void KPS::setup_basin_sets(const Network &ktn, Walker &walker, bool get_new_basi
     }
 }
 
+/* estimate of the memory (bytes) required for the graph transformation of a basin with the given numbers of basin nodes, absorbing
+   boundary nodes and edges, namely for the transformed, original, L and U subnetworks. The transformed subnetwork is allocated with
+   space for the maximum possible number of fill-in edges */
+long long int KPS::gt_mem_estimate(long long int n_b, long long int n_c, long long int n_e) const {
+    bool lu_nets = !statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth;
+    long long int n_elim=min<long long int>(n_b,nelim);
+    long long int n_edges = max(2*n_e,(n_b*(n_b-1))+(2*n_b*n_c));
+    if (lu_nets) n_edges += 2*n_e+(n_elim*(n_b+n_c-1))+((n_elim*(2*(n_b+n_c)-1-n_elim))/2);
+    long long int n_edges_kps = (n_b*(n_b-1))+(2*n_b*n_c); // entries of the edges vector of the transformed subnetwork
+    return (lu_nets?4:1)*(n_b+n_c)*sizeof(Node)+n_edges*sizeof(Edge)+ \
+           (n_b+n_c)*KPS_Fields::node_bytes+n_edges_kps*KPS_Fields::edge_bytes;
+}
+
+/* if the memory required for the graph transformation of the current basin would exceed the remaining memory budget, replace the
+   basin by the subset of the community found by a BFS from the current node, with the largest size (found by successive halving)
+   for which the memory required is within the budget. The effective value of NELIM is thereby lowered for this kPS iteration */
+void KPS::limit_basin_size(const Network &ktn) {
+
+    long long int avail=Mem_Accounting::available();
+    if (gt_mem_estimate(N_B,N_c,N_e)<=avail) return;
+    int maxsz=N_B;
+    do {
+        maxsz = maxsz>nelim?nelim:maxsz/2;
+        if (maxsz<1) {
+            cout << "kps> error: memory budget is too small for the graph transformation of a single node" << endl;
+            exit(EXIT_FAILURE); }
+        bfs.find_comm(ktn,epsilon,maxsz,epsilon->comm_id);
+    } while (gt_mem_estimate(bfs.N_B,bfs.N_c,bfs.N_e)>avail);
+    if (debug) cout << "kps> basin of " << N_B << " nodes reduced to " << bfs.N_B << " nodes to fit within the memory budget" << endl;
+    for (idx_t pos: basin_nodes) basin_ids[pos]=0;
+    for (idx_t pos: bfs.touched) basin_ids[pos]=bfs.flag(pos);
+    basin_nodes=bfs.touched;
+    N_B=bfs.N_B; N_c=bfs.N_c; N_e=bfs.N_e;
+    bfsbasin=true;
+    Mem_Accounting::n_limited++;
+}
+
 /* Iterative reverse randomisation procedure to stochastically sample the hopping matrix
    H^(0) corresponding to T^(0), given H^(N) and the {T^(n)} for 0 <= n <= N.
    Return a sampled time for the stochastic escape trajectory. */
-long double KPS::iterative_reverse_randomisation() {
+template<bool DEBUG,bool SR>
+long double KPS::iterative_reverse_randomisation_kernel() {
 
-    if (debug) {
+    PROF_SCOPE(PROF_IRR);
+    if constexpr (DEBUG) {
         cout << "\nkps> iterative reverse randomisation" << endl;
-        cout << "N is: " << N << endl; if (!statereduction) cout << "node alpha: " << alpha->node_id << endl; }
+        cout << "N is: " << N << endl; if constexpr (!SR) cout << "node alpha: " << alpha->node_id << endl; }
     // main loop of the iterative reverse randomisation procedure
     for (int i=N;i>0;i--) {
         Node *curr_node = &(ktn_kps->nodes[nodemap[eliminated_nodes[i-1]]-1]);
-        vector<pair<Node*,Edge*>> nodes_nbrs = undo_gt_iteration(curr_node);
+        vector<pair<Node*,Edge*>> nodes_nbrs = undo_gt_iteration_kernel<DEBUG,SR>(curr_node);
         // reset flags for neighbouring nodes
         for (vector<pair<Node*,Edge*>>::iterator it_nodevec=nodes_nbrs.begin();it_nodevec!=nodes_nbrs.end();++it_nodevec) {
-            ((*it_nodevec).first)->flag=false; }
-        if (statereduction) continue;
+            gt_flag((*it_nodevec).first)=false; }
+        if constexpr (SR) continue;
 //        cout << "  i: " << i << "    undone GT elimination of node: " << curr_node->node_id << endl;
         // vector stores number of kMC hops from i-th node to noneliminated nodes, other elems are irrelevant
         vector<unsigned long long int> fromn_hops(N_B+N_c);
@@ -259,66 +335,66 @@ long double KPS::iterative_reverse_randomisation() {
             if (basin_ids[((*it_nodevec).first)->node_id-1]!=1 || (*it_nodevec).first==curr_node) continue;
             unsigned long long int hx=0; // number of transitions from eliminated node to the i-th node
             Edge *edgeptr=((*it_nodevec).first)->top_from;
-            if (debug) cout << "from node: " << edgeptr->from_node->node_id << endl;
+            if constexpr (DEBUG) cout << "from node: " << edgeptr->from_node->node_id << endl;
             // update the self-loop for this node
 //            cout << "    stage 1" << endl;
             if (!edgeptr->from_node->eliminated) {
-                long double ratio=edgeptr->from_node->t/(edgeptr->from_node->t+edgeptr->from_node->dt);
-                unsigned long long int h_prev = edgeptr->from_node->h;
-//                cout << "      about to draw from B distribn. h: " << edgeptr->from_node->h << "  ratio: " << ratio << endl;
-                edgeptr->from_node->h = KPS::binomial_distribn(edgeptr->from_node->h,ratio,seed);
-                hx += h_prev-edgeptr->from_node->h;
-                fromn_hops[edgeptr->from_node->node_pos] += h_prev-edgeptr->from_node->h;
-                if (debug) cout << " old node h: " << h_prev << "  new node h: " << edgeptr->from_node->h \
+                long double ratio=edgeptr->from_node->t/(edgeptr->from_node->t+dtrans(edgeptr->from_node));
+                unsigned long long int h_prev = hops(edgeptr->from_node);
+//                cout << "      about to draw from B distribn. h: " << hops(edgeptr->from_node) << "  ratio: " << ratio << endl;
+                hops(edgeptr->from_node) = KPS::binomial_distribn(hops(edgeptr->from_node),ratio,seed);
+                hx += h_prev-hops(edgeptr->from_node);
+                fromn_hops[edgeptr->from_node->node_pos] += h_prev-hops(edgeptr->from_node);
+                if constexpr (DEBUG) cout << " old node h: " << h_prev << "  new node h: " << hops(edgeptr->from_node) \
                                 << "  R: " << ratio << endl;
             }
-            edgeptr->from_node->dt=0.L;
+            dtrans(edgeptr->from_node)=0.L;
             // update edges
 //            cout << "    stage 2" << endl;
             while (edgeptr!=nullptr) {
-                if (edgeptr->to_node->eliminated || (edgeptr->deadts && edgeptr->label!=curr_node->node_id) \
+                if (edgeptr->to_node->eliminated || (edgeptr->deadts && gt_label(edgeptr)!=curr_node->node_id) \
                     || edgeptr->to_node==curr_node) {
-                    edgeptr->dt=0.L; edgeptr=edgeptr->next_from; continue;
+                    dtrans(edgeptr)=0.L; edgeptr=edgeptr->next_from; continue;
                 }
                 long double ratio;
-                if (!edgeptr->deadts) { ratio=edgeptr->t/(edgeptr->t+edgeptr->dt);
+                if (!edgeptr->deadts) { ratio=edgeptr->t/(edgeptr->t+dtrans(edgeptr));
                 } else { ratio=0.L; }
-                unsigned long long int h_prev = edgeptr->h;
-//                cout << "      about to draw from B distribn. h: " << edgeptr->from_node->h << "  ratio: " << ratio << endl;                
-                edgeptr->h = KPS::binomial_distribn(edgeptr->h,ratio,seed);
-                hx += h_prev-edgeptr->h;
-                fromn_hops[edgeptr->to_node->node_pos] += h_prev-edgeptr->h;
-                if (debug) cout << "  to node : " << edgeptr->to_node->node_id \
-                                << "  R: " << ratio << "  old h: " << h_prev << "  new h: " << edgeptr->h << endl;
-                edgeptr->dt=0.L; edgeptr=edgeptr->next_from;
+                unsigned long long int h_prev = hops(edgeptr);
+//                cout << "      about to draw from B distribn. h: " << hops(edgeptr->from_node) << "  ratio: " << ratio << endl;                
+                hops(edgeptr) = KPS::binomial_distribn(hops(edgeptr),ratio,seed);
+                hx += h_prev-hops(edgeptr);
+                fromn_hops[edgeptr->to_node->node_pos] += h_prev-hops(edgeptr);
+                if constexpr (DEBUG) cout << "  to node : " << edgeptr->to_node->node_id \
+                                << "  R: " << ratio << "  old h: " << h_prev << "  new h: " << hops(edgeptr) << endl;
+                dtrans(edgeptr)=0.L; edgeptr=edgeptr->next_from;
             }
-            ((*it_nodevec).second)->rev_edge->h = hx; // transitions from eliminated nodes to the i-th node
-            if (debug) cout << "  new h to elimd node: " << hx << endl;
+            hops(((*it_nodevec).second)->rev_edge) = hx; // transitions from eliminated nodes to the i-th node
+            if constexpr (DEBUG) cout << "  new h to elimd node: " << hx << endl;
         }
 //        cout << "    stage 3" << endl;
         // update transitions from the i-th node to noneliminated nodes
         for (vector<pair<Node*,Edge*>>::iterator it_nodevec=nodes_nbrs.begin();it_nodevec!=nodes_nbrs.end();++it_nodevec) {
             if (((*it_nodevec).first)->eliminated || (*it_nodevec).first==curr_node) continue;
-            ((*it_nodevec).second)->h += fromn_hops[((*it_nodevec).first)->node_pos];
-            if (debug) cout << "from elimd node: " << curr_node->node_id << "  to: " << ((*it_nodevec).first)->node_id \
-                            << "  new h: " << ((*it_nodevec).second)->h << endl;
+            hops((*it_nodevec).second) += fromn_hops[((*it_nodevec).first)->node_pos];
+            if constexpr (DEBUG) cout << "from elimd node: " << curr_node->node_id << "  to: " << ((*it_nodevec).first)->node_id \
+                            << "  new h: " << hops((*it_nodevec).second) << endl;
         }
         // sample the number of self-hops for the i-th node
         unsigned long long int nhops=0; // number of kMC hops from the i-th node to alternative nonelimd nodes (ie no self-loops)
         Edge *edgeptr = curr_node->top_from;
         while (edgeptr!=nullptr) {
             if (!(edgeptr->deadts || edgeptr->to_node->eliminated)) {
-                nhops += edgeptr->h; }
+                nhops += hops(edgeptr); }
             edgeptr=edgeptr->next_from;
         }
         long double nb_prob = Network::calc_gt_factor(*curr_node);
 //        cout << "    about to draw from NB distribn. nhops: " << nhops << " nb_prob: " << nb_prob << endl;
-        curr_node->h = KPS::negbinomial_distribn(nhops,nb_prob,seed);
-//        cout << "    curr_node->h is now: " << curr_node->h << endl;
-        if (debug) {
+        hops(curr_node) = KPS::negbinomial_distribn(nhops,nb_prob,seed);
+//        cout << "    hops(curr_node) is now: " << hops(curr_node) << endl;
+        if constexpr (DEBUG) {
             cout << "tot no of hops from node " << curr_node->node_id << " to alt nonelimd nodes: " \
                  << nhops << "  1-t: " << nb_prob << endl;
-            cout << "number of self-hops for node " << curr_node->node_id << ":  " << curr_node->h << endl;
+            cout << "number of self-hops for node " << curr_node->node_id << ":  " << hops(curr_node) << endl;
             cout << "network after restoring node " << curr_node->node_id << endl; test_ktn(*ktn_kps);
         }
     }
@@ -326,16 +402,16 @@ long double KPS::iterative_reverse_randomisation() {
     long double t_traj=0.L; // sampled time for basin escape trajectory
     for (const auto &node: ktn_kps->nodes) {
         unsigned long long int nhops=0;
-        nhops += node.h;
+        nhops += hops(&node);
         const Edge *edgeptr = node.top_from;
         while (edgeptr!=nullptr) {
-            if (!edgeptr->deadts) nhops += edgeptr->h;
+            if (!edgeptr->deadts) nhops += hops(edgeptr);
             edgeptr = edgeptr->next_from;
         }
         if (discretetime) { t_traj += static_cast<long double>(nhops)*node.t_esc;
         } else { t_traj += KPS::gamma_distribn(nhops,node.t_esc,seed); }
     }
-    if (debug) {
+    if constexpr (DEBUG) {
         cout << "network after iterative reverse randomisation:" << endl; test_ktn(*ktn_kps);
         cout << "kps> finished iterative reverse randomisation" << endl; }
     return t_traj;
@@ -343,9 +419,11 @@ long double KPS::iterative_reverse_randomisation() {
 
 /* Sample a node at the absorbing boundary of the current trapping basin, by the
    categorical sampling procedure based on T^(0) and T^(N) */
-Node *KPS::sample_absorbing_node() {
+template<bool DEBUG>
+Node *KPS::sample_absorbing_node_kernel() {
 
-    if (debug) cout << "\nkps> sample absorbing node, epsilon: " << epsilon->node_id << endl;
+    PROF_SCOPE(PROF_SAMPLE_ABSORBING);
+    if constexpr (DEBUG) cout << "\nkps> sample absorbing node, epsilon: " << epsilon->node_id << endl;
     int curr_comm_id = epsilon->comm_id;
     Node *next_node, *curr_node, *dummy_node;
     /* NB epsilon points to a node in the original network. At the start of each iteration of the following loop,
@@ -353,13 +431,13 @@ Node *KPS::sample_absorbing_node() {
        it is a noneliminated node */
     curr_node = &ktn_kps->nodes[nodemap[epsilon->node_id]-1];
     do {
-        if (debug) cout << "curr_node is: " << curr_node->node_id << endl;
+        if constexpr (DEBUG) cout << "curr_node is: " << curr_node->node_id << endl;
         double rand_no = Wrapper_Method::rand_unif_met(seed);
         long double cum_t = 0.L; // accumulated transition probability
         bool nonelimd = false; // flag indicates if the current node is transient noneliminated
         long double factor = 0.L;
         if (!curr_node->eliminated) {
-            if (debug) cout << "  node has not been eliminated" << endl;
+            if constexpr (DEBUG) cout << "  node has not been eliminated" << endl;
             dummy_node = &(*curr_node);
             curr_node = &ktn_kps_orig->nodes[curr_node->node_id-1]; // now points to a node in the untransformed subnetwork
             nonelimd = true;
@@ -372,7 +450,7 @@ Node *KPS::sample_absorbing_node() {
                 edgeptr=edgeptr->next_from; continue; }
             cum_t += edgeptr->t;
             if (nonelimd) cum_t += (edgeptr->t)*(curr_node->t)/factor;
-            if (debug) cout << "    to node: " << edgeptr->to_node->node_id << "  edgeptr->t: " << edgeptr->t \
+            if constexpr (DEBUG) cout << "    to node: " << edgeptr->to_node->node_id << "  edgeptr->t: " << edgeptr->t \
                  << "  extra contribn: " << (edgeptr->t)*(curr_node->t)/factor << "  cum_t: " << cum_t << endl;
             if (cum_t>rand_no) { next_node = edgeptr->to_node; break; }
             edgeptr=edgeptr->next_from;
@@ -381,16 +459,16 @@ Node *KPS::sample_absorbing_node() {
             cout << "kps> GT error detected in sample_absorbing_node()" << endl; exit(EXIT_FAILURE); }
         // increment the number of kMC hops and set the new node
         if (nonelimd) {
-            dummy_node->h++;
+            hops(dummy_node)++;
             curr_node = &ktn_kps->nodes[nodemap[next_node->node_id]-1];
         } else {
-            edgeptr->h++;
+            hops(edgeptr)++;
             curr_node=next_node;
         }
         next_node=nullptr;
-        if (adaptivecomms && basin_ids[curr_node->node_id-1]==3) break; // reached absorbing boundary of on-the-fly community
+        if (bfsbasin && basin_ids[curr_node->node_id-1]==3) break; // reached absorbing boundary of on-the-fly community
     } while (curr_node->comm_id==curr_comm_id);
-    if (debug) cout << "after categorical sampling procedure the current node is: " << curr_node->node_id << endl;
+    if constexpr (DEBUG) cout << "after categorical sampling procedure the current node is: " << curr_node->node_id << endl;
     return curr_node;
 }
 
@@ -400,17 +478,23 @@ Node *KPS::sample_absorbing_node() {
    The graph transformation is achieved by performing a LU-decomposition of T^(0) */
 void KPS::graph_transformation(const Network &ktn) {
 
+    PROF_SCOPE(PROF_GT);
     if (debug) cout << "\nkps> graph transformation" << endl;
     ktn_kps=get_subnetwork(ktn,true);
     ktn_kps->ncomms=ktn.ncomms;
+    ktn_kps->alloc_kps_fields();
+    ktn_kps->account_mem(Mem_Accounting::KTN_KPS);
     /* the original, L and U network are not needed for certain state reduction computations, which only require a forward pass phase of GT */
     if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
     ktn_kps_orig=get_subnetwork(ktn,false);
+    ktn_kps_orig->account_mem(Mem_Accounting::KTN_KPS_ORIG);
     ktn_l = new Network(N_B+N_c,0);
     ktn_u = new Network(N_B+N_c,0);
-    vector<int> noderange(N_B); iota(noderange.begin(),noderange.end(),N_c);
-    ktn_l->edges.resize((N_B*(N_B+N_c))-N_B);
-    ktn_u->edges.resize(accumulate(noderange.begin(),noderange.end(),0));
+    // the i-th eliminated node has at most N_B+N_c-1 neighbours, of which at most N_B+N_c-1-i are not yet eliminated
+    long long int n_elim=min(N_B,nelim);
+    ktn_l->edges.resize(n_elim*(N_B+N_c-1));
+    ktn_u->edges.resize((n_elim*(2*(N_B+N_c)-1-n_elim))/2);
+    ktn_l->account_mem(Mem_Accounting::KTN_L); ktn_u->account_mem(Mem_Accounting::KTN_U);
     for (int i=0;i<ktn_kps->n_nodes;i++) {
         ktn_l->nodes[i] = ktn_kps->nodes[i];
         ktn_u->nodes[i] = ktn_kps->nodes[i];
@@ -428,9 +512,9 @@ void KPS::graph_transformation(const Network &ktn) {
     };
     priority_queue<Node*,vector<Node*>,decltype(cmp)> gt_pq(cmp); // priority queue of nodes (based on out-degree)
     for (vector<Node>::iterator it_nodevec=ktn_kps->nodes.begin();it_nodevec!=ktn_kps->nodes.end();++it_nodevec) {
-        if (sr_args.fundamentalred && !it_nodevec->flag) continue; // only eliminate dummy nodes when computing the absorbing fundamental matrix
-        if ((!adaptivecomms && it_nodevec->comm_id!=epsilon->comm_id) || \
-            (adaptivecomms && basin_ids[it_nodevec->node_id-1]!=2)) continue;
+        if (sr_args.fundamentalred && !gt_flag(&*it_nodevec)) continue; // only eliminate dummy nodes when computing the absorbing fundamental matrix
+        if ((!bfsbasin && it_nodevec->comm_id!=epsilon->comm_id) || \
+            (bfsbasin && basin_ids[it_nodevec->node_id-1]!=2)) continue;
         gt_pq.push(&(*it_nodevec));
     }
     bool done_committor=false;
@@ -441,7 +525,7 @@ void KPS::graph_transformation(const Network &ktn) {
         if (sr_args.committor && !done_committor && node_elim->aorb==1) { // only nodes not in A and B remain at this point; compute committor probabilities
             calc_committor(ktn); done_committor=true;
         }
-        gt_iteration(node_elim);
+        (this->*gt_iteration)(node_elim);
         basin_ids[node_elim->node_id-1]=1; // flag eliminated node
         eliminated_nodes.push_back(node_elim->node_id);
         N++;
@@ -457,7 +541,6 @@ void KPS::graph_transformation(const Network &ktn) {
             }
         }
     }
-    if (!adaptivecomms && ktn.ncomms==2 && ktn_kps_gt==nullptr) ktn_kps_gt = new Network(*ktn_kps);
     if (N!=(!(N_B>nelim)?N_B:nelim)) {
         cout << "kps> fatal error: lost track of number of eliminated nodes" << endl; exit(EXIT_FAILURE); }
     if (debug) cout << "kps> finished graph transformation" << endl;
@@ -466,33 +549,87 @@ void KPS::graph_transformation(const Network &ktn) {
     if (sr_args.fundamentalred) calc_fundamentalred(ktn); // the remaining edges are the elements of the fundamental matrix for a reducible Markov chain
 }
 
+/* set up the current basin as the community of the current node from the cache, performing the GT of the community and storing it in
+   the cache if this is the first walker to be trapped in the community. Only walkers trapped in the same community wait for the GT, and
+   a cached GT is read without locking. If the GT of the community could not be cached, it is performed for the current escape only */
+void KPS::get_gt_basin(const Network &ktn, Walker &walker) {
+
+    KPS_GT_Slot &slot = (*gt_basins)[epsilon->comm_id];
+    bool done_gt=false;
+    call_once(slot.once,[&]() {
+        setup_basin_sets(ktn,walker,true);
+        graph_transformation(ktn);
+        slot.basin.reset(cache_gt_basin());
+        done_gt=true;
+    });
+    if (!slot.basin) {
+        if (!done_gt) { setup_basin_sets(ktn,walker,true); graph_transformation(ktn); }
+        return;
+    }
+    gt_cached=true;
+    if (done_gt) return; // the subnetworks of the current basin are those stored in the cache
+    const KPS_GT_Basin &basin = *slot.basin;
+    for (idx_t pos: basin_nodes) basin_ids[pos]=0;
+    basin_nodes=basin.basin_nodes;
+    for (size_t i=0;i<basin_nodes.size();i++) basin_ids[basin_nodes[i]]=basin.basin_flags[i];
+    eliminated_nodes=basin.eliminated_nodes; nodemap=basin.nodemap;
+    N=basin.N; N_B=basin.N_B; N_c=basin.N_c; N_e=basin.N_e;
+    bfsbasin=false;
+    ktn_kps = new Network(*basin.ktn_kps_gt);
+    ktn_kps->account_mem(Mem_Accounting::KTN_KPS);
+    ktn_kps_orig=basin.ktn_kps_orig.get(); ktn_l=basin.ktn_l.get(); ktn_u=basin.ktn_u.get();
+}
+
+/* return a cache entry for the GT of the current basin, which has just been performed, taking ownership of the original, L and U
+   subnetworks. The GT can be cached only if the basin is the whole community and the copy of the transformed subnetwork fits within
+   the memory budget, otherwise nullptr is returned */
+KPS_GT_Basin *KPS::cache_gt_basin() {
+
+    long long int gt_bytes = ktn_kps->n_nodes*(sizeof(Node)+KPS_Fields::node_bytes)+ \
+                             ktn_kps->n_edges*(sizeof(Edge)+KPS_Fields::edge_bytes); // the copy holds only the used entries
+    if (bfsbasin || gt_bytes>Mem_Accounting::available()) return nullptr;
+    KPS_GT_Basin *basin = new KPS_GT_Basin();
+    basin->ktn_kps_gt.reset(new Network(*ktn_kps));
+    basin->ktn_kps_gt->account_mem(Mem_Accounting::KTN_KPS_GT);
+    basin->ktn_kps_orig.reset(ktn_kps_orig); basin->ktn_l.reset(ktn_l); basin->ktn_u.reset(ktn_u);
+    basin->basin_nodes=basin_nodes;
+    for (idx_t pos: basin_nodes) basin->basin_flags.push_back(basin_ids[pos]);
+    basin->eliminated_nodes=eliminated_nodes; basin->nodemap=nodemap;
+    basin->N=N; basin->N_B=N_B; basin->N_c=N_c; basin->N_e=N_e;
+    if (debug) cout << "kps> cached GT of community " << epsilon->comm_id << " of " << N_B << " nodes" << endl;
+    return basin;
+}
+
 /* return the subnetwork corresponding to the active trapping basin and absorbing boundary nodes, to be transformed
    in the graph transformation phase of the kPS algorithm */
 Network *KPS::get_subnetwork(const Network& ktn, bool resize_edgevec) {
 
+    PROF_SCOPE(PROF_SUBNETWORK);
     if (debug) cout << "\nkps> get_subnetwork: create TN of " << N_B+N_c << " nodes and " << N_e << " edges" << endl;
     Network *ktnptr = new Network(N_B+N_c,N_e);
     if (resize_edgevec) ktnptr->edges.resize((N_B*(N_B-1))+(2*N_B*N_c));
     ktnptr->branchprobs=ktn.branchprobs;
     int j=0;
-    for (int i=0;i<ktn.n_nodes;i++) {
-        if (!basin_ids[i]) continue;
+    for (idx_t i: basin_nodes) {
         nodemap[i+1]=j+1;
         ktnptr->nodes[j] = ktn.nodes[i];
         ktnptr->nodes[j].node_pos=j; j++;
     }
     int m=0, n=0;
-    vector<bool> edgemask(2*ktn.n_edges,false);
     // note that the indices of the edge vector in the subnetwork are not in a meaningful order
     for (auto &node: ktnptr->nodes) {
         n++;
         const Node *node_orig = &ktn.nodes[node.node_id-1];
         // for absorbing node, do not incl any FROM edges, or any TO edges for non-basin nbr nodes, in the subnetwork
-        if ((!adaptivecomms && node_orig->comm_id!=epsilon->comm_id) || \
-            (adaptivecomms && basin_ids[node_orig->node_id-1]!=2)) continue;
+        if ((!bfsbasin && node_orig->comm_id!=epsilon->comm_id) || \
+            (bfsbasin && basin_ids[node_orig->node_id-1]!=2)) continue;
         const Edge *edgeptr = node_orig->top_from;
         while (edgeptr!=nullptr) {
-            if (edgeptr->deadts || edgemask[edgeptr->edge_id]) { edgeptr=edgeptr->next_from; continue; }
+            /* the edge pair was already added when visiting the neighbouring basin node, if this node precedes the current node
+               and the reverse edge (from this node) is not removed */
+            const Node *nbr_orig = edgeptr->to_node;
+            if (edgeptr->deadts || (basin_ids[nbr_orig->node_id-1]==2 && nbr_orig->node_id<node_orig->node_id && \
+                !edgeptr->rev_edge->deadts)) { edgeptr=edgeptr->next_from; continue; }
             ktnptr->edges[m] = *edgeptr; // edge of subnetwork inherits properties (transn rate etc) of node in full network
             ktnptr->edges[m].edge_id = m;
             ktnptr->edges[m].from_node = &ktnptr->nodes[nodemap[edgeptr->from_node->node_id]-1];
@@ -501,9 +638,9 @@ Network *KPS::get_subnetwork(const Network& ktn, bool resize_edgevec) {
             ktnptr->add_to_edge(nodemap[edgeptr->to_node->node_id]-1,m);
 //            Network::add_edge_network(ktnptr,ktnptr->nodes[nodemap[edgeptr->from_node->node_id]]-1, \
                 ktnptr->nodes[nodemap[edgeptr->to_node->node_id]-1],m);
-            m++; edgemask[edgeptr->edge_id]=true;
+            m++;
             const Edge *edgeptr_rev = edgeptr->rev_edge;
-            if (edgeptr_rev->deadts || edgemask[edgeptr_rev->edge_id]) {
+            if (edgeptr_rev->deadts) {
                 edgeptr=edgeptr->next_from; continue; }
             // reverse edge
             ktnptr->edges[m] = *edgeptr_rev;
@@ -516,7 +653,7 @@ Network *KPS::get_subnetwork(const Network& ktn, bool resize_edgevec) {
                 ktnptr->nodes[nodemap[edgeptr_rev->to_node->node_id]-1],m);
             ktnptr->edges[m-1].rev_edge = &ktnptr->edges[m];
             ktnptr->edges[m].rev_edge = &ktnptr->edges[m-1];
-            m++; edgemask[edgeptr_rev->edge_id]=true;
+            m++; edgeptr=edgeptr->next_from;
         }
     }
     if (debug) cout << "added " << n << " nodes and " << m << " edges to subnetwork" << endl;
@@ -528,10 +665,11 @@ Network *KPS::get_subnetwork(const Network& ktn, bool resize_edgevec) {
 /* a single iteration of the graph transformation method. Argument is a pointer to the node to be
    eliminated from the network to which the ktn_kps pointer refers.
    The networks "L" and "U" required to undo the graph transformation iterations are updated */
-void KPS::gt_iteration(Node *node_elim) {
+template<bool DEBUG,bool SR>
+void KPS::gt_iteration_kernel(Node *node_elim) {
 
     long double factor = Network::calc_gt_factor(*node_elim); // equal to (1-T_{nn})
-    if (debug) cout << "kps> eliminating node: " << node_elim->node_id << endl;
+    if constexpr (DEBUG) cout << "kps> eliminating node: " << node_elim->node_id << endl;
     // objects to queue all nbrs of the current elimd node, incl all elimd nbrs, and update relevant edges
     vector<Node*> nodes_nbrs;
     typedef struct {
@@ -541,22 +679,24 @@ void KPS::gt_iteration(Node *node_elim) {
     } nbrnode;
     // vector of which relevant entries are for all nodes directly connected to the current elimd node, incl elimd nodes
     vector<nbrnode> nbrnode_vec(N_B+N_c,(nbrnode){false,0.L,0.L});
+    // the L and U networks are always required in simulations, but only for some state reduction computations
+    const bool lu_nets = !SR || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth;
     // update the self-loops of the L and U networks
-    if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
+    if (lu_nets) {
     ktn_u->nodes[node_elim->node_pos].t = -factor;
     ktn_l->nodes[node_elim->node_pos].t = node_elim->t/factor;
     }
     // update the weights for all edges from the elimd node to non-elimd nbr nodes, and self-loops of non-elimd nbr nodes
     Edge *edgeptr = node_elim->top_from;
-    if (debug) cout << "updating edges from the eliminated node..." << endl;
+    if constexpr (DEBUG) cout << "updating edges from the eliminated node..." << endl;
     while (edgeptr!=nullptr) {
         if (edgeptr->deadts) { edgeptr=edgeptr->next_from; continue; }
-        if (debug) cout << "  to node: " << edgeptr->to_node->node_id << endl;
-        edgeptr->to_node->flag=true;
+        if constexpr (DEBUG) cout << "  to node: " << edgeptr->to_node->node_id << endl;
+        gt_flag(edgeptr->to_node)=true;
         nodes_nbrs.push_back(edgeptr->to_node); // queue nbr node
         nbrnode_vec[edgeptr->to_node->node_pos].t_fromn=edgeptr->t;
         nbrnode_vec[edgeptr->to_node->node_pos].t_ton=edgeptr->rev_edge->t;
-        if (!statereduction || sr_args.fundamentalirred || sr_args.mfpt || sr_args.gth) {
+        if (lu_nets) {
         // update L and U networks
         ktn_l->edges[ktn_l->n_edges].t = edgeptr->rev_edge->t/factor;
         ktn_l->edges[ktn_l->n_edges].edge_id = ktn_l->n_edges;
@@ -574,58 +714,58 @@ void KPS::gt_iteration(Node *node_elim) {
         ktn_u->n_edges++;
         }
         // renormalise mean waiting time for the neighbouring node (when noneliminated) if the computation is to compute exact MFPTs
-        if (sr_args.mfpt && !edgeptr->to_node->eliminated && edgeptr->to_node->aorb!=-1) {
+        if (SR && sr_args.mfpt && !edgeptr->to_node->eliminated && edgeptr->to_node->aorb!=-1) {
             edgeptr->to_node->t_esc += (edgeptr->rev_edge->t)*(node_elim->t_esc)/factor; }
         // update subnetwork
-        if (debug) cout << "    old node t: " << edgeptr->to_node->t << "  incr in node t: " \
+        if constexpr (DEBUG) cout << "    old node t: " << edgeptr->to_node->t << "  incr in node t: " \
                         << (edgeptr->t)*(edgeptr->rev_edge->t)/factor << endl;
         edgeptr->to_node->t += (edgeptr->t)*(edgeptr->rev_edge->t)/factor; // update self-loop of non-elimd nbr node
-        if (debug) cout << "    old edge t: " << edgeptr->t << "  incr in t: " << (edgeptr->t)*(node_elim->t)/factor << endl;
+        if constexpr (DEBUG) cout << "    old edge t: " << edgeptr->t << "  incr in t: " << (edgeptr->t)*(node_elim->t)/factor << endl;
         edgeptr->t += (edgeptr->t)*(node_elim->t)/factor; // update edge from elimd node to non-elimd nbr node
         edgeptr=edgeptr->next_from;
     }
-    if (debug) cout << "updating edges between pairs of nodes both directly connected to the eliminated node..." << endl;
+    if constexpr (DEBUG) cout << "updating edges between pairs of nodes both directly connected to the eliminated node..." << endl;
     // update the weights for all pairs of nodes directly connected to the eliminated node
-    int old_n_edges = ktn_kps->n_edges; // number of edges in the network before we start adding edges in the GT algo
+    idx_t old_n_edges = ktn_kps->n_edges; // number of edges in the network before we start adding edges in the GT algo
     for (vector<Node*>::iterator it_nodevec=nodes_nbrs.begin();it_nodevec!=nodes_nbrs.end();++it_nodevec) {
-        if (debug) cout << "checking node: " << (*it_nodevec)->node_id << endl;
+        if constexpr (DEBUG) cout << "checking node: " << (*it_nodevec)->node_id << endl;
         bool node1_abs = (basin_ids[(*it_nodevec)->node_id-1]==3);
         edgeptr = (*it_nodevec)->top_from; // loop over edges to neighbouring nodes
         while (edgeptr!=nullptr) { // find pairs of nodes that are already directly connected to one another
             // skip nodes not directly connected to elimd node and edges to elimd nodes
-            if (edgeptr->deadts || edgeptr->to_node->eliminated || !edgeptr->to_node->flag || \
+            if (edgeptr->deadts || edgeptr->to_node->eliminated || !gt_flag(edgeptr->to_node) || \
                 (node1_abs && basin_ids[edgeptr->to_node->node_id-1]==3)) {
                 edgeptr=edgeptr->next_from; continue; }
-            if (debug) cout << "  node " << (*it_nodevec)->node_id << " is directly connected to node " \
+            if constexpr (DEBUG) cout << "  node " << (*it_nodevec)->node_id << " is directly connected to node " \
                             << edgeptr->to_node->node_id << endl;
             nbrnode_vec[edgeptr->to_node->node_pos].dirconn=true; // this pair of nodes are directly connected
             if (edgeptr->edge_id>old_n_edges) { // skip nodes for which a new edge has already been added
-                if (debug) cout << "    edge already added" << endl;
+                if constexpr (DEBUG) cout << "    edge already added" << endl;
                 edgeptr=edgeptr->next_from; continue; }
-            if (debug) cout << "    old edge t: " << edgeptr->t << "  incr in t: " \
+            if constexpr (DEBUG) cout << "    old edge t: " << edgeptr->t << "  incr in t: " \
                             << (nbrnode_vec[edgeptr->from_node->node_pos].t_ton)*\
                                (nbrnode_vec[edgeptr->to_node->node_pos].t_fromn)/factor << endl;
             edgeptr->t += (nbrnode_vec[edgeptr->from_node->node_pos].t_ton)*\
                 (nbrnode_vec[edgeptr->to_node->node_pos].t_fromn)/factor;
             edgeptr=edgeptr->next_from;
         }
-        if (debug) cout << "  checking for nbrs of elimd node that are not already connected to this node" << endl;
+        if constexpr (DEBUG) cout << "  checking for nbrs of elimd node that are not already connected to this node" << endl;
         for (vector<Node*>::iterator it_nodevec2=nodes_nbrs.begin();it_nodevec2!=nodes_nbrs.end();++it_nodevec2) {
             /* skip self-loops of neighbour nodes (already accounted for), proposed edges TO eliminated nodes (accounted
                for when the reverse direction is found), and proposed edges connecting pairs of absorbing nodes (irrelevant) */
-            if (debug) cout << "    checking nbr node: "<< (*it_nodevec2)->node_id << endl;
+            if constexpr (DEBUG) cout << "    checking nbr node: "<< (*it_nodevec2)->node_id << endl;
             if ((*it_nodevec2)==(*it_nodevec) || (*it_nodevec2)->eliminated || \
                 (node1_abs && basin_ids[(*it_nodevec2)->node_id-1]==3)) continue;
             int node1_pos=(*it_nodevec)->node_pos, node2_pos=(*it_nodevec2)->node_pos;
             if (nbrnode_vec[node2_pos].dirconn) { nbrnode_vec[node2_pos].dirconn=false; continue; } // reset flag
-            if (debug) {
+            if constexpr (DEBUG) {
                 cout << "    node " << (*it_nodevec)->node_id << " is not directly connected to node " \
                      << (*it_nodevec2)->node_id << "\n    t of new edge: " \
                      << nbrnode_vec[node2_pos].t_fromn*nbrnode_vec[node1_pos].t_ton/factor << endl; }
             // nodes are directly connected to the elimd node but not to one another, add an edge in the transformed network
             ktn_kps->edges[ktn_kps->n_edges].t = nbrnode_vec[node2_pos].t_fromn*nbrnode_vec[node1_pos].t_ton/factor;
             ktn_kps->edges[ktn_kps->n_edges].edge_id = ktn_kps->n_edges;
-            ktn_kps->edges[ktn_kps->n_edges].label = node_elim->node_id;
+            gt_label(&ktn_kps->edges[ktn_kps->n_edges]) = node_elim->node_id;
             ktn_kps->edges[ktn_kps->n_edges].from_node = &ktn_kps->nodes[node1_pos];
             ktn_kps->edges[ktn_kps->n_edges].to_node = &ktn_kps->nodes[node2_pos];
             ktn_kps->add_from_edge(node1_pos,ktn_kps->n_edges);
@@ -635,12 +775,12 @@ void KPS::gt_iteration(Node *node_elim) {
             if ((*it_nodevec)->eliminated) {
                 ktn_kps->edges[ktn_kps->n_edges].t = 0.L; // dummy value
             } else {
-                if (debug) cout << "    t of new reverse edge: " \
+                if constexpr (DEBUG) cout << "    t of new reverse edge: " \
                                 << nbrnode_vec[node2_pos].t_ton*nbrnode_vec[node1_pos].t_fromn/factor << endl;
                 ktn_kps->edges[ktn_kps->n_edges].t = nbrnode_vec[node2_pos].t_ton*nbrnode_vec[node1_pos].t_fromn/factor;
             }
             ktn_kps->edges[ktn_kps->n_edges].edge_id = ktn_kps->n_edges;
-            ktn_kps->edges[ktn_kps->n_edges].label = node_elim->node_id;
+            gt_label(&ktn_kps->edges[ktn_kps->n_edges]) = node_elim->node_id;
             ktn_kps->edges[ktn_kps->n_edges].from_node = &ktn_kps->nodes[node2_pos];
             ktn_kps->edges[ktn_kps->n_edges].to_node = &ktn_kps->nodes[node1_pos];
             ktn_kps->add_from_edge(node2_pos,ktn_kps->n_edges);
@@ -651,10 +791,11 @@ void KPS::gt_iteration(Node *node_elim) {
             ktn_kps->n_edges++;
         }
     }
+    PROF_COUNT(PROF_FILLIN_EDGES,(ktn_kps->n_edges-old_n_edges)/2);
     // reset the flags
     edgeptr = node_elim->top_from;
     while (edgeptr!=nullptr) {
-        if (!edgeptr->deadts) edgeptr->to_node->flag=false;
+        if (!edgeptr->deadts) gt_flag(edgeptr->to_node)=false;
         edgeptr = edgeptr->next_from;
     }
     node_elim->eliminated=true; // this flag negates the need to zero the weights to the eliminated node
@@ -663,9 +804,10 @@ void KPS::gt_iteration(Node *node_elim) {
 /* undo a single iteration of the graph transformation.
    Argument is a pointer to the node to be un-eliminated from the network, and which exists in the Network object
    pointed to by ktn_kps */
-vector<pair<Node*,Edge*>> KPS::undo_gt_iteration(Node *node_elim) {
+template<bool DEBUG,bool SR>
+vector<pair<Node*,Edge*>> KPS::undo_gt_iteration_kernel(Node *node_elim) {
 
-    if (debug) cout << "\nkps> undoing elimination of node " << node_elim->node_id << endl;
+    if constexpr (DEBUG) cout << "\nkps> undoing elimination of node " << node_elim->node_id << endl;
     if (!node_elim->eliminated) throw exception(); // node is already noneliminated
     node_elim->eliminated=false;
     // set the self-loop for the restored node
@@ -676,77 +818,77 @@ vector<pair<Node*,Edge*>> KPS::undo_gt_iteration(Node *node_elim) {
     while (edgeptr!=nullptr) {
         if (!edgeptr->deadts) {
             nodes_nbrs.push_back(make_pair(edgeptr->to_node,edgeptr));
-            edgeptr->to_node->flag=true;
+            gt_flag(edgeptr->to_node)=true;
         }
         edgeptr=edgeptr->next_from;
     }
-    if (debug) {
+    if constexpr (DEBUG) {
         cout << "list of neighbouring nodes:" << endl;
         for (auto &neptr: nodes_nbrs) cout << "  " << (neptr.first)->node_id;
         cout << endl; }
     // update the remaining edges for pairs of nodes connected to the restored node 
     edgeptr = ktn_l->nodes[node_elim->node_pos].top_to;
-    if (debug) cout << "doing edges FROM neighbouring nodes" << endl;
+    if constexpr (DEBUG) cout << "doing edges FROM neighbouring nodes" << endl;
     while (edgeptr!=nullptr) {
         Edge *edgeptr2 = ktn_kps->nodes[edgeptr->from_node->node_pos].top_from;
         if (!edgeptr2->from_node->eliminated) { // quack but what if edge is dead?
-            if (debug) cout << " neighbour node " << edgeptr2->from_node->node_id \
+            if constexpr (DEBUG) cout << " neighbour node " << edgeptr2->from_node->node_id \
                             << " is noneliminated, relevant L elem: " << edgeptr->t << endl;
-            edgeptr2->from_node->dt = edgeptr->t;
-            if (debug) cout << " new t of node is: " << edgeptr2->from_node->dt << endl;
+            dtrans(edgeptr2->from_node) = edgeptr->t;
+            if constexpr (DEBUG) cout << " new t of node is: " << dtrans(edgeptr2->from_node) << endl;
         }
         while (edgeptr2!=nullptr) {
-            if (debug) cout << "  edge from: " << edgeptr2->from_node->node_id \
+            if constexpr (DEBUG) cout << "  edge from: " << edgeptr2->from_node->node_id \
                             << "  to: " << edgeptr2->to_node->node_id << endl;
-            if (edgeptr2->label==node_elim->node_id) edgeptr2->deadts=true;
+            if (gt_label(edgeptr2)==node_elim->node_id) edgeptr2->deadts=true;
             if (edgeptr2->deadts) { edgeptr2=edgeptr2->next_from; continue; }
-            if (edgeptr2->to_node->flag) {
-                if (debug) cout << "    to node is flagged, relevant L elem: " << edgeptr->t << endl;
-                edgeptr2->dt = edgeptr->t;
+            if (gt_flag(edgeptr2->to_node)) {
+                if constexpr (DEBUG) cout << "    to node is flagged, relevant L elem: " << edgeptr->t << endl;
+                dtrans(edgeptr2) = edgeptr->t;
 //            } else if (edgeptr2->to_node==node_elim) {
 //                cout << "    to node is eliminated node, relevant U elem: " \
                        << ktn_u->nodes[node_elim->node_pos].t << endl;
-//                edgeptr2->dt = ktn_u->nodes[node_elim->node_pos].t;
+//                dtrans(edgeptr2) = ktn_u->nodes[node_elim->node_pos].t;
             }
             edgeptr2 = edgeptr2->next_from;            
         }
         edgeptr=edgeptr->next_to;
     }
     edgeptr = ktn_u->nodes[node_elim->node_pos].top_from;
-    if (debug) cout << "doing edges TO neighbouring nodes" << endl;
+    if constexpr (DEBUG) cout << "doing edges TO neighbouring nodes" << endl;
     while (edgeptr!=nullptr) {
         Edge *edgeptr2 = ktn_kps->nodes[edgeptr->to_node->node_pos].top_to;
         if (!edgeptr2->to_node->eliminated) { // quack but what if edge is dead?
-            if (debug) cout << " neighbour node: " << edgeptr2->to_node->node_id \
+            if constexpr (DEBUG) cout << " neighbour node: " << edgeptr2->to_node->node_id \
                             << " is noneliminated, relevant U elem: " << edgeptr->t << endl;
-            edgeptr2->to_node->dt *= edgeptr->t;
-            edgeptr2->to_node->t -= edgeptr2->to_node->dt;
-            if (debug) cout << " new t of node is: " << edgeptr2->to_node->t << endl;
+            dtrans(edgeptr2->to_node) *= edgeptr->t;
+            edgeptr2->to_node->t -= dtrans(edgeptr2->to_node);
+            if constexpr (DEBUG) cout << " new t of node is: " << edgeptr2->to_node->t << endl;
         }
         while (edgeptr2!=nullptr) {
-            if (debug) cout << "  edge from: " << edgeptr2->from_node->node_id \
+            if constexpr (DEBUG) cout << "  edge from: " << edgeptr2->from_node->node_id \
                             << "  to: " << edgeptr2->to_node->node_id << endl;
-            if (edgeptr2->label==node_elim->node_id) edgeptr2->deadts=true;
+            if (gt_label(edgeptr2)==node_elim->node_id) edgeptr2->deadts=true;
             if (edgeptr2->deadts) {edgeptr2=edgeptr2->next_to; continue; }
-            if (edgeptr2->from_node->flag) {
-                if (debug) cout << "    from node is flagged, relevant U elem: " << edgeptr->t << endl;
-                edgeptr2->dt *= edgeptr->t;
-                edgeptr2->t -= edgeptr2->dt;
-                if (debug) cout << "      new t of edge is: " << edgeptr2->t << endl;
+            if (gt_flag(edgeptr2->from_node)) {
+                if constexpr (DEBUG) cout << "    from node is flagged, relevant U elem: " << edgeptr->t << endl;
+                dtrans(edgeptr2) *= edgeptr->t;
+                edgeptr2->t -= dtrans(edgeptr2);
+                if constexpr (DEBUG) cout << "      new t of edge is: " << edgeptr2->t << endl;
             } else if (edgeptr2->from_node==node_elim) {
-                if (debug) cout << "    from node is eliminated node, relevant L elem: " \
+                if constexpr (DEBUG) cout << "    from node is eliminated node, relevant L elem: " \
                                 << ktn_l->nodes[node_elim->node_pos].t \
                                 << "  relevant U elem: " << edgeptr->t << endl;
-//                edgeptr2->dt *= ktn_l->nodes[node_elim->node_pos]].t;
-//                edgeptr2->t -= edgeptr2->dt;
+//                dtrans(edgeptr2) *= ktn_l->nodes[node_elim->node_pos]].t;
+//                edgeptr2->t -= dtrans(edgeptr2);
                 edgeptr2->t -= (ktn_l->nodes[node_elim->node_pos].t)*edgeptr->t;
-                if (debug) cout << "      new t of edge is: " << edgeptr2->t << endl;
+                if constexpr (DEBUG) cout << "      new t of edge is: " << edgeptr2->t << endl;
             }
             edgeptr2 = edgeptr2->next_to;
         }
         edgeptr=edgeptr->next_from;
     }
-    if (sr_args.mfpt) {
+    if (SR && sr_args.mfpt) {
         mfpt_vals[node_elim->node_pos] = node_elim->t_esc;
         Edge *edgeptr = node_elim->top_from;
         while (edgeptr!=nullptr) {
@@ -757,7 +899,7 @@ vector<pair<Node*,Edge*>> KPS::undo_gt_iteration(Node *node_elim) {
         long double factor = Network::calc_gt_factor(*node_elim);
         mfpt_vals[node_elim->node_pos] *= 1.L/factor;
     }
-    if (sr_args.gth) {
+    if (SR && sr_args.gth) {
         cout << "\nrestored node: " << node_elim->node_id << endl;
         cout << "  self-loop: " << node_elim->t << endl;
         long double new_pi=0.L;
@@ -784,28 +926,29 @@ vector<pair<Node*,Edge*>> KPS::undo_gt_iteration(Node *node_elim) {
    should only be set for use with pure BKL simulations) */
 void KPS::update_path_quantities(Walker &walker, long double t_traj, const Node *curr_node) {
 
+    PROF_SCOPE(PROF_UPDATE_PATH);
     if (debug) cout << "kps> updating path quantities" << endl;
     if (ktn_kps==nullptr) throw exception();
     walker.prev_node = walker.curr_node;
     walker.curr_node = &(*curr_node);
     walker.t += t_traj;
     for (const auto &node: ktn_kps->nodes) {
-        if (!ktn_kps->branchprobs && node.h>0) {
-            walker.k += node.h;
-            walker.p += -1.L*static_cast<long double>(node.h)*log(node.t);
+        if (!ktn_kps->branchprobs && hops(&node)>0) {
+            walker.k += hops(&node);
+            walker.p += -1.L*static_cast<long double>(hops(&node))*log(node.t);
             // no need to update entropy flow along paths because contribution from self-loop transitions is zero
             if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visited[node.bin_id]=true;
         }
         Edge *edgeptr = node.top_from;
         while (edgeptr!=nullptr) {
-            if (edgeptr->deadts || edgeptr->h==0) { edgeptr=edgeptr->next_from; continue; }
-            walker.k += edgeptr->h;
-            walker.p += -1.L*static_cast<long double>(edgeptr->h)*log(edgeptr->t);
+            if (edgeptr->deadts || hops(edgeptr)==0) { edgeptr=edgeptr->next_from; continue; }
+            walker.k += hops(edgeptr);
+            walker.p += -1.L*static_cast<long double>(hops(edgeptr))*log(edgeptr->t);
             if (ktn_kps->ncomms>0 && !walker.visited.empty()) walker.visited[edgeptr->to_node->bin_id]=true;
             if (!discretetime) {
-                walker.s += static_cast<long double>(edgeptr->h)*(edgeptr->rev_edge->k-edgeptr->k);
+                walker.s += static_cast<long double>(hops(edgeptr))*(edgeptr->rev_edge->k-edgeptr->k);
             } else {
-                walker.s += static_cast<long double>(edgeptr->h)*log(edgeptr->rev_edge->t/edgeptr->t);
+                walker.s += static_cast<long double>(hops(edgeptr))*log(edgeptr->rev_edge->t/edgeptr->t);
             }
             edgeptr=edgeptr->next_from;
         }
@@ -815,7 +958,7 @@ void KPS::update_path_quantities(Walker &walker, long double t_traj, const Node
 /* Gamma distribution with shape parameter a and rate parameter 1./b */
 long double KPS::gamma_distribn(unsigned long long int a, long double b, int seed) {
 
-    static default_random_engine generator(seed);
+    default_random_engine &generator = Wrapper_Method::rng(seed);
     gamma_distribution<long double> gamma_distrib(a,b);
     return gamma_distrib(generator);
 }
@@ -824,7 +967,7 @@ long double KPS::gamma_distribn(unsigned long long int a, long double b, int see
    Returns the number of successes after h Bernoulli trials. */
 unsigned long long int KPS::binomial_distribn(unsigned long long int h, long double p, int seed) {
 
-    static default_random_engine generator(seed);
+    default_random_engine &generator = Wrapper_Method::rng(seed);
     if (h<0 || (p>1. && h>0) ) { // || (p<0. && h>0)) {
 cout << "h: " << h << " p: " << p << endl; throw exception(); } // quack
     if (h==0 || p==0.)  { return 0;
@@ -837,7 +980,7 @@ cout << "h: " << h << " p: " << p << endl; throw exception(); } // quack
    Returns the number of failures before the r-th success. */
 unsigned long long int KPS::negbinomial_distribn(unsigned long long int r, long double p, int seed) {
 
-    static default_random_engine generator(seed);
+    default_random_engine &generator = Wrapper_Method::rng(seed);
     if (!(r>=0 && (p>0. && p<=1.)) && !(r==0 &p==0.)) { cout << "r: " << r << " p: " << p << endl; throw exception(); }
     if (r==0) return 0;
     negative_binomial_distribution<unsigned long long int> neg_binom_distrib(r,p);
@@ -847,7 +990,7 @@ unsigned long long int KPS::negbinomial_distribn(unsigned long long int r, long
 /* Exponential distribution with rate parameter 1./tau */
 long double KPS::exp_distribn(long double tau, int seed) {
 
-    static default_random_engine generator(seed);
+    default_random_engine &generator = Wrapper_Method::rng(seed);
     exponential_distribution<long double> exp_distrib(1.L/tau);
     return exp_distrib(generator);
 }
@@ -22,6 +22,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <cmath>
+#include <random>
+#include <iostream>
 
 using namespace std;
 
@@ -31,25 +34,271 @@ MCAMC::MCAMC(const Network &ktn, int kpskmcsteps, bool meanrate, \
     cout << "kps> MCAMC parameters:\n  FPTA (0) or mean rate method (1)?: " << meanrate \
          << "\n  no. of kMC steps after MCAMC iteration: " << kpskmcsteps << endl;
     this->kpskmcsteps=kpskmcsteps; this->meanrate=meanrate;
+    basins = make_shared<vector<MCAMC_Basin_Slot>>(ktn.ncomms);
+    bkl_step=BKL::select_bkl(discretetime,ktn.accumprobs);
 }
 
 MCAMC::~MCAMC() {}
 
 MCAMC::MCAMC(const MCAMC &mcamc_obj) : Traj_Method(mcamc_obj) {
     this->kpskmcsteps=mcamc_obj.kpskmcsteps; this->meanrate=mcamc_obj.meanrate;
+    this->basins=mcamc_obj.basins;
 }
 
+/* perform a single MCAMC basin escape iteration. The transient states of the absorbing Markov chain are the nodes of the community
+   currently occupied (excluding nodes in A), and the absorbing states are the nodes directly connected to the transient states. The
+   number of steps to absorption and the absorbing node are sampled from the cached factorisation for the community */
 void MCAMC::kmc_iteration(const Network &ktn, Walker &walker) {
 
-    cout << "mcamc> running a single iteration of MCAMC" << endl;
+    if (!epsilon) { // first iteration of A<-B path, need to set starting node
+        epsilon = Wrapper_Method::get_initial_node(ktn,walker,seed);
+        if (tintvl>=0.) walker.dump_walker_info(true,0.,walker.curr_node,dumpintvls);
+        next_tintvl=tintvl;
+    }
+    TRACE_SCOPE("escape");
+    const MCAMC_Basin &basin = get_basin(ktn,epsilon->comm_id);
+    int i = basin.trans_idcs.at(epsilon->node_pos);
+    unsigned long long int nsteps; // number of steps (including self-loops) of the escape trajectory
+    {
+    PROF_SCOPE(PROF_MCAMC_ESCAPE);
+    alpha = meanrate?sample_escape_meanrate(basin,i,nsteps):sample_escape_fpta(basin,i,nsteps);
+    }
+    PROF_COUNT(PROF_ESCAPES,1);
+    // update path quantities. The contributions to the path probability and entropy flow are not known for an MCAMC escape
+    walker.prev_node=walker.curr_node; walker.curr_node=alpha;
+    walker.k+=nsteps;
+    if (discretetime) { // every step takes the lag time
+        walker.t+=static_cast<long double>(nsteps)*epsilon->t_esc;
+    } else { // time for a linearised transition matrix is the sum of nsteps exponentially distributed waiting times
+        gamma_distribution<long double> gamma_distrib(static_cast<long double>(nsteps),epsilon->t_esc);
+        walker.t+=gamma_distrib(Wrapper_Method::rng(seed));
+    }
+    if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[alpha->bin_id]=true;
+    epsilon=alpha; alpha=nullptr;
 }
 
 /* perform specified number of BKL iterations after a basin escape */
 void MCAMC::do_bkl_steps(const Network &ktn, Walker &walker, long double maxtime) {
 
-    cout << "mcamc> doing BKL steps after a basin escape" << endl;
+    PROF_SCOPE(PROF_BKL);
+    int n_kmcit=0;
+    while (n_kmcit<kpskmcsteps && walker.t<maxtime) {
+        bkl_step(walker,seed);
+        alpha=walker.curr_node;
+        if (ktn.nbins>0 && !ktn.nodesB.empty()) walker.visited[alpha->bin_id]=true;
+        if (alpha->comm_id!=epsilon->comm_id || walker.t>maxtime) { // traj data is not dumped unless comm changes, regardless of tintvl, except if (DIMREDN) max time is exceeded
+            this->dump_traj(walker,walker.curr_node->aorb==-1,false,maxtime); }
+        epsilon=alpha;
+        if (alpha->aorb==-1 || alpha->aorb==1) return; // note that the BKL iterations are terminated if the simulation returns to B
+        n_kmcit++;
+    }
 }
 
 void MCAMC::reset_nodeptrs() {
     epsilon=nullptr; alpha=nullptr;
 }
+
+/* return the factorisation for the community, which is computed the first time that the community is visited by any walker. Only
+   walkers entering the same community wait for the factorisation, and a cached factorisation is read without locking */
+const MCAMC_Basin &MCAMC::get_basin(const Network &ktn, int comm_id) {
+    MCAMC_Basin_Slot &slot = (*basins)[comm_id];
+    call_once(slot.once,[&]() { slot.basin.reset(factorise_basin(ktn,comm_id)); });
+    return *slot.basin;
+}
+
+/* cyclic Jacobi eigenvalue algorithm for a real symmetric matrix a, which is overwritten. On return, the i-th column of v is the
+   eigenvector corresponding to the i-th eigenvalue */
+static void jacobi_eigen(vector<vector<long double>> &a, vector<long double> &evals, vector<vector<long double>> &v) {
+
+    int n=a.size();
+    v.assign(n,vector<long double>(n,0.L));
+    for (int i=0;i<n;i++) v[i][i]=1.L;
+    for (int sweep=0;sweep<100;sweep++) {
+        long double off=0.L, diag=0.L;
+        for (int i=0;i<n;i++) {
+            diag+=a[i][i]*a[i][i];
+            for (int j=i+1;j<n;j++) off+=a[i][j]*a[i][j];
+        }
+        if (!(off>numeric_limits<long double>::epsilon()*numeric_limits<long double>::epsilon()*diag)) break;
+        for (int p=0;p<n;p++) {
+            for (int q=p+1;q<n;q++) {
+                if (a[p][q]==0.L) continue;
+                long double theta=(a[q][q]-a[p][p])/(2.L*a[p][q]);
+                long double t=(theta>=0.L?1.L:-1.L)/(fabs(theta)+sqrt((theta*theta)+1.L));
+                long double c=1.L/sqrt((t*t)+1.L), s=t*c;
+                for (int k=0;k<n;k++) { // rotate columns p and q
+                    long double akp=a[k][p], akq=a[k][q];
+                    a[k][p]=(c*akp)-(s*akq); a[k][q]=(s*akp)+(c*akq);
+                }
+                for (int k=0;k<n;k++) { // rotate rows p and q
+                    long double apk=a[p][k], aqk=a[q][k];
+                    a[p][k]=(c*apk)-(s*aqk); a[q][k]=(s*apk)+(c*aqk);
+                }
+                for (int k=0;k<n;k++) {
+                    long double vkp=v[k][p], vkq=v[k][q];
+                    v[k][p]=(c*vkp)-(s*vkq); v[k][q]=(s*vkp)+(c*vkq);
+                }
+            }
+        }
+    }
+    evals.resize(n);
+    for (int i=0;i<n;i++) evals[i]=a[i][i];
+}
+
+/* set up the absorbing Markov chain for the community and compute its factorisation. For the FPTA method, the transient block of the
+   transition matrix is symmetrised using the stationary probabilities (which requires that the Markov chain is reversible) and
+   diagonalised. For the mean rate method, the fundamental matrix is used to compute the mean numbers of steps to absorption and the
+   absorption probabilities, via an LU decomposition of I-T */
+MCAMC_Basin *MCAMC::factorise_basin(const Network &ktn, int comm_id) {
+
+    PROF_SCOPE(PROF_MCAMC_FACTORISE);
+    if (debug) cout << "mcamc> factorising absorbing Markov chain for community " << comm_id << endl;
+    MCAMC_Basin *basin = new MCAMC_Basin();
+    for (const Node &node: ktn.nodes) {
+        if (node.comm_id!=comm_id || node.aorb==-1) continue;
+        basin->trans_idcs[node.node_pos]=basin->trans_nodes.size();
+        basin->trans_nodes.push_back(&node);
+    }
+    int n=basin->trans_nodes.size();
+    vector<vector<long double>> t_tt(n,vector<long double>(n,0.L)); // transient block of transition matrix
+    vector<vector<pair<int,long double>>> t_ta(n); // nonzero elements of transient-absorbing block
+    unordered_map<idx_t,int> abs_idcs; // map from position of node in the network to index of absorbing node
+    for (int i=0;i<n;i++) {
+        t_tt[i][i]=basin->trans_nodes[i]->t; // self-loop probability
+        const Edge *edgeptr = basin->trans_nodes[i]->top_from;
+        while (edgeptr!=nullptr) {
+            if (edgeptr->deadts) { edgeptr=edgeptr->next_from; continue; }
+            idx_t pos=edgeptr->to_node->node_pos;
+            if (basin->trans_idcs.count(pos)) {
+                t_tt[i][basin->trans_idcs[pos]]+=edgeptr->t;
+            } else {
+                if (!abs_idcs.count(pos)) {
+                    abs_idcs[pos]=basin->abs_nodes.size(); basin->abs_nodes.push_back(edgeptr->to_node); }
+                t_ta[i].push_back(make_pair(abs_idcs[pos],edgeptr->t));
+            }
+            edgeptr=edgeptr->next_from;
+        }
+    }
+    int m=basin->abs_nodes.size();
+    if (m==0) {
+        cout << "mcamc> error: community " << comm_id << " has no absorbing nodes" << endl; exit(EXIT_FAILURE); }
+    if (!meanrate) {
+        long double pi_max=-numeric_limits<long double>::infinity(); // stationary probs are scaled to avoid over/underflow
+        for (const Node *node: basin->trans_nodes) pi_max=max(pi_max,(long double)node->pi);
+        vector<long double> sqrt_pi(n);
+        for (int i=0;i<n;i++) sqrt_pi[i]=exp(0.5L*(basin->trans_nodes[i]->pi-pi_max));
+        vector<vector<long double>> sym(n,vector<long double>(n));
+        for (int i=0;i<n;i++) {
+            for (int j=0;j<n;j++) sym[i][j]=t_tt[i][j]*sqrt_pi[i]/sqrt_pi[j]; }
+        for (int i=0;i<n;i++) {
+            for (int j=i+1;j<n;j++) {
+                if (fabs(sym[i][j]-sym[j][i])>1.E-06L*max(fabs(sym[i][j]),fabs(sym[j][i]))) {
+                    cout << "mcamc> error: FPTA method requires a reversible Markov chain, use MEANRATE instead" << endl;
+                    exit(EXIT_FAILURE); }
+                sym[i][j]=0.5L*(sym[i][j]+sym[j][i]); sym[j][i]=sym[i][j];
+            }
+        }
+        vector<vector<long double>> v;
+        jacobi_eigen(sym,basin->evals,v);
+        basin->evecs_l.assign(n,vector<long double>(n));
+        basin->evecs_sum.assign(n,0.L);
+        basin->evecs_abs.assign(n,vector<long double>(m,0.L));
+        for (int i=0;i<n;i++) {
+            for (int l=0;l<n;l++) {
+                basin->evecs_l[i][l]=v[i][l]/sqrt_pi[i];
+                basin->evecs_sum[l]+=v[i][l]*sqrt_pi[i];
+                for (const auto &elem: t_ta[i]) basin->evecs_abs[l][elem.first]+=v[i][l]*sqrt_pi[i]*elem.second;
+            }
+        }
+    } else {
+        // LU decomposition (with partial pivoting) of I-T, stored in place
+        vector<vector<long double>> lu(n,vector<long double>(n));
+        for (int i=0;i<n;i++) {
+            for (int j=0;j<n;j++) lu[i][j]=(i==j?1.L:0.L)-t_tt[i][j]; }
+        vector<int> perm(n);
+        for (int i=0;i<n;i++) perm[i]=i;
+        for (int k=0;k<n;k++) {
+            int pivot=k;
+            for (int i=k+1;i<n;i++) { if (fabs(lu[i][k])>fabs(lu[pivot][k])) pivot=i; }
+            swap(lu[k],lu[pivot]); swap(perm[k],perm[pivot]);
+            for (int i=k+1;i<n;i++) {
+                lu[i][k]/=lu[k][k];
+                for (int j=k+1;j<n;j++) lu[i][j]-=lu[i][k]*lu[k][j];
+            }
+        }
+        auto lu_solve = [&](const vector<long double> &b) { // solve (I-T)x=b using the LU decomposition
+            vector<long double> x(n);
+            for (int i=0;i<n;i++) {
+                x[i]=b[perm[i]];
+                for (int j=0;j<i;j++) x[i]-=lu[i][j]*x[j];
+            }
+            for (int i=n-1;i>=0;i--) {
+                for (int j=i+1;j<n;j++) x[i]-=lu[i][j]*x[j];
+                x[i]/=lu[i][i];
+            }
+            return x;
+        };
+        basin->mean_steps=lu_solve(vector<long double>(n,1.L));
+        basin->absprobs.assign(n,vector<long double>(m,0.L));
+        for (int a=0;a<m;a++) {
+            vector<long double> b(n,0.L);
+            for (int i=0;i<n;i++) {
+                for (const auto &elem: t_ta[i]) { if (elem.first==a) b[i]+=elem.second; } }
+            vector<long double> x=lu_solve(b);
+            for (int i=0;i<n;i++) basin->absprobs[i][a]=max(x[i],0.L);
+        }
+        for (int i=0;i<n;i++) { // cumulative absorption probabilities
+            for (int a=1;a<m;a++) basin->absprobs[i][a]+=basin->absprobs[i][a-1]; }
+    }
+    return basin;
+}
+
+/* first passage time analysis (FPTA). The number of steps k to absorption from the i-th transient node is sampled exactly by
+   inverting the survival probability S(k)=sum_l [D^{-1/2}V]_il L_l^k [V^TD^{1/2}1]_l, using an exponential search followed by bisection.
+   The absorbing node is then sampled from the probabilities of absorption at each node at the k-th step */
+const Node *MCAMC::sample_escape_fpta(const MCAMC_Basin &basin, int i, unsigned long long int &nsteps) {
+
+    int n=basin.evals.size(), m=basin.abs_nodes.size();
+    auto survival = [&](long double k) {
+        long double s=0.L;
+        for (int l=0;l<n;l++) s+=basin.evecs_l[i][l]*basin.evecs_sum[l]*pow(basin.evals[l],k);
+        return s;
+    };
+    long double u=Wrapper_Method::rand_unif_met(seed);
+    long double k_lo=0.L, k_hi=1.L; // S(k_lo)>=u>S(k_hi)
+    while (survival(k_hi)>=u) {
+        k_lo=k_hi; k_hi*=2.L;
+        if (k_hi>1.E+18L) { cout << "mcamc> error: escape time from basin exceeds max. number of steps" << endl; exit(EXIT_FAILURE); }
+    }
+    while (k_hi-k_lo>1.L) {
+        long double k_mid=floor(0.5L*(k_lo+k_hi));
+        if (survival(k_mid)>=u) { k_lo=k_mid; } else { k_hi=k_mid; }
+    }
+    nsteps=static_cast<unsigned long long int>(k_hi);
+    vector<long double> coeffs(n); // coefficients of the eigenmodes at the (k-1)-th step
+    for (int l=0;l<n;l++) coeffs[l]=basin.evecs_l[i][l]*pow(basin.evals[l],k_hi-1.L);
+    vector<long double> cum_probs(m); // cumulative (unnormalised) probabilities of absorption at each node at the k-th step
+    long double cum_p=0.L;
+    for (int a=0;a<m;a++) {
+        long double p=0.L;
+        for (int l=0;l<n;l++) p+=coeffs[l]*basin.evecs_abs[l][a];
+        cum_p+=max(p,0.L); cum_probs[a]=cum_p;
+    }
+    long double rand_no=Wrapper_Method::rand_unif_met(seed)*cum_p;
+    for (int a=0;a<m;a++) { if (rand_no<cum_probs[a]) return basin.abs_nodes[a]; }
+    return basin.abs_nodes[m-1];
+}
+
+/* mean rate method. The number of steps to absorption from the i-th transient node is approximated as geometrically distributed with
+   mean equal to the exact mean number of steps, and the absorbing node is sampled from the exact absorption probabilities */
+const Node *MCAMC::sample_escape_meanrate(const MCAMC_Basin &basin, int i, unsigned long long int &nsteps) {
+
+    long double p_esc=1.L/basin.mean_steps[i]; // probability of escape at each step
+    if (p_esc>=1.L) { nsteps=1;
+    } else {
+        nsteps=1+static_cast<unsigned long long int>(floor(log(1.L-Wrapper_Method::rand_unif_met(seed))/log1p(-p_esc))); }
+    const vector<long double> &cum_probs=basin.absprobs[i];
+    long double rand_no=Wrapper_Method::rand_unif_met(seed)*cum_probs.back();
+    for (int a=0;a<cum_probs.size();a++) { if (rand_no<cum_probs[a]) return basin.abs_nodes[a]; }
+    return basin.abs_nodes.back();
+}
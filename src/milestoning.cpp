@@ -23,14 +23,198 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <cmath>
+#include <algorithm>
 #include <omp.h>
+#include <fstream>
 #include <iostream>
 
 using namespace std;
 
-MILES::MILES(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the milestones are the boundaries between pairs of adjacent communities. Trajectories launched from a milestone are initialised
+   at the nodes entered by transitions across the boundary, sampled in proportion to the equilibrium flux along the transition.
+   Trajectories launched from the initial set B are initialised according to the initial distribution for B */
+MILES::MILES(const Network &ktn, int ntrajs, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    this->ntrajs=ntrajs; this->ncomms=ktn.ncomms;
+    vector<vector<const Node*>> start_nodes(1);
+    vector<vector<long double>> start_logprobs(1);
+    mile_comms.push_back(make_pair(-1,-1)); // initial set B
+    for (const Edge &edge: ktn.edges) {
+        if (edge.deadts || edge.from_node->comm_id==edge.to_node->comm_id) continue;
+        int comm1=min(edge.from_node->comm_id,edge.to_node->comm_id), comm2=max(edge.from_node->comm_id,edge.to_node->comm_id);
+        int key=(comm1*ncomms)+comm2;
+        if (mile_ids.find(key)==mile_ids.end()) {
+            mile_ids[key]=mile_comms.size(); mile_comms.push_back(make_pair(comm1,comm2));
+            start_nodes.emplace_back(vector<const Node*>()); start_logprobs.emplace_back(vector<long double>());
+        }
+        if (edge.to_node->aorb==-1) continue; // trajectories are not initialised in A
+        start_nodes[mile_ids[key]].push_back(edge.to_node);
+        start_logprobs[mile_ids[key]].push_back(edge.from_node->pi+log(edge.t)-log(edge.from_node->t_esc));
+    }
+    mile_comms.push_back(make_pair(-1,-1)); // target set A
+    nmiles=mile_comms.size();
+    start_tables.resize(nmiles-1);
+    start_tables[0]=ktn.init_tables[0];
+    for (int i=1;i<nmiles-1;i++) {
+        if (start_nodes[i].empty()) continue; // milestone can only be crossed by entering A
+        long double logprob_max=*max_element(start_logprobs[i].begin(),start_logprobs[i].end());
+        vector<long double> probs;
+        for (const long double logprob: start_logprobs[i]) probs.push_back(exp(logprob-logprob_max));
+        start_tables[i]=Alias_Table(start_nodes[i],probs,0.L);
+    }
+    cout << "miles> running milestoning with parameters:\n  no. of milestones: " << nmiles-2 \
+         << " \tno. of trajectories launched from each milestone: " << ntrajs << endl;
+}
+
 MILES::~MILES() {}
 
+/* return the ID of the milestone crossed by a transition between the given communities, or -1 if no milestone other than the
+   current milestone is crossed */
+int MILES::get_mile_id(int comm_from, int comm_to, int mile_id) const {
+    if (comm_from==comm_to) return -1;
+    int new_mile_id=mile_ids.at((min(comm_from,comm_to)*ncomms)+max(comm_from,comm_to));
+    return new_mile_id==mile_id?-1:new_mile_id;
+}
+
+/* main loop of milestoning. Short trajectories are launched independently, and in parallel, from each milestone, and are propagated
+   until a different milestone is crossed or A is reached. The milestone transition kernel K and mean lifetimes T of the milestones
+   are estimated from these trajectories, and the MFPTs tau from each milestone to A are the solution of (I-K)tau=T.
+   The first iteration is classical milestoning, where trajectories are initialised according to the equilibrium flux across each
+   milestone. In subsequent iterations (exact milestoning), the starting nodes are sampled from the points at which each milestone was
+   hit in the previous iteration, weighted by the steady state flux through the milestone from which the trajectory was launched */
 void MILES::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nmiles> beginning milestoning simulation" << endl;
+    vector<long double> mfpts;
+    for (int n_it=1;n_it<=nabpaths;n_it++) {
+        launch_trajs(ktn,traj_method_obj);
+        mfpts=calc_mfpts();
+        cout << "miles> iteration " << n_it << " \tA<-B MFPT: " << mfpts[0] << endl;
+        if (n_it<nabpaths) update_start_tables(ktn);
+    }
+    write_miles_info(mfpts);
+    cout << "miles> finished milestoning simulation" << endl;
+    cout << "miles> A<-B MFPT: " << mfpts[0] << " \tA<-B flux (rate constant): " << 1.L/mfpts[0] << endl;
+}
+
+/* launch ntrajs trajectories from each milestone, in parallel, and record the milestones and points at which they are hit */
+void MILES::launch_trajs(const Network &ktn, Traj_Method *traj_method_obj) {
+
+    n_hits.assign(nmiles-1,vector<unsigned long long int>(nmiles,0));
+    lifetimes.assign(nmiles-1,0.L); n_launched.assign(nmiles-1,0);
+    hit_points.assign(nmiles-1,unordered_map<long long int,unsigned long long int>());
+    int n_jobs=(nmiles-1)*ntrajs;
+    #pragma omp parallel
+    {
+    int x = omp_get_thread_num();
+    Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+    Walker &walker=walkers[x];
+    vector<vector<unsigned long long int>> n_hits_local(nmiles-1,vector<unsigned long long int>(nmiles,0));
+    vector<long double> lifetimes_local(nmiles-1,0.L);
+    vector<int> n_launched_local(nmiles-1,0);
+    vector<unordered_map<long long int,unsigned long long int>> hit_points_local(nmiles-1);
+    #pragma omp for schedule(dynamic,16)
+    for (int job=0;job<n_jobs;job++) {
+        int mile_id=job/ntrajs;
+        if (start_tables[mile_id].nodes.empty()) continue;
+        walker.reset_walker_info(); walker.p=0.L;
+        walker.curr_node=start_tables[mile_id].sample(rand_unif_met(seed));
+        walker.prev_node=walker.curr_node;
+        int new_mile_id;
+        for (;;) {
+            int comm_from=walker.curr_node->comm_id;
+            traj_method_local->kmc_iteration(ktn,walker);
+            if (walker.curr_node->aorb==-1) { new_mile_id=nmiles-1; break; }
+            new_mile_id=get_mile_id(comm_from,walker.curr_node->comm_id,mile_id);
+            if (new_mile_id>=0) break;
+        }
+        n_hits_local[mile_id][new_mile_id]++; lifetimes_local[mile_id]+=walker.t; n_launched_local[mile_id]++;
+        if (new_mile_id<nmiles-1) {
+            hit_points_local[new_mile_id][(static_cast<long long int>(mile_id)*ktn.n_nodes)+walker.curr_node->node_pos]++; }
+    }
+    #pragma omp critical
+    {
+    for (int i=0;i<nmiles-1;i++) {
+        for (int j=0;j<nmiles;j++) n_hits[i][j]+=n_hits_local[i][j];
+        lifetimes[i]+=lifetimes_local[i]; n_launched[i]+=n_launched_local[i];
+        for (const auto &hit_point: hit_points_local[i]) hit_points[i][hit_point.first]+=hit_point.second;
+    }
+    }
+    delete traj_method_local;
+    }
+    for (int i=0;i<nmiles-1;i++) { if (n_launched[i]>0) lifetimes[i]/=static_cast<long double>(n_launched[i]); }
+}
+
+/* solve for the MFPTs to A from each milestone. Milestones that cannot be launched from are always followed by A */
+vector<long double> MILES::calc_mfpts() {
+
+    int n=nmiles-1;
+    vector<vector<long double>> a(n,vector<long double>(n,0.L));
+    vector<long double> mfpts(n,0.L);
+    for (int i=0;i<n;i++) {
+        a[i][i]=1.L;
+        if (n_launched[i]==0) continue;
+        mfpts[i]=lifetimes[i];
+        for (int j=0;j<n;j++) a[i][j]-=static_cast<long double>(n_hits[i][j])/static_cast<long double>(n_launched[i]);
+    }
+    if (!solve_linear_system(a,mfpts)) {
+        cout << "miles> error: milestone transition kernel is singular, increase no. of trajectories" << endl; exit(EXIT_FAILURE); }
+    return mfpts;
+}
+
+/* the steady state fluxes q through the milestones are the stationary distribution of the milestone transition kernel, where
+   hitting A is followed by B. The probability of a starting node for a milestone is proportional to the sum, over the milestones
+   from which trajectories were launched, of the flux through the launching milestone multiplied by the probability of hitting the
+   milestone at the node */
+void MILES::update_start_tables(const Network &ktn) {
+
+    int n=nmiles-1;
+    vector<vector<long double>> a(n,vector<long double>(n,0.L)); // transpose of (K-I), last eqn replaced by normalisation
+    for (int i=0;i<n;i++) {
+        a[i][i]-=1.L;
+        if (n_launched[i]==0) { a[0][i]+=1.L; continue; }
+        for (int j=0;j<nmiles;j++) {
+            a[j<n?j:0][i]+=static_cast<long double>(n_hits[i][j])/static_cast<long double>(n_launched[i]); }
+    }
+    vector<long double> q(n,0.L); q[n-1]=1.L;
+    fill(a[n-1].begin(),a[n-1].end(),1.L);
+    if (!solve_linear_system(a,q)) return;
+    for (int j=1;j<n;j++) {
+        unordered_map<idx_t,long double> start_probs; // probabilities of starting nodes, keyed by node position
+        for (const auto &hit_point: hit_points[j]) {
+            int mile_id=hit_point.first/ktn.n_nodes;
+            idx_t pos=hit_point.first%ktn.n_nodes;
+            start_probs[pos]+=max(q[mile_id],0.L)*static_cast<long double>(hit_point.second)/n_launched[mile_id];
+        }
+        vector<const Node*> start_nodes; vector<long double> probs;
+        for (const auto &start_prob: start_probs) {
+            if (!(start_prob.second>0.L)) continue;
+            start_nodes.push_back(&ktn.nodes[start_prob.first]); probs.push_back(start_prob.second);
+        }
+        if (!start_nodes.empty()) start_tables[j]=Alias_Table(start_nodes,probs,0.L);
+    }
+}
+
+/* write the milestone properties and the transition kernel to files */
+void MILES::write_miles_info(const vector<long double> &mfpts) {
+
+    int n=nmiles-1;
+    ofstream miles_f; miles_f.open("milestones.dat");
+    miles_f.setf(ios::right,ios::adjustfield); miles_f.setf(ios::scientific,ios::floatfield);
+    miles_f.precision(10);
+    for (int i=0;i<n;i++) {
+        miles_f << setw(7) << i << setw(7) << mile_comms[i].first << setw(7) << mile_comms[i].second << setw(12) << n_launched[i] \
+                << setw(20) << lifetimes[i] << setw(20) << mfpts[i] << endl;
+    }
+    miles_f.close();
+    ofstream kernel_f; kernel_f.open("milestone_kernel.dat");
+    kernel_f.setf(ios::scientific,ios::floatfield); kernel_f.precision(10);
+    for (int i=0;i<n;i++) {
+        for (int j=0;j<nmiles;j++) {
+            if (n_hits[i][j]==0) continue;
+            kernel_f << setw(7) << i << setw(7) << j << setw(20) << static_cast<long double>(n_hits[i][j])/n_launched[i] << endl;
+        }
+    }
+    kernel_f.close();
 }
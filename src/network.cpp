@@ -26,9 +26,49 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
 
 using namespace std;
 
+const char *Mem_Accounting::names[Mem_Accounting::NCOMPONENTS] = {"network","ktn_kps","ktn_kps_orig","ktn_l","ktn_u","ktn_kps_gt", \
+    "rea_shortest_paths","rea_candidate_paths","unif_matrix","spectral_basis"};
+atomic<long long int> Mem_Accounting::curr[Mem_Accounting::NCOMPONENTS]{}, Mem_Accounting::peak[Mem_Accounting::NCOMPONENTS]{};
+atomic<long long int> Mem_Accounting::curr_tot{0}, Mem_Accounting::peak_tot{0};
+atomic<unsigned long long int> Mem_Accounting::n_limited{0};
+long long int Mem_Accounting::budget=0;
+
+/* record a change in the memory held by a component, and update the peak values. A warning is printed the first time that the total
+   memory exceeds the budget */
+void Mem_Accounting::alloc(int comp, long long int bytes) {
+    auto update_peak = [](atomic<long long int> &pk, long long int val) {
+        long long int old_pk=pk.load();
+        while (val>old_pk && !pk.compare_exchange_weak(old_pk,val)) {}
+        return old_pk;
+    };
+    update_peak(peak[comp],curr[comp]+=bytes);
+    long long int tot=curr_tot+=bytes;
+    long long int old_peak=update_peak(peak_tot,tot);
+    if (budget>0 && tot>budget && !(old_peak>budget)) {
+        #pragma omp critical
+        cout << "memory> warning: memory in use (" << tot/1.e6 << " MB) has exceeded the memory budget" << endl;
+    }
+}
+
+long long int Mem_Accounting::available() {
+    if (budget<=0) return numeric_limits<long long int>::max();
+    return budget-curr_tot;
+}
+
+void Mem_Accounting::print_report() {
+    cout << "memory> peak memory usage of components (MB):" << endl;
+    for (int i=0;i<NCOMPONENTS;i++) {
+        if (peak[i]==0) continue;
+        cout << "  " << left << setw(22) << names[i] << right << fixed << setprecision(3) << peak[i]/1.e6 << endl;
+    }
+    cout << "memory> peak total memory usage (MB): " << peak_tot/1.e6 << defaultfloat << setprecision(6) << endl;
+    if (n_limited>0) cout << "memory> no. of kPS basins reduced in size to fit within the memory budget: " << n_limited << endl;
+}
+
 Node::Node() {}
 
 Node::~Node() {}
@@ -41,29 +81,63 @@ Node::Node(const Node &node) {
 }
 
 /* constructor for Network class */
-Network::Network(int nnodes, int nedges) {
+Network::Network(idx_t nnodes, idx_t nedges) {
     nodes.resize(nnodes); n_nodes=nnodes;
     edges.resize(2*nedges); n_edges=nedges;
 }
 
-Network::~Network() {}
+Network::~Network() {
+    if (cktn!=nullptr) delete cktn;
+    if (kps_fields!=nullptr) delete kps_fields;
+    if (mem_comp>=0) Mem_Accounting::alloc(mem_comp,-mem_bytes);
+}
+
+/* record the memory held by the node and edge vectors (by capacity) in the accounting for the specified component */
+void Network::account_mem(int comp) {
+    long long int bytes = nodes.capacity()*sizeof(Node)+edges.capacity()*sizeof(Edge);
+    if (kps_fields!=nullptr) bytes += kps_fields->bytes();
+    if (mem_comp>=0 && comp!=mem_comp) { Mem_Accounting::alloc(mem_comp,-mem_bytes); mem_bytes=0; }
+    mem_comp=comp;
+    Mem_Accounting::alloc(comp,bytes-mem_bytes);
+    mem_bytes=bytes;
+}
 
 /* copy constructor for Network class */
 Network::Network(const Network &ktn) {
     n_nodes=ktn.n_nodes; n_edges=ktn.n_edges;
     nodes.resize(n_nodes); edges.resize(n_edges);
-    for (int i=0;i<n_nodes;i++) nodes[i] = ktn.nodes[i];
-    for (int i=0;i<n_edges;i++) edges[i] = ktn.edges[i];
+    for (idx_t i=0;i<n_nodes;i++) nodes[i] = ktn.nodes[i];
+    for (idx_t i=0;i<n_edges;i++) edges[i] = ktn.edges[i];
     n_dead=ktn.n_dead; ncomms=ktn.ncomms;
     branchprobs=ktn.branchprobs; tau=ktn.tau;
     // now sort out pointers
-    for (int i=0;i<n_edges;i++) {
+    for (idx_t i=0;i<n_edges;i++) {
         edges[i].from_node = &nodes[ktn.edges[i].from_node->node_pos];
         edges[i].to_node = &nodes[ktn.edges[i].to_node->node_pos];
         add_to_edge(ktn.edges[i].to_node->node_pos,i);
         add_from_edge(ktn.edges[i].from_node->node_pos,i);
         edges[i].rev_edge = &edges[ktn.edges[i].rev_edge->edge_id];
     }
+    // the hop counts of the copy are zero, but the GT labels of edges are retained
+    if (ktn.kps_fields!=nullptr) {
+        alloc_kps_fields();
+        copy(ktn.kps_fields->edge_label.begin(),ktn.kps_fields->edge_label.begin()+n_edges,kps_fields->edge_label.begin());
+    }
+}
+
+/* allocate the kPS-only fields of the nodes and edges, initialised to zero values */
+void Network::alloc_kps_fields() {
+    if (kps_fields==nullptr) kps_fields = new KPS_Fields();
+    kps_fields->resize(nodes.size(),edges.size());
+}
+
+void KPS_Fields::resize(size_t n_nodes, size_t n_edges) {
+    node_h.assign(n_nodes,0); node_dt.assign(n_nodes,0.); node_flag.assign(n_nodes,false);
+    edge_h.assign(n_edges,0); edge_dt.assign(n_edges,0.); edge_label.assign(n_edges,0);
+}
+
+long long int KPS_Fields::bytes() const {
+    return node_h.capacity()*node_bytes+edge_h.capacity()*edge_bytes;
 }
 
 /* calculate the factor (1-T_{nn}) needed in the elimination of the n-th node in graph transformation */
@@ -94,6 +168,7 @@ void Network::dumpwaittimes() {
 void Network::get_tmtx_lin(long double tau) {
     cout << "network> calculating linearised transition probability matrix at lag time: " << tau << endl;
     for (auto &node: nodes) {
+        calc_t_esc(node);
         if (tau>node.t_esc) throw Network_exception(); // value of tau does not give stochastic matrix
         node.t = 1.L-(tau/node.t_esc);
         node.t_esc = tau; // mean waiting times are all equal in the linearised transition matrix
@@ -154,7 +229,9 @@ void Network::set_accumprobs() {
             edgeptr->t += prev_cum_t;
             edgeptr=edgeptr->next_from;
         }
-        if (abs(cum_t-1.)>1.E-16) throw Network_exception();
+        // rounding error of the accumulated sum scales with the precision of the stored probabilities and the no. of terms
+        long double tol=max(1.E-16L,4.L*static_cast<long double>(numeric_limits<real_t>::epsilon())*static_cast<long double>(node.udeg+1));
+        if (abs(cum_t-1.)>tol) throw Network_exception();
     }
 }
 
@@ -173,7 +250,7 @@ void Network::renormalize_selfloops() {
 }
 
 // delete node i 
-void Network::del_node(int i) {
+void Network::del_node(idx_t i) {
     if (nodes[i].eliminated) throw Network_exception();
     Edge *edgeptr;
     edgeptr = nodes[i].top_to;
@@ -191,7 +268,7 @@ void Network::del_node(int i) {
 }
 
 // edge j goes TO node i
-void Network::add_to_edge(int i, int j) {
+void Network::add_to_edge(idx_t i, idx_t j) {
     if (nodes[i].top_to != nullptr) {
         edges[j].next_to = nodes[i].top_to;
         nodes[i].top_to = &edges[j]; }
@@ -202,7 +279,7 @@ void Network::add_to_edge(int i, int j) {
 }
 
 // edge j goes FROM node i
-void Network::add_from_edge(int i, int j) {
+void Network::add_from_edge(idx_t i, idx_t j) {
     if (nodes[i].top_from != nullptr) {
         edges[j].next_from = nodes[i].top_from;
         nodes[i].top_from = &edges[j]; }
@@ -214,7 +291,7 @@ void Network::add_from_edge(int i, int j) {
 }
 
 // delete the top TO edge for node i
-void Network::del_to_edge(int i) {
+void Network::del_to_edge(idx_t i) {
     if (nodes[i].top_to != nullptr) {
         if (nodes[i].top_to->next_to != nullptr) {
             nodes[i].top_to = nodes[i].top_to->next_to;
@@ -228,7 +305,7 @@ void Network::del_to_edge(int i) {
 }
 
 // delete the top FROM edge for node i
-void Network::del_from_edge(int i) {
+void Network::del_from_edge(idx_t i) {
     if (nodes[i].top_from != nullptr) {
         if (nodes[i].top_from->next_from != nullptr) {
             nodes[i].top_from = nodes[i].top_from->next_from;
@@ -243,7 +320,7 @@ void Network::del_from_edge(int i) {
 }
 
 // delete TO edge with edge_id j for node i
-void Network::del_spec_to_edge(int i, int j) {
+void Network::del_spec_to_edge(idx_t i, idx_t j) {
     Edge *edgeptr; Edge *edgeptr_prev = nullptr;
     bool edge_exists = false;
     if (nodes[i].top_to==nullptr) throw Network_exception();
@@ -267,7 +344,7 @@ void Network::del_spec_to_edge(int i, int j) {
 }
 
 // delete FROM edge with edge_id j for node i
-void Network::del_spec_from_edge(int i, int j) {
+void Network::del_spec_from_edge(idx_t i, idx_t j) {
     Edge *edgeptr; Edge *edgeptr_prev = nullptr;
     bool edge_exists = false;
     if (nodes[i].top_from==nullptr) throw Network_exception();
@@ -291,20 +368,20 @@ void Network::del_spec_from_edge(int i, int j) {
 }
 
 // update edge with edge_id j so that it now points TO node i
-void Network::update_to_edge(int i, int j) {
+void Network::update_to_edge(idx_t i, idx_t j) {
     Edge *edgeptr;
     edgeptr = &edges[j];
-    int old_to = edgeptr->to_node->node_id;
+    idx_t old_to = edgeptr->to_node->node_id;
     edgeptr->to_node = &nodes[i];
     del_spec_to_edge(old_to-1,edgeptr->edge_id);
     add_to_edge(i,j);
 }
 
 // update edge with edge_id j so that it now points FROM i
-void Network::update_from_edge(int i, int j) {
+void Network::update_from_edge(idx_t i, idx_t j) {
     Edge *edgeptr;
     edgeptr = &edges[j];
-    int old_from = edgeptr->from_node->node_id;
+    idx_t old_from = edgeptr->from_node->node_id;
     edgeptr->from_node = &nodes[i];
     del_spec_from_edge(old_from-1,edgeptr->edge_id);
     add_from_edge(i,j);
@@ -353,9 +430,30 @@ void Network::set_initcond(const vector<double> &init_probs) {
     this->init_probs=init_probs;
 }
 
+/* validate that the Markov chain satisfies detailed balance, i.e. that the stationary fluxes along the forward and reverse transitions
+   of each edge, pi_i*T_{i->j}/t_esc_i and pi_j*T_{j->i}/t_esc_j, are equal (to within a relative tolerance) */
+void Network::check_detailed_balance() {
+    cout << "network> checking detailed balance condition for reversible Markov chain" << endl;
+    const long double tol=1.E-08;
+    long double maxdev=0.L;
+    for (idx_t i=0;i<n_edges;i++) {
+        const Edge &edge=edges[2*i], &rev_edge=edges[(2*i)+1];
+        if (edge.t==0.L && rev_edge.t==0.L) continue;
+        long double logflux=edge.from_node->pi+log(edge.t)-log(edge.from_node->t_esc);
+        long double logflux_rev=rev_edge.from_node->pi+log(rev_edge.t)-log(rev_edge.from_node->t_esc);
+        long double dev=abs(logflux-logflux_rev);
+        if (!(dev<=tol)) {
+            cout << "network> error: detailed balance is violated for the edge connecting nodes " << edge.from_node->node_id \
+                 << " and " << edge.to_node->node_id << ", difference in (log) stationary fluxes: " << dev << endl;
+            exit(EXIT_FAILURE); }
+        if (dev>maxdev) maxdev=dev;
+    }
+    cout << "network> detailed balance is satisfied, max. difference in (log) stationary fluxes: " << maxdev << endl;
+}
+
 /* update the Network object pointed to by the ktn argument to include an additional edge (with index k in the edges vector)
    connecting from_node and to_node */
-void Network::add_edge_network(Network *ktn, Node &from_node, Node &to_node, int k) {
+void Network::add_edge_network(Network *ktn, Node &from_node, Node &to_node, idx_t k) {
     (ktn->edges[k]).from_node = &from_node;
     (ktn->edges[k]).to_node = &to_node;
     ktn->add_from_edge(from_node.node_id-1,k);
@@ -363,9 +461,9 @@ void Network::add_edge_network(Network *ktn, Node &from_node, Node &to_node, int
 }
 
 /* set up the Markov chain (kinetic transition network, KTN) */
-void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
+void Network::setup_network(Network& ktn, const vector<pair<idx_t,idx_t>> &conns, \
         const vector<pair<long double,long double>> &weights, const vector<long double> &stat_probs, \
-        const vector<int> &nodesinA, const vector<int> &nodesinB, bool discretetime, bool noloop, bool branchprobs, \
+        const vector<idx_t> &nodesinA, const vector<idx_t> &nodesinB, bool discretetime, bool noloop, bool branchprobs, \
         long double tau, int ncomms, const vector<int> &comms, const vector<int> &bins) {
 
     cout << "network> constructing nodes and edges of Markovian network from vectors" << endl;
@@ -378,7 +476,7 @@ void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
     ktn.ncomms=ncomms;
     if (!comms.empty()) ktn.comm_sizes.resize(ncomms);
     long double tot_pi = -numeric_limits<long double>::infinity();
-    for (int i=0;i<ktn.n_nodes;i++) {
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
         ktn.nodes[i].node_id = i+1; ktn.nodes[i].node_pos = i;
         if (!comms.empty()) {
             ktn.nodes[i].comm_id = comms[i];
@@ -397,7 +495,7 @@ void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
 
     cout << "network> beginning setup of Markovian network topology" << endl;
     // network topology setup
-    for (int i=0;i<ktn.n_edges;i++) {
+    for (idx_t i=0;i<ktn.n_edges;i++) {
         ktn.edges[2*i].edge_id = 2*i;
         ktn.edges[(2*i)+1].edge_id = (2*i)+1;
         if (conns[i].first==conns[i].second) {
@@ -434,7 +532,7 @@ void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
     else if (!discretetime) { ktn.get_tmtx_lin(tau); } // linearised transition probabilities (uniform mean waiting times)
     // set the lag times and self-loop transition probabilities for a DTMC
     if (discretetime) {
-        for (int i=0;i<ktn.n_nodes;i++) {
+        for (idx_t i=0;i<ktn.n_nodes;i++) {
             calc_t_selfloop(ktn.nodes[i]);
             ktn.nodes[i].t_esc = tau;
         }
@@ -442,12 +540,12 @@ void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
     }
 
     // set endpoint states
-    for (int i=0;i<nodesinA.size();i++) {
+    for (idx_t i=0;i<nodesinA.size();i++) {
         if (nodesinA[i]>ktn.n_nodes) throw Network_exception();
         ktn.nodes[nodesinA[i]-1].aorb = -1;
         ktn.nodesA.insert(&ktn.nodes[nodesinA[i]-1]);
     }
-    for (int i=0;i<nodesinB.size();i++) {
+    for (idx_t i=0;i<nodesinB.size();i++) {
         if (nodesinB[i]>ktn.n_nodes) throw Network_exception();
         ktn.nodes[nodesinB[i]-1].aorb = 1;
         ktn.nodesB.insert(&ktn.nodes[nodesinB[i]-1]);
@@ -466,3 +564,125 @@ void Network::setup_network(Network& ktn, const vector<pair<int,int>> &conns, \
     }
     cout << "network> finished setting up Markovian network data structure" << endl;
 }
+
+/* construct the compact array-based representation of the network. Must be called before the transition probabilities are
+   set to accumulated values (cf. set_accumprobs()) */
+void Network::compile(bool discretetime) {
+    if (accumprobs) throw Network::Network_exception();
+    if (cktn!=nullptr) delete cktn;
+    cktn = new Compiled_Network(*this,discretetime);
+}
+
+Compiled_Network::Compiled_Network(const Network &ktn, bool discretetime) {
+
+    cout << "network> constructing compact array-based representation of the network" << endl;
+    n_nodes=ktn.n_nodes; n_trans=0;
+    offsets.resize(n_nodes+1);
+    to_pos.reserve(n_nodes+(2*ktn.n_edges)); cum_t.reserve(n_nodes+(2*ktn.n_edges));
+    log_t.reserve(n_nodes+(2*ktn.n_edges)); ds.reserve(n_nodes+(2*ktn.n_edges));
+    t_esc.resize(n_nodes);
+    typedef struct {
+        idx_t to_pos; long double t; long double ds;
+    } trans;
+    vector<trans> row;
+    for (const Node &node: ktn.nodes) {
+        row.clear();
+        if (node.t>0.L) row.push_back({node.node_pos,node.t,0.L}); // self-loop
+        const Edge *edgeptr = node.top_from;
+        while (edgeptr!=nullptr) {
+            if (!edgeptr->deadts && edgeptr->t>0.L) {
+                long double ds_edge;
+                if (!discretetime) { ds_edge = edgeptr->rev_edge->k-edgeptr->k;
+                } else { ds_edge = log(edgeptr->rev_edge->t/edgeptr->t); }
+                row.push_back({edgeptr->to_node->node_pos,edgeptr->t,ds_edge});
+            }
+            edgeptr=edgeptr->next_from;
+        }
+        if (row.empty()) throw Network::Network_exception();
+        stable_sort(row.begin(),row.end(),[](const trans &l, const trans &r) { return l.t>r.t; });
+        offsets[node.node_pos]=n_trans;
+        long double cum=0.L;
+        for (const trans &tr: row) {
+            cum += tr.t;
+            to_pos.push_back(tr.to_pos); cum_t.push_back(static_cast<double>(cum));
+            log_t.push_back(log(tr.t)); ds.push_back(tr.ds);
+            n_trans++;
+        }
+        t_esc[node.node_pos]=node.t_esc;
+    }
+    offsets[n_nodes]=n_trans;
+}
+
+Compiled_Network::~Compiled_Network() {}
+
+/* construct the alias tables used to sample the initial node of a trajectory. If the set B is specified, there is a single table
+   for B. Otherwise (e.g. in dimensionality reduction simulations), there is a table for each community. The probability
+   distribution is the local equilibrium within the set, or else the specified initial condition for B */
+void Network::setup_init_tables() {
+
+    cout << "network> constructing tables to sample initial nodes of trajectories" << endl;
+    vector<vector<const Node*>> sets;
+    if (!nodesB.empty()) {
+        sets.push_back(vector<const Node*>(nodesB.begin(),nodesB.end()));
+    } else if (ncomms>0) {
+        sets.resize(ncomms);
+        for (const Node &node: nodes) {
+            if (node.comm_id>=0) sets[node.comm_id].push_back(&node); }
+    }
+    init_tables.clear(); init_tables.reserve(sets.size());
+    for (const vector<const Node*> &nodes_set: sets) {
+        vector<long double> probs(nodes_set.size());
+        long double pi_set;
+        if (nodes_set.size()==1) {
+            probs[0]=1.L; pi_set=nodes_set[0]->pi;
+        } else if (initcond && !nodesB.empty()) { // for specified initial condition, sum of probabilities is unity
+            for (idx_t i=0;i<nodes_set.size();i++) probs[i]=init_probs[i];
+            pi_set=0.L;
+        } else { // local equilibrium within the set
+            pi_set=-numeric_limits<long double>::infinity();
+            for (const Node *nodeptr: nodes_set) {
+                if (nodeptr->pi>pi_set) pi_set=nodeptr->pi; }
+            long double sum_p=0.L;
+            for (const Node *nodeptr: nodes_set) sum_p+=exp(nodeptr->pi-pi_set);
+            pi_set+=log(sum_p);
+            for (idx_t i=0;i<nodes_set.size();i++) probs[i]=exp(nodes_set[i]->pi-pi_set);
+        }
+        init_tables.emplace_back(Alias_Table(nodes_set,probs,pi_set));
+    }
+}
+
+/* construct alias table by Vose's algorithm. The probabilities are normalised */
+Alias_Table::Alias_Table(const vector<const Node*> &nodes, const vector<long double> &probs, long double pi_set) {
+
+    if (nodes.size()!=probs.size()) throw Network::Network_exception();
+    this->nodes=nodes; this->pi_set=pi_set;
+    idx_t n=nodes.size();
+    prob.resize(n); alias.resize(n);
+    long double sum_p=0.L;
+    for (const long double p: probs) sum_p+=p;
+    vector<long double> q(n); // probabilities scaled by the number of nodes
+    vector<idx_t> small, large;
+    for (idx_t i=0;i<n;i++) {
+        q[i]=probs[i]*static_cast<long double>(n)/sum_p;
+        if (q[i]<1.L) { small.push_back(i); } else { large.push_back(i); }
+    }
+    while (!small.empty() && !large.empty()) {
+        idx_t s=small.back(), l=large.back();
+        small.pop_back(); large.pop_back();
+        prob[s]=q[s]; alias[s]=l;
+        q[l]=(q[l]+q[s])-1.L;
+        if (q[l]<1.L) { small.push_back(l); } else { large.push_back(l); }
+    }
+    // remaining entries have a scaled probability of unity (up to roundoff)
+    for (const idx_t l: large) { prob[l]=1.; alias[l]=l; }
+    for (const idx_t s: small) { prob[s]=1.; alias[s]=s; }
+}
+
+const Node *Alias_Table::sample(double rand_no) const {
+    if (nodes.empty()) throw Network::Network_exception();
+    double x=rand_no*static_cast<double>(nodes.size());
+    idx_t i=static_cast<idx_t>(x);
+    if (i>=nodes.size()) i=nodes.size()-1;
+    if (x-static_cast<double>(i)<prob[i]) return nodes[i];
+    return nodes[alias[i]];
+}
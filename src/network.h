@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define __NETWORK_H_INCLUDED__
 
 #include <set>
+#include <atomic>
 #include <exception>
 #include <vector>
 #include <iostream>
@@ -31,14 +32,68 @@ using namespace std;
 class Discotress;
 
 struct Node;
+struct Compiled_Network;
 
+/* floating-point type used to store the probabilities, rates and times of the nodes and edges of a network. This is long double
+   by default, and double if compiled with -DDISCOTRESS_DOUBLE, which halves the memory of the network and allows faster
+   (non-x87) arithmetic in the kMC kernels. Quantities accumulated along paths (Walker) and the renormalisation factors of the
+   graph transformation (calc_gt_factor) are always evaluated in long double */
+#ifdef DISCOTRESS_DOUBLE
+typedef double real_t;
+#else
+typedef long double real_t;
+#endif
+
+/* integer type used for the IDs and positions of nodes and edges, and for the numbers of nodes and edges, of a network. This is
+   int by default, and long long int if compiled with -DDISCOTRESS_INDEX64, which is needed for networks with more than ~10^9
+   (bidirectional) edges, since the edges vector contains an entry for each direction of each edge */
+#ifdef DISCOTRESS_INDEX64
+typedef long long int idx_t;
+#else
+typedef int idx_t;
+#endif
+
+/* accounting of the memory held by the main data structures of a computation (nodes and edges of Network objects, and the path
+   tables of the REA), by component. The current and peak usage of each component and in total are tracked, summed over threads,
+   and are compared against the optional memory budget */
+struct Mem_Accounting {
+
+    public:
+
+    enum Component { NETWORK, KTN_KPS, KTN_KPS_ORIG, KTN_L, KTN_U, KTN_KPS_GT, REA_SHORTEST_PATHS, REA_CANDIDATE_PATHS, \
+                     UNIF_MATRIX, SPECTRAL_BASIS, NCOMPONENTS };
+    static const char *names[NCOMPONENTS];
+    static atomic<long long int> curr[NCOMPONENTS], peak[NCOMPONENTS]; // current and peak memory of each component (bytes)
+    static atomic<long long int> curr_tot, peak_tot; // current and peak memory in total (bytes)
+    static atomic<unsigned long long int> n_limited; // no. of kPS basins that were reduced in size to fit in the budget
+    static long long int budget; // memory budget (bytes), or zero if unlimited
+
+    static void alloc(int,long long int); // record change in memory held by a component (negative if memory is released)
+    static long long int available(); // memory remaining within the budget (bytes)
+    static void print_report();
+};
+
+/* alias table (Walker's alias method, using Vose's construction) to sample a node from a fixed probability distribution over a
+   set of nodes in constant time. Used to sample the initial nodes of trajectories */
+struct Alias_Table {
+
+    public:
+
+    Alias_Table() {}
+    Alias_Table(const vector<const Node*>&,const vector<long double>&,long double);
+    const Node *sample(double) const; // return the node corresponding to a uniform random number in [0,1)
+
+    vector<const Node*> nodes; // nodes of the set
+    vector<double> prob;       // probability of accepting the i-th node when the i-th bin is chosen (otherwise the alias node is chosen)
+    vector<idx_t> alias;       // index of the alias node for the i-th bin
+    long double pi_set;        // normalisation (log) probability for the set, used for the initial path probability
+};
+
+/* note that the fields of nodes and edges that are used only in kPS are stored separately, in the KPS_Fields of the subnetwork */
 struct Edge {
-    int edge_id; // position of the TS in the edges vector
-    unsigned long long int h=0; // no. of kMC moves along the edge (used in kPS)
-    int label=0; // label indicates node ID of GT iteration at which edge becomes dead (in kPS)
-    long double k; // (log) transition rate
-    long double t; // transition probability
-    long double dt; // change in transition probability (used in kPS)
+    idx_t edge_id; // position of the TS in the edges vector
+    real_t k; // (log) transition rate
+    real_t t; // transition probability
     bool deadts=false; // indicates that edge is redundant or otherwise deleted from the network
     Node *to_node=nullptr;
     Node *from_node=nullptr;
@@ -47,32 +102,29 @@ struct Edge {
     Edge *rev_edge=nullptr; // reverse edge (all edges are bidirectional)
 
     inline Edge operator+(const Edge& other_edge) const {
-        Edge new_edge{.edge_id=edge_id, .h=h+other_edge.h, .label=other_edge.label, .k=k+other_edge.k, \
-            .t=t+other_edge.t, .dt=dt+other_edge.dt, .deadts=deadts, .to_node=to_node, \
+        Edge new_edge{.edge_id=edge_id, .k=k+other_edge.k, .t=t+other_edge.t, .deadts=deadts, .to_node=to_node, \
             .from_node=from_node, .next_to=next_to, .next_from=next_from, .rev_edge=rev_edge};
         return new_edge;
     }
 
     inline Edge& operator=(const Edge& other_edge) {
-        edge_id=other_edge.edge_id; label=other_edge.label;
+        edge_id=other_edge.edge_id;
         k=other_edge.k; t=other_edge.t; deadts=other_edge.deadts;
+        return *this;
     }
 };
 
 struct Node {
-    int node_id;
-    int node_pos; // position of node in nodes vector of Network (needed in kPS, where a subnetwork is copied)
+    idx_t node_id;
+    idx_t node_pos; // position of node in nodes vector of Network (needed in kPS, where a subnetwork is copied)
     int comm_id = -1; // community ID (-1 indicates null value)
     int bin_id = -1; // bin ID (for calculating TP statistics) (-1 indicates null value)
     int aorb = 0; // indicates set to which node belongs: -1 for A, +1 for B, 0 for I
     int udeg = 0; // (unweighted) node (out-) degree
     bool eliminated = false; // node has been eliminated from the network (in graph transformation) (or otherwise deleted)
-    long double t_esc; // mean waiting time for escape from node
-    long double t; // self-transition probability
-    long double pi; // (log) occupation probability (usually the stationary/equilibrium probability)
-    unsigned long long int h=0; // no. of kMC moves along the self-loop "edge" (used in kPS)
-    long double dt; // change in transition probability (used in kPS)
-    bool flag=false; // additional flag variable
+    real_t t_esc; // mean waiting time for escape from node
+    real_t t; // self-transition probability
+    real_t pi; // (log) occupation probability (usually the stationary/equilibrium probability)
     Edge *top_to=nullptr;
     Edge *top_from=nullptr;
 
@@ -94,9 +146,26 @@ struct Node {
         comm_id=other_node.comm_id; bin_id=other_node.bin_id; udeg=0;
         aorb=other_node.aorb; eliminated=other_node.eliminated;
         t_esc=other_node.t_esc; t=other_node.t; pi=other_node.pi;
+        return *this;
     }
 };
 
+/* fields of the nodes and edges of a subnetwork that are used only in kPS, stored in arrays indexed by the position of the node, or
+   the ID of the edge, in the subnetwork. These are kept separate from the Node and Edge objects so that the main network, which is
+   traversed in every kMC step, contains only the fields needed for sampling */
+struct KPS_Fields {
+    vector<unsigned long long int> node_h; // no. of kMC moves along the self-loop "edge" of each node
+    vector<unsigned long long int> edge_h; // no. of kMC moves along each edge
+    vector<real_t> node_dt, edge_dt; // change in transition probability of the self-loop of each node / of each edge
+    vector<idx_t> edge_label; // node ID of GT iteration at which each edge becomes dead
+    vector<char> node_flag; // flag for each node (indicates a neighbour of the node being (un-)eliminated in GT)
+
+    void resize(size_t,size_t);
+    long long int bytes() const;
+    static constexpr long long int node_bytes = sizeof(unsigned long long int)+sizeof(real_t)+sizeof(char);
+    static constexpr long long int edge_bytes = sizeof(unsigned long long int)+sizeof(real_t)+sizeof(idx_t);
+};
+
 /* structure representing the Markovian network */
 struct Network {
 
@@ -104,19 +173,19 @@ struct Network {
 
     public:
 
-    Network(int,int);
+    Network(idx_t,idx_t);
     ~Network();
     Network(const Network&);
 
-    void del_node(int);
-    void add_to_edge(int,int);
-    void add_from_edge(int,int);
-    void del_to_edge(int);
-    void del_from_edge(int);
-    void del_spec_to_edge(int,int);
-    void del_spec_from_edge(int,int);
-    void update_to_edge(int,int);
-    void update_from_edge(int,int);
+    void del_node(idx_t);
+    void add_to_edge(idx_t,idx_t);
+    void add_from_edge(idx_t,idx_t);
+    void del_to_edge(idx_t);
+    void del_from_edge(idx_t);
+    void del_spec_to_edge(idx_t,idx_t);
+    void del_spec_from_edge(idx_t,idx_t);
+    void update_to_edge(idx_t,idx_t);
+    void update_from_edge(idx_t,idx_t);
     static long double calc_gt_factor(const Node&); // calc (1-T_{nn})^{-1} factors needed in graph transformation
     static void calc_t_esc(Node&);
     static void calc_t_selfloop(Node&);
@@ -127,9 +196,12 @@ struct Network {
     void set_accumprobs(); // set transition probabilities to accumulated branching probability values (for optimisation in kMC)
     void renormalize_selfloops(); // (for a DTMC) renormalize escape (lag) times and outgoing transition probs to subsume self-loops
     void set_initcond(const vector<double>&); // set initial probabilities for nodes in set B
-    static void add_edge_network(Network*,Node&,Node&,int);
-    static void setup_network(Network&,const vector<pair<int,int>>&,const vector<pair<long double,long double>>&, \
-        const vector<long double>&,const vector<int>&,const vector<int>&,bool,bool,bool,long double,int,const vector<int>& = {}, \
+    void check_detailed_balance(); // validate that the Markov chain is reversible with respect to the stationary distribution
+    void compile(bool); // construct the compact array-based representation of the transition probability matrix
+    void setup_init_tables(); // construct the alias tables used to sample the initial nodes of trajectories
+    static void add_edge_network(Network*,Node&,Node&,idx_t);
+    static void setup_network(Network&,const vector<pair<idx_t,idx_t>>&,const vector<pair<long double,long double>>&, \
+        const vector<long double>&,const vector<idx_t>&,const vector<idx_t>&,bool,bool,bool,long double,int,const vector<int>& = {}, \
         const vector<int>& = {});
 
     vector<Node> nodes;
@@ -139,9 +211,9 @@ struct Network {
         const char * what () const throw () { return "network> fatal error in Network object"; }
     };
 
-    int n_nodes, n_edges; // number of nodes and bidirectional edges (not including self-loops)
-    int tot_nodes=0, tot_edges=0;
-    int n_dead=0; // number of dead/deleted edges
+    idx_t n_nodes, n_edges; // number of nodes and bidirectional edges (not including self-loops)
+    idx_t tot_nodes=0, tot_edges=0;
+    idx_t n_dead=0; // number of dead/deleted edges
     int ncomms; // total number of communities
     int nbins=0; // total number of bins
     set<const Node*> nodesA, nodesB; // A and B endpoint nodes (A<-B)
@@ -151,6 +223,14 @@ struct Network {
     bool accumprobs=false; // transition probabilities are accumulated values (Y/N)
     bool initcond=false; // nodes in set B have initial probabilities different to their equilibrium values (Y/N)
     long double tau=0.; // lag time at which transition probabilities are calculated
+    Compiled_Network *cktn=nullptr; // compact array-based representation of the network (not copied by the copy constructor)
+    KPS_Fields *kps_fields=nullptr; // fields of nodes and edges used only in kPS (allocated only for kPS subnetworks)
+    vector<Alias_Table> init_tables; // tables to sample initial nodes: for the B set if specified, otherwise for each community
+    int mem_comp=-1; // component of memory accounting to which the nodes and edges are assigned (-1 if not tracked)
+    long long int mem_bytes=0; // memory of the nodes and edges currently recorded in the accounting (bytes)
+
+    void alloc_kps_fields(); // allocate the kPS-only fields for all nodes and entries of the edges vector
+    void account_mem(int); // update the memory recorded for the nodes and edges, assigned to the specified component
 
     inline Network& operator=(const Network& other_network) {
         cout << "called assignment operator for Network" << endl;
@@ -162,4 +242,24 @@ struct Network {
 
 };
 
+/* compact array-based (compressed sparse row) representation of the transition probability matrix of a Network, used by
+   batched kMC engines. The transitions from each node, including the self-loop, are stored contiguously in order of
+   decreasing transition probability, so that a transition is selected by a short scan over the accumulated probabilities */
+struct Compiled_Network {
+
+    public:
+
+    Compiled_Network(const Network&,bool);
+    ~Compiled_Network();
+
+    idx_t n_nodes;
+    idx_t n_trans;              // total number of stored transitions (including self-loops)
+    vector<idx_t> offsets;      // transitions from the i-th node are stored at positions offsets[i] to offsets[i+1]-1
+    vector<idx_t> to_pos;       // positions (in the nodes vector of the Network) of the nodes to which the transitions lead
+    vector<double> cum_t;       // accumulated transition probabilities along the row for each node
+    vector<real_t> log_t;       // (log) transition probabilities
+    vector<real_t> ds;          // contribution of each transition to the entropy flow along a path
+    vector<real_t> t_esc;       // mean waiting times for nodes
+};
+
 #endif
@@ -25,12 +25,178 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <cmath>
+#include <omp.h>
+#include <tuple>
+#include <fstream>
+#include <iostream>
 
 using namespace std;
 
-NEUS::NEUS(const Network &ktn, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {}
+/* the communities define the regions to which walkers are restrained. The entry points of each region are initially
+   sampled from a local equilibrium within the nodes of the region that are not in A */
+NEUS::NEUS(const Network &ktn, double taure, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    nwalkers_comm=walkers.size()/ktn.ncomms;
+    cout << "neus> running NEUS-kMC with parameters:\n  time between updates of weights: " << taure << " \tno. of regions: " \
+         << ktn.ncomms << " \tno. of walkers in each region: " << nwalkers_comm << endl;
+    this->taure=taure;
+    for (int i=0;i<walkers.size();i++) walkers[i].walker_id=i/nwalkers_comm;
+    active_comms.assign(ktn.ncomms,false); comm_wts.assign(ktn.ncomms,0.L); comm_times.assign(ktn.ncomms,0.L);
+    n_exits.assign(ktn.ncomms,vector<unsigned long long int>(ktn.ncomms,0)); n_exits_a.assign(ktn.ncomms,0);
+    entries.resize(ktn.ncomms); entry_tables.resize(ktn.ncomms);
+    vector<vector<const Node*>> comm_nodes(ktn.ncomms);
+    for (const Node &node: ktn.nodes) {
+        if (node.aorb!=-1) comm_nodes[node.comm_id].push_back(&node); }
+    int n_active=0;
+    for (int i=0;i<ktn.ncomms;i++) {
+        if (comm_nodes[i].empty()) continue;
+        active_comms[i]=true; n_active++;
+        long double pi_max=-numeric_limits<long double>::infinity();
+        for (const Node *node: comm_nodes[i]) pi_max=max(pi_max,(long double)node->pi);
+        vector<long double> probs;
+        for (const Node *node: comm_nodes[i]) probs.push_back(exp(node->pi-pi_max));
+        entry_tables[i]=Alias_Table(comm_nodes[i],probs,0.L);
+    }
+    for (int i=0;i<ktn.ncomms;i++) { if (active_comms[i]) comm_wts[i]=1.L/static_cast<long double>(n_active); }
+}
+
 NEUS::~NEUS() {}
 
+/* main loop of NEUS-kMC. The walkers of each region are propagated in parallel for a time interval. When a walker leaves its
+   region, the exit is recorded as an entry point of the region that is entered, and the walker is restarted from an entry point of
+   its own region. A walker that enters A is recycled to B, so that the simulation estimates the nonequilibrium steady state
+   for the A<-B transition. After each time interval, the region weights are determined from the matrix of inter-region fluxes,
+   and the distributions of entry points are reweighted accordingly */
 void NEUS::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
+    cout << "\n\nneus> beginning NEUS-kMC simulation" << endl;
+    n_ab=0; int n_it=0;
+    typedef tuple<int,int,int,bool> Exit_event; // source region, entered region, position of entry node, and if walker entered A
+    for (auto &walker: walkers) {
+        if (!active_comms[walker.walker_id]) continue;
+        walker.curr_node=entry_tables[walker.walker_id].sample(rand_unif_met(seed));
+        walker.prev_node=walker.curr_node; walker.p=0.L;
+    }
+    long double tau_r=static_cast<long double>(taure); // next time for updating weights
+    long double flux_a=0.L; // steady state flux into A
+    ofstream neus_f; neus_f.open("neus.dat");
+    neus_f.setf(ios::right,ios::adjustfield); neus_f.setf(ios::scientific,ios::floatfield);
+    neus_f.precision(10);
+    while ((n_ab<nabpaths) and (n_it<maxit)) {
+        vector<Exit_event> exit_events;
+        #pragma omp parallel
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+        vector<Exit_event> exit_events_local;
+        vector<long double> comm_times_local(ktn.ncomms,0.L);
+        #pragma omp for schedule(dynamic,64)
+        for (int i=0;i<walkers.size();i++) {
+            Walker &walker=walkers[i];
+            int comm_id=walker.walker_id;
+            if (!active_comms[comm_id]) continue;
+            long double t_start=walker.t;
+            while (walker.t<tau_r) {
+                traj_method_local->kmc_iteration(ktn,walker);
+                if (walker.curr_node->aorb==-1) { // recycle into B, the entry point is sampled from the initial distribution
+                    const Node *node_b = ktn.init_tables[0].sample(rand_unif_met(seed));
+                    exit_events_local.emplace_back(make_tuple(comm_id,node_b->comm_id,node_b->node_pos,true));
+                } else if (walker.curr_node->comm_id!=comm_id) {
+                    exit_events_local.emplace_back(make_tuple(comm_id,walker.curr_node->comm_id,walker.curr_node->node_pos,false));
+                } else { continue; }
+                // walker is restrained to its region, restart from an entry point
+                walker.curr_node=entry_tables[comm_id].sample(rand_unif_met(seed));
+                walker.prev_node=walker.curr_node;
+            }
+            comm_times_local[comm_id]+=walker.t-t_start;
+        }
+        #pragma omp critical
+        {
+        exit_events.insert(exit_events.end(),exit_events_local.begin(),exit_events_local.end());
+        for (int j=0;j<ktn.ncomms;j++) comm_times[j]+=comm_times_local[j];
+        }
+        delete traj_method_local;
+        }
+        int n_ab_it=0;
+        for (const Exit_event &exit_event: exit_events) {
+            int comm_from=get<0>(exit_event), comm_to=get<1>(exit_event);
+            n_exits[comm_from][comm_to]++;
+            if (get<3>(exit_event)) { n_exits_a[comm_from]++; n_ab_it++; }
+            entries[comm_to][(static_cast<long long int>(comm_from)*ktn.n_nodes)+get<2>(exit_event)]++;
+        }
+        n_ab+=n_ab_it; n_it++;
+        update_weights();
+        update_entry_tables(ktn);
+        flux_a=calc_flux_a();
+        neus_f << setw(10) << n_it << setw(20) << tau_r << setw(20) << flux_a << setw(10) << n_ab_it << endl;
+        if (debug) cout << "neus> iteration: " << n_it << " time: " << tau_r << " flux into A: " << flux_a << endl;
+        tau_r += taure;
+    }
+    neus_f.close();
+    ofstream wts_f; wts_f.open("neus_weights.dat");
+    wts_f.setf(ios::scientific,ios::floatfield); wts_f.precision(10);
+    for (int i=0;i<ktn.ncomms;i++) wts_f << setw(7) << i << setw(20) << comm_wts[i] << endl;
+    wts_f.close();
+    cout << "neus> finished NEUS-kMC simulation after " << n_it << " iterations. No. of entries into A: " << n_ab << endl;
+    cout << "neus> steady state A<-B flux (rate constant): " << flux_a << " \tMFPT: " << 1.L/flux_a << endl;
+}
+
+/* the region weights are the stationary distribution of the rate matrix for transitions between regions, estimated from the numbers
+   of exits from each region per unit time simulated in that region. If the rate matrix is not yet well-defined (ie the linear
+   system is singular), then the weights are not updated */
+void NEUS::update_weights() {
+
+    vector<int> active_ids; // IDs of active regions
+    for (int i=0;i<active_comms.size();i++) { if (active_comms[i]) active_ids.push_back(i); }
+    int n=active_ids.size();
+    // equations for the transpose of the rate matrix, with the last equation replaced by the normalisation condition
+    vector<vector<long double>> q(n,vector<long double>(n,0.L));
+    for (int j=0;j<n;j++) {
+        int comm_from=active_ids[j];
+        if (comm_times[comm_from]==0.L) return;
+        for (int i=0;i<n;i++) {
+            if (i==j) continue;
+            long double k=static_cast<long double>(n_exits[comm_from][active_ids[i]])/comm_times[comm_from];
+            q[i][j]+=k; q[j][j]-=k;
+        }
+    }
+    vector<long double> wts(n,0.L); wts[n-1]=1.L;
+    fill(q[n-1].begin(),q[n-1].end(),1.L);
+    if (!solve_linear_system(q,wts)) return;
+    for (int i=0;i<n;i++) comm_wts[active_ids[i]]=max(wts[i],0.L);
+}
+
+/* the probability of an entry point of a region is proportional to the sum, over the source regions, of the weight of the
+   source region multiplied by the number of entries per unit time simulated in the source region */
+void NEUS::update_entry_tables(const Network &ktn) {
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0;i<ktn.ncomms;i++) {
+        if (!active_comms[i] || entries[i].empty()) continue;
+        unordered_map<idx_t,long double> entry_probs; // probabilities of entry points, keyed by node position
+        for (const auto &entry: entries[i]) {
+            int comm_from=entry.first/ktn.n_nodes;
+            idx_t pos=entry.first%ktn.n_nodes;
+            entry_probs[pos]+=comm_wts[comm_from]*static_cast<long double>(entry.second)/comm_times[comm_from];
+        }
+        vector<const Node*> entry_nodes; vector<long double> probs;
+        long double sum_p=0.L;
+        for (const auto &entry_prob: entry_probs) {
+            if (!(entry_prob.second>0.L)) continue;
+            entry_nodes.push_back(&ktn.nodes[entry_prob.first]); probs.push_back(entry_prob.second);
+            sum_p+=entry_prob.second;
+        }
+        if (sum_p>0.L) entry_tables[i]=Alias_Table(entry_nodes,probs,0.L);
+    }
+}
+
+/* steady state flux into A, ie the sum over regions of the region weight multiplied by the rate of entering A from the region */
+long double NEUS::calc_flux_a() {
+
+    long double flux_a=0.L;
+    for (int i=0;i<active_comms.size();i++) {
+        if (!active_comms[i] || comm_times[i]==0.L) continue;
+        flux_a+=comm_wts[i]*static_cast<long double>(n_exits_a[i])/comm_times[i];
+    }
+    return flux_a;
 }
@@ -0,0 +1,262 @@
+/*
+Low-overhead instrumentation of the hot paths of a simulation, with per-thread timers for the phases of the trajectory methods and
+per-thread counters of events (kMC steps, basin escapes, fill-in edges created by the graph transformation, and completed paths).
+
+The instrumentation is enabled by compiling with the flag -DDISCOTRESS_PROFILE. Otherwise, the PROF_ macros expand to nothing, so
+that there is no overhead. When enabled, a report is written to the file profile.dat at exit and, if the PROFILEINTVL keyword is
+set, every PROFILEINTVL seconds of wall time during the simulation.
+
+Optionally (keyword TRACE), begin/end events are also recorded for each thread, for the phases above, for each path (or block of
+walkers) and basin escape, and for waits at barriers and critical sections. The events are stored in a ring buffer for each thread,
+which is written only by the thread that owns it, so no locking is required (the oldest events are overwritten if the buffer is
+full). The events are written at exit to the file trace.json in the Chrome trace event format, which can be viewed in standard
+trace viewers (e.g. chrome://tracing or Perfetto).
+
+The timers are exclusive, i.e. the time spent in a nested phase (e.g. get_subnetwork() within graph_transformation()) is
+not included in the time for the enclosing phase. Each thread writes only to its own accumulators, which are relaxed atomics so
+that the periodic report can be written safely while the simulation is running, without the cost of locked instructions.
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PROFILE_H_INCLUDED__
+#define __PROFILE_H_INCLUDED__
+
+#ifdef DISCOTRESS_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <omp.h>
+
+using namespace std;
+
+/* phases of the simulation that are timed */
+enum Prof_Phase { PROF_NONE=-1, PROF_SETUP_BASIN, PROF_SUBNETWORK, PROF_GT, PROF_SAMPLE_ABSORBING, PROF_IRR, PROF_UPDATE_PATH, \
+                  PROF_BKL, PROF_MCAMC_FACTORISE, PROF_MCAMC_ESCAPE, PROF_UNIF_MATVEC, PROF_OUTPUT, PROF_NPHASES };
+
+/* events that are counted */
+enum Prof_Counter { PROF_BKL_STEPS, PROF_ESCAPES, PROF_FILLIN_EDGES, PROF_PATHS, PROF_NCOUNTERS };
+
+/* a complete event (with a begin time and duration) for the trace */
+struct Trace_Event {
+    const char *name;
+    long long int ts_ns, dur_ns; // begin time (relative to start of program) and duration (ns)
+};
+
+/* accumulators for a single thread, padded to a cache line to avoid false sharing between threads */
+struct alignas(64) Prof_Thread_Data {
+    atomic<long long int> time_ns[PROF_NPHASES]; // exclusive time spent in each phase (ns)
+    atomic<unsigned long long int> calls[PROF_NPHASES]; // no. of entries into each phase
+    atomic<unsigned long long int> counts[PROF_NCOUNTERS]; // event counts
+    int curr_phase=PROF_NONE; // phase that the thread is currently in
+    vector<Trace_Event> trace; // ring buffer of trace events
+    unsigned long long int n_trace=0; // total no. of trace events recorded by the thread
+
+    Prof_Thread_Data() {
+        for (int i=0;i<PROF_NPHASES;i++) { time_ns[i]=0; calls[i]=0; }
+        for (int i=0;i<PROF_NCOUNTERS;i++) counts[i]=0;
+    }
+};
+
+class Profiler {
+
+    public:
+
+    static inline vector<Prof_Thread_Data> threads;
+    static inline chrono::steady_clock::time_point start_time, next_report;
+    static inline double report_intvl=-1.; // interval (s) for writing the periodic report (<=0 if not written periodically)
+    static inline bool tracing=false; // trace events are recorded
+
+    static constexpr const char *phase_names[PROF_NPHASES] = {"setup_basin_sets","get_subnetwork","graph_transformation", \
+        "sample_absorbing_node","iterative_reverse_randomisation","update_path_quantities","bkl_steps","mcamc_factorise", \
+        "mcamc_escape","unif_matvec","output"};
+    static constexpr const char *counter_names[PROF_NCOUNTERS] = {"bkl_steps","escapes","fillin_edges","paths"};
+
+    /* relaxed increment, which is safe since each accumulator is written only by the thread that owns it */
+    template<typename T>
+    static inline void incr(atomic<T> &x, T n) { x.store(x.load(memory_order_relaxed)+n,memory_order_relaxed); }
+
+    static void start(double intvl, int tracebuf) {
+        threads = vector<Prof_Thread_Data>(omp_get_max_threads());
+        if (tracebuf>0) {
+            tracing=true;
+            for (Prof_Thread_Data &td: threads) td.trace.resize(tracebuf);
+        }
+        report_intvl=intvl;
+        start_time=chrono::steady_clock::now();
+        next_report=start_time+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(intvl));
+        cout << "profile> instrumentation is enabled, the report will be written to profile.dat";
+        if (intvl>0.) cout << " every " << intvl << " s";
+        if (tracing) cout << "\nprofile> trace events will be written to trace.json (max. " << tracebuf << " events per thread)";
+        cout << endl;
+    }
+
+    /* add an event to the trace buffer of the calling thread */
+    static inline void trace_event(const char *name, chrono::steady_clock::time_point t0, chrono::steady_clock::time_point t1) {
+        Prof_Thread_Data &td = threads[omp_get_thread_num()];
+        td.trace[td.n_trace++%td.trace.size()] = {name,chrono::duration_cast<chrono::nanoseconds>(t0-start_time).count(), \
+                                                  chrono::duration_cast<chrono::nanoseconds>(t1-t0).count()};
+    }
+
+    /* write the trace events of all threads to a file in the Chrome trace event format (times in microseconds). Must be called
+       outside of any parallel region */
+    static void write_trace() {
+        if (!tracing) return;
+        ofstream trace_f("trace.json");
+        trace_f << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" << fixed << setprecision(3);
+        unsigned long long int n_dropped=0;
+        for (int t=0;t<threads.size();t++) {
+            const Prof_Thread_Data &td = threads[t];
+            trace_f << (t>0?",\n":"") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t \
+                    << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+            unsigned long long int n=min<unsigned long long int>(td.n_trace,td.trace.size());
+            n_dropped+=td.n_trace-n;
+            for (unsigned long long int i=td.n_trace-n;i<td.n_trace;i++) { // in order of recording, oldest first
+                const Trace_Event &ev = td.trace[i%td.trace.size()];
+                trace_f << ",\n{\"name\":\"" << ev.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t << ",\"ts\":" \
+                        << ev.ts_ns*1.e-3 << ",\"dur\":" << ev.dur_ns*1.e-3 << "}";
+            }
+        }
+        trace_f << "\n],\"otherData\":{\"dropped_events\":" << n_dropped << "}}" << endl;
+        cout << "profile> wrote trace events to trace.json";
+        if (n_dropped>0) cout << ". " << n_dropped << " oldest events were overwritten, increase the TRACE buffer size to retain them";
+        cout << endl;
+    }
+
+    static inline void count(Prof_Counter counter, unsigned long long int n) {
+        incr(threads[omp_get_thread_num()].counts[counter],n); }
+
+    /* write the report if the interval for the periodic report has elapsed (checked only by the master thread) */
+    static inline void check_report(chrono::steady_clock::time_point now) {
+        if (report_intvl>0. && now>=next_report && omp_get_thread_num()==0) {
+            next_report=now+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(report_intvl));
+            write_report(false);
+        }
+    }
+
+    /* write the report. For each phase and counter, the total over threads is given, followed by the values for each thread. The
+       load balance is the ratio of the mean to the maximum over threads of the instrumented time */
+    static void write_report(bool final) {
+        double walltime = chrono::duration<double>(chrono::steady_clock::now()-start_time).count();
+        int nthreads=threads.size();
+        ofstream prof_f("profile.dat.tmp");
+        prof_f << "# DISCOTRESS profile report (" << (final?"final":"in progress") << ")\n";
+        prof_f << "walltime " << fixed << setprecision(6) << walltime << "\nnthreads " << nthreads << "\n";
+        prof_f << "# counter / total / rate (per s of wall time) / values for each thread\n";
+        for (int c=0;c<PROF_NCOUNTERS;c++) {
+            unsigned long long int tot=0;
+            for (const Prof_Thread_Data &td: threads) tot+=td.counts[c].load(memory_order_relaxed);
+            prof_f << "count " << counter_names[c] << " " << tot << " " << setprecision(3) << tot/walltime;
+            for (const Prof_Thread_Data &td: threads) prof_f << " " << td.counts[c].load(memory_order_relaxed);
+            prof_f << "\n";
+        }
+        prof_f << "# phase / total time (s) / fraction of instrumented time / no. of calls / times (s) for each thread\n";
+        vector<double> thread_times(nthreads,0.);
+        double tot_time=0.;
+        for (int t=0;t<nthreads;t++) {
+            for (int p=0;p<PROF_NPHASES;p++) thread_times[t]+=threads[t].time_ns[p].load(memory_order_relaxed)*1.e-9; }
+        for (double t: thread_times) tot_time+=t;
+        for (int p=0;p<PROF_NPHASES;p++) {
+            double phase_time=0.; unsigned long long int ncalls=0;
+            for (const Prof_Thread_Data &td: threads) {
+                phase_time+=td.time_ns[p].load(memory_order_relaxed)*1.e-9; ncalls+=td.calls[p].load(memory_order_relaxed); }
+            prof_f << "phase " << phase_names[p] << " " << setprecision(6) << phase_time << " " << setprecision(4) \
+                   << (tot_time>0.?phase_time/tot_time:0.) << " " << ncalls << setprecision(6);
+            for (const Prof_Thread_Data &td: threads) prof_f << " " << td.time_ns[p].load(memory_order_relaxed)*1.e-9;
+            prof_f << "\n";
+        }
+        double max_time=*max_element(thread_times.begin(),thread_times.end());
+        prof_f << "# load balance (mean / max instrumented time per thread, unity is perfect balance)\n";
+        prof_f << "loadbalance " << setprecision(4) << (max_time>0.?tot_time/(nthreads*max_time):1.) << "\n";
+        prof_f.close();
+        rename("profile.dat.tmp","profile.dat");
+        if (final) cout << "profile> wrote profile report to profile.dat. Wall time: " << walltime << " s" << endl;
+    }
+};
+
+/* scoped timer, which adds the elapsed time to the accumulator for the phase and subtracts it from the enclosing phase */
+class Prof_Timer {
+
+    private:
+
+    Prof_Thread_Data &td;
+    Prof_Phase phase;
+    int parent;
+    chrono::steady_clock::time_point t0;
+
+    public:
+
+    Prof_Timer(Prof_Phase phase) : td(Profiler::threads[omp_get_thread_num()]), phase(phase) {
+        parent=td.curr_phase; td.curr_phase=phase;
+        t0=chrono::steady_clock::now();
+    }
+    ~Prof_Timer() {
+        chrono::steady_clock::time_point t1=chrono::steady_clock::now();
+        long long int dt=chrono::duration_cast<chrono::nanoseconds>(t1-t0).count();
+        Profiler::incr(td.time_ns[phase],dt); Profiler::incr(td.calls[phase],1ULL);
+        if (parent!=PROF_NONE) Profiler::incr(td.time_ns[parent],-dt);
+        td.curr_phase=parent;
+        if (Profiler::tracing) Profiler::trace_event(Profiler::phase_names[phase],t0,t1);
+        Profiler::check_report(t1);
+    }
+};
+
+/* scoped trace event that is not associated with a timed phase */
+class Trace_Scope {
+
+    private:
+
+    const char *name;
+    chrono::steady_clock::time_point t0;
+
+    public:
+
+    Trace_Scope(const char *name) : name(name) { if (Profiler::tracing) t0=chrono::steady_clock::now(); }
+    ~Trace_Scope() { if (Profiler::tracing) Profiler::trace_event(name,t0,chrono::steady_clock::now()); }
+};
+
+#define PROF_CONCAT_(a,b) a##b
+#define PROF_CONCAT(a,b) PROF_CONCAT_(a,b)
+#define PROF_START(intvl,tracebuf) Profiler::start(intvl,tracebuf)
+#define PROF_SCOPE(phase) Prof_Timer PROF_CONCAT(prof_timer_,__LINE__)(phase)
+#define PROF_COUNT(counter,n) Profiler::count(counter,n)
+#define PROF_REPORT() { Profiler::write_report(true); Profiler::write_trace(); }
+#define TRACE_SCOPE(name) Trace_Scope PROF_CONCAT(trace_scope_,__LINE__)(name)
+#define TRACE_MARK(var) chrono::steady_clock::time_point var; if (Profiler::tracing) var=chrono::steady_clock::now()
+#define TRACE_SINCE(name,var) if (Profiler::tracing) Profiler::trace_event(name,var,chrono::steady_clock::now())
+#define TRACE_BARRIER() { TRACE_SCOPE("barrier"); _Pragma("omp barrier") }
+
+#else
+
+#define PROF_START(intvl,tracebuf)
+#define PROF_SCOPE(phase)
+#define PROF_COUNT(counter,n)
+#define PROF_REPORT()
+#define TRACE_SCOPE(name)
+#define TRACE_MARK(var)
+#define TRACE_SINCE(name,var)
+#define TRACE_BARRIER() _Pragma("omp barrier")
+
+#endif
+
+#endif
@@ -41,8 +41,16 @@ REA::REA(const Network &ktn, bool discretetime, bool writerea, bool reanotirred,
     }
     source_node = *ktn.nodesB.begin(); // NB there is only a single source node
     sink_node = *ktn.nodesA.begin(); // NB there is only a single sink node
+    // check that the tables of shortest and candidate paths fit within the memory budget before allocating them
+    long long int sp_bytes = static_cast<long long int>(ktn.n_nodes)*(sizeof(vector<Walker>)+ \
+                             static_cast<long long int>(wrapper_args.nabpaths)*sizeof(Walker));
+    long long int cp_bytes = static_cast<long long int>(ktn.n_nodes)*sizeof(vector<pair<const Walker*,const Edge*>>)+ \
+                             2*static_cast<long long int>(ktn.n_edges)*sizeof(pair<const Walker*,const Edge*>);
+    if (sp_bytes+cp_bytes>Mem_Accounting::available()) {
+        cout << "rea> error: the tables of shortest and candidate paths require " << (sp_bytes+cp_bytes)/1.e6 \
+             << " MB, which exceeds the memory budget. Reduce NABPATHS" << endl; exit(EXIT_FAILURE); }
     shortest_paths.resize(ktn.n_nodes); candidate_paths.resize(ktn.n_nodes);
-    for (int i=0;i<ktn.n_nodes;i++) { // allocate arrays for candidate and assigned shortest paths
+    for (idx_t i=0;i<ktn.n_nodes;i++) { // allocate arrays for candidate and assigned shortest paths
         shortest_paths[i].resize(wrapper_args.nabpaths);
         for (int k=1;k<wrapper_args.nabpaths+1;k++) { // path cost is initially infinite and predecessor node not set for all paths
             /* for the REA Wrapper_Method, the members of the Walker objects are interpreted as follows:
@@ -57,9 +65,15 @@ REA::REA(const Network &ktn, bool discretetime, bool writerea, bool reanotirred,
             candidate_paths[i][j].first=nullptr; candidate_paths[i][j].second=nullptr;
         }
     }
+    Mem_Accounting::alloc(Mem_Accounting::REA_SHORTEST_PATHS,sp_bytes);
+    Mem_Accounting::alloc(Mem_Accounting::REA_CANDIDATE_PATHS,cp_bytes);
+    this->sp_bytes=sp_bytes; this->cp_bytes=cp_bytes;
 }
 
-REA::~REA() {}
+REA::~REA() {
+    Mem_Accounting::alloc(Mem_Accounting::REA_SHORTEST_PATHS,-sp_bytes);
+    Mem_Accounting::alloc(Mem_Accounting::REA_CANDIDATE_PATHS,-cp_bytes);
+}
 
 void REA::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
@@ -84,14 +98,14 @@ void REA::dijkstra(const Network& ktn) {
     const Node *curr_node=source_node;
     shortest_paths[curr_node->node_id-1][0].p=0.L;
     // main loop for Dijkstra's algorithm
-    for (int i=0;i<ktn.n_nodes;i++) {
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
 	if (debug) cout << "iter: " << i+1 << "    curr_node: " << curr_node->node_id << endl;
         const Edge *edgeptr=curr_node->top_from;
-        int n=curr_node->node_id-1;
+        idx_t n=curr_node->node_id-1;
         insptree[n]=true;
 	if (*curr_node==*sink_node) goto find_next_node; // sink_node cannot be a predecessor of any other node in the shortest path tree, skip
         while (edgeptr!=nullptr) { // loop over outgoing edges
-            int m=edgeptr->to_node->node_id-1;
+            idx_t m=edgeptr->to_node->node_id-1;
             if (shortest_paths[n][0].p - 1.L*log(edgeptr->t) < shortest_paths[m][0].p) {
                 // update path values
                 shortest_paths[m][0].p = shortest_paths[n][0].p - 1.L*log(edgeptr->t);
@@ -109,7 +123,7 @@ void REA::dijkstra(const Network& ktn) {
         find_next_node: {}
         // find node with current lowest shortest path cost
         long double mincost=numeric_limits<long double>::infinity();
-        for (int j=0;j<ktn.n_nodes;j++) {
+        for (idx_t j=0;j<ktn.n_nodes;j++) {
             if (!insptree[j] && (shortest_paths[j][0].p < mincost)) {
                 mincost = shortest_paths[j][0].p;
                 curr_node = &ktn.nodes[j];
@@ -187,7 +201,7 @@ void REA::add_candidate(const Walker *cand_path, const Edge *uvedge) {
         cout << "add_candidate() to node: " << uvedge->to_node->node_id << "    path no. " << cand_path->path_no \
              << "    from node: " << uvedge->from_node->node_id << "    weight of parent path: " << cand_path->p << endl;
     }
-    int v = uvedge->to_node->node_id;
+    idx_t v = uvedge->to_node->node_id;
     bool foundempty=false; // boolean value to indicate if an available space in the candidate_paths array has been found
     for (int i=0;i<uvedge->to_node->udeg;i++) {
         if (candidate_paths[v-1][i].first==nullptr) {
@@ -204,7 +218,7 @@ void REA::add_candidate(const Walker *cand_path, const Edge *uvedge) {
    candidate path from the list */
 void REA::select_candidate(const Node &vnode, int k) {
     if (debug) cout << "in select_candidate for node: " << vnode.node_id << " path no.: " << k << endl;
-    int v = vnode.node_id;
+    idx_t v = vnode.node_id;
     int m=-1; long double mincost=numeric_limits<long double>::infinity();
     for (int i=0;i<vnode.udeg;i++) { // loop over candidate paths
         if (candidate_paths[v-1][i].first==nullptr) continue; // empty space in list of candidate paths
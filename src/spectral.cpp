@@ -0,0 +1,310 @@
+/*
+File containing functions relating to the spectral analysis of a reversible Markov chain, namely the computation of the slowest
+relaxation rates and the associated eigenvectors by the Lanczos algorithm.
+
+For a Markov chain satisfying detailed balance, the rate matrix Q (CTMC) or transition matrix T (DTMC) is similar to a symmetric
+matrix by the transformation D^{1/2} Q D^{-1/2}, where D is the diagonal matrix of stationary probabilities. The Lanczos algorithm,
+with full reorthogonalisation and thick restarts, is applied to the symmetrised matrix, optionally in shift-invert mode. See:
+C. Lanczos, J. Res. Natl. Bur. Stand. 45, 255-282 (1950).
+Y. Saad, Numerical Methods for Large Eigenvalue Problems, 2nd ed. (SIAM, Philadelphia, 2011), ch. 6.
+T. Ericsson and A. Ruhe, Math. Comput. 35, 1251-1268 (1980).
+K. Wu and H. Simon, SIAM J. Matrix Anal. Appl. 22, 602-616 (2000).
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "kmc_methods.h"
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <omp.h>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+/* constructor for SPECTRAL derived class. The off-diagonal elements of the symmetrised matrix L are computed from the (log)
+   stationary probabilities of the nodes, i.e. L_ij = -exp((pi_i-pi_j)/2)*K_ij, where K is the rate or transition matrix */
+SPECTRAL::SPECTRAL(const Network &ktn, bool discretetime, int neigs, int nlanczos, double shift, \
+                   const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    if (nlanczos<=0) nlanczos=max(2*neigs,neigs+20); // default dimension of the Krylov subspace
+    if (nlanczos>ktn.n_nodes) nlanczos=ktn.n_nodes;
+    if (neigs>nlanczos) {
+        cout << "spectral> error: the number of eigenpairs cannot exceed the number of Lanczos vectors" << endl; exit(EXIT_FAILURE); }
+    cout << "\n\nspectral> computing the " << neigs << " slowest relaxation modes by the Lanczos algorithm with " << nlanczos \
+         << " Lanczos vectors" << endl;
+    if (shift>0.) cout << "spectral> using shift-invert operator with shift: " << shift << endl;
+    this->discretetime=discretetime; this->neigs=neigs; this->nlanczos=nlanczos; this->shift=shift;
+    tau=ktn.nodes[0].t_esc; // lag time is the same for all nodes of a DTMC
+    // check that the matrix and Lanczos vectors fit within the memory budget before allocating them
+    idx_t n_offdiag=0;
+    for (const Edge &edge: ktn.edges) {
+        if (!edge.deadts) n_offdiag++; }
+    basis_bytes = static_cast<long long int>(ktn.n_nodes+1)*sizeof(idx_t)+static_cast<long long int>(n_offdiag)*(sizeof(idx_t)+ \
+                  sizeof(double))+static_cast<long long int>(nlanczos+3)*static_cast<long long int>(ktn.n_nodes)*sizeof(double);
+    if (basis_bytes>Mem_Accounting::available()) {
+        cout << "spectral> error: the matrix and Lanczos vectors require " << basis_bytes/1.e6 \
+             << " MB, which exceeds the memory budget. Reduce the number of Lanczos vectors" << endl; exit(EXIT_FAILURE); }
+    offsets.resize(ktn.n_nodes+1); cols.resize(n_offdiag); vals.resize(n_offdiag);
+    diag.resize(ktn.n_nodes); sqrt_pi.resize(ktn.n_nodes);
+    Mem_Accounting::alloc(Mem_Accounting::SPECTRAL_BASIS,basis_bytes);
+    idx_t pos=0;
+    lambda=0.L;
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
+        offsets[i]=pos;
+        const Node &node=ktn.nodes[i];
+        sqrt_pi[i]=exp(0.5L*node.pi);
+        long double k_esc=0.L; // escape rate (CTMC) or escape probability (DTMC)
+        const Edge *edgeptr=node.top_from;
+        while (edgeptr!=nullptr) {
+            if (!edgeptr->deadts) {
+                long double k_ij=discretetime?edgeptr->t:edgeptr->t/node.t_esc;
+                cols[pos]=edgeptr->to_node->node_pos;
+                vals[pos]=-exp(0.5L*(node.pi-edgeptr->to_node->pi))*k_ij; pos++;
+                k_esc+=k_ij;
+            }
+            edgeptr=edgeptr->next_from;
+        }
+        diag[i]=discretetime?1.L-node.t:k_esc;
+        if (diag[i]>lambda) lambda=diag[i];
+    }
+    offsets[ktn.n_nodes]=pos;
+}
+
+SPECTRAL::~SPECTRAL() {
+    Mem_Accounting::alloc(Mem_Accounting::SPECTRAL_BASIS,-basis_bytes);
+}
+
+/* main loop of the thick-restart Lanczos algorithm. The operator is I-L/lambda, or else (L+shift*I)^{-1} in shift-invert mode, so
+   that the largest eigenvalues of the operator correspond to the smallest eigenvalues of L. The Lanczos vectors are fully
+   reorthogonalised, and the elements of the projected matrix are taken from the Gram-Schmidt coefficients. If the residual norms
+   of the wanted Ritz pairs are not below the tolerance, the iteration is restarted retaining the leading Ritz vectors together
+   with the residual vector, so that the Krylov subspace is not discarded. MAXIT is interpreted as the maximum number of restarts */
+void SPECTRAL::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
+
+    idx_t n=ktn.n_nodes;
+    vector<vector<double>> v(nlanczos+1,vector<double>(n)); // Lanczos vectors
+    vector<double> w(n);
+    for (idx_t i=0;i<n;i++) v[0][i]=static_cast<double>(Wrapper_Method::rand_unif_met(seed))-0.5;
+    double norm=sqrt(dot(v[0],v[0]));
+    for (idx_t i=0;i<n;i++) v[0][i]/=norm;
+    vector<vector<double>> h(nlanczos,vector<double>(nlanczos,0.)); // projected matrix (upper triangle)
+    vector<double> theta, resids(neigs); // Ritz values, and residual norms of the wanted Ritz pairs
+    vector<vector<double>> y; // eigenvectors of the projected matrix
+    double op_norm=0.; // estimate of the norm of the operator, used to detect an invariant Krylov subspace
+    int m=nlanczos, n_kept=0, n_restart=0;
+    int n_keep=min(nlanczos-1,neigs+(nlanczos-neigs)/2); // no. of Ritz vectors retained on restart
+    while (true) {
+        double beta=0.; // norm of the residual vector
+        m=nlanczos;
+        for (int j=n_kept;j<nlanczos;j++) {
+            apply_op(v[j],w);
+            for (int pass=0;pass<2;pass++) { // full reorthogonalisation against all previous Lanczos vectors (twice is enough)
+                for (int l=0;l<=j;l++) {
+                    double c=dot(w,v[l]);
+                    h[l][j]+=c;
+                    #pragma omp parallel for schedule(static)
+                    for (idx_t i=0;i<n;i++) w[i]-=c*v[l][i];
+                }
+            }
+            beta=sqrt(dot(w,w));
+            op_norm=max(op_norm,abs(h[j][j])+beta);
+            if (beta<tol*op_norm) { m=j+1; beta=0.; break; } // Krylov subspace is invariant
+            #pragma omp parallel for schedule(static)
+            for (idx_t i=0;i<n;i++) v[j+1][i]=w[i]/beta;
+        }
+        // Ritz values and vectors of the projected matrix, in order of decreasing Ritz value
+        vector<vector<double>> a(m,vector<double>(m));
+        for (int j=0;j<m;j++) {
+            for (int l=0;l<=j;l++) { a[l][j]=h[l][j]; a[j][l]=h[l][j]; } }
+        sym_eigen(a,theta,y);
+        int n_conv=0;
+        double scale=abs(theta[0]);
+        for (int k=0;k<min(neigs,m);k++) {
+            resids[k]=abs(beta*y[m-1][k]);
+            if (resids[k]<=tol*scale) n_conv++;
+        }
+        cout << "spectral> Lanczos iteration: " << n_restart << "   no. of converged eigenpairs: " << n_conv << endl;
+        if (n_conv==neigs || m<nlanczos || n_restart==maxit) {
+            if (n_conv<neigs && m<nlanczos) {
+                cout << "spectral> warning: Krylov subspace is invariant, only " << m << " eigenpairs can be determined" << endl; }
+            else if (n_conv<neigs) { cout << "spectral> warning: max. no. of restarts reached before convergence" << endl; }
+            break;
+        }
+        // thick restart: the Lanczos vectors are replaced by the leading Ritz vectors, followed by the residual vector
+        #pragma omp parallel for schedule(static)
+        for (idx_t i=0;i<n;i++) {
+            vector<double> x(n_keep,0.);
+            for (int j=0;j<m;j++) {
+                for (int k=0;k<n_keep;k++) x[k]+=y[j][k]*v[j][i]; }
+            for (int k=0;k<n_keep;k++) v[k][i]=x[k];
+            v[n_keep][i]=v[m][i];
+        }
+        for (int j=0;j<nlanczos;j++) fill(h[j].begin(),h[j].end(),0.);
+        for (int k=0;k<n_keep;k++) h[k][k]=theta[k];
+        n_kept=n_keep;
+        n_restart++;
+    }
+    cout << "spectral> total no. of applications of the operator: " << n_op;
+    if (shift>0.) cout << "   total no. of CG iterations: " << n_cg;
+    cout << endl;
+
+    /* write the eigenvalues and relaxation timescales, and the right eigenvectors of the rate or transition matrix, which are given
+       by the eigenvectors of L divided by the square roots of the stationary probabilities */
+    int n_eigs=min(neigs,m);
+    ofstream vals_f, vecs_f;
+    vals_f.open("spectral_eigvals.dat"); vecs_f.open("spectral_eigvecs.dat");
+    vals_f.setf(ios::right,ios::adjustfield); vals_f.setf(ios::scientific,ios::floatfield); vals_f.precision(10);
+    vecs_f.setf(ios::right,ios::adjustfield); vecs_f.setf(ios::scientific,ios::floatfield); vecs_f.precision(10);
+    vector<vector<double>> psi(n_eigs,vector<double>(n,0.));
+    for (int k=0;k<n_eigs;k++) {
+        long double mu=shift>0.?(1.L/theta[k])-shift:lambda*(1.L-theta[k]); // eigenvalue of L
+        long double eigval, t_relax; // eigenvalue of rate or transition matrix, and relaxation timescale
+        if (discretetime) {
+            eigval=1.L-mu; t_relax=-tau/log(eigval);
+        } else {
+            eigval=-mu; t_relax=1.L/mu;
+        }
+        if (mu<=tol*lambda) t_relax=numeric_limits<long double>::infinity(); // stationary mode
+        cout << "spectral> eigenvalue " << k+1 << ":   " << eigval << "   relaxation timescale: " << t_relax << endl;
+        vals_f << setw(6) << k+1 << setw(25) << eigval << setw(25) << t_relax << setw(25) << resids[k]/abs(theta[0]) << endl;
+        for (int j=0;j<m;j++) {
+            #pragma omp parallel for schedule(static)
+            for (idx_t i=0;i<n;i++) psi[k][i]+=y[j][k]*v[j][i];
+        }
+        double max_elem=0.; // sign of eigenvector is chosen so that the element of largest magnitude is positive
+        for (idx_t i=0;i<n;i++) {
+            psi[k][i]/=sqrt_pi[i];
+            if (abs(psi[k][i])>abs(max_elem)) max_elem=psi[k][i];
+        }
+        if (max_elem<0.) { for (idx_t i=0;i<n;i++) psi[k][i]=-psi[k][i]; }
+    }
+    for (idx_t i=0;i<n;i++) {
+        vecs_f << setw(10) << i+1;
+        for (int k=0;k<n_eigs;k++) vecs_f << setw(20) << psi[k][i];
+        vecs_f << endl;
+    }
+}
+
+/* matrix-vector product y = L x */
+void SPECTRAL::apply_l(const vector<double> &x, vector<double> &y) const {
+
+    #pragma omp parallel for schedule(static)
+    for (idx_t i=0;i<diag.size();i++) {
+        double y_i=diag[i]*x[i];
+        for (idx_t l=offsets[i];l<offsets[i+1];l++) y_i+=vals[l]*x[cols[l]];
+        y[i]=y_i;
+    }
+}
+
+/* apply the operator whose largest eigenvalues are sought, y = (I-L/lambda) x or y = (L+shift*I)^{-1} x */
+void SPECTRAL::apply_op(const vector<double> &x, vector<double> &y) {
+
+    n_op++;
+    if (shift>0.) { solve_cg(x,y); return; }
+    apply_l(x,y);
+    #pragma omp parallel for schedule(static)
+    for (idx_t i=0;i<x.size();i++) y[i]=x[i]-y[i]/lambda;
+}
+
+/* solve the linear system (L+shift*I) x = b, where the matrix is symmetric positive definite, by the conjugate gradient method with
+   a Jacobi (diagonal) preconditioner */
+void SPECTRAL::solve_cg(const vector<double> &b, vector<double> &x) {
+
+    idx_t n=b.size();
+    vector<double> r(b), z(n), p(n), q(n);
+    fill(x.begin(),x.end(),0.);
+    double b_norm=sqrt(dot(b,b));
+    #pragma omp parallel for schedule(static)
+    for (idx_t i=0;i<n;i++) z[i]=r[i]/(diag[i]+shift);
+    p=z;
+    double rz=dot(r,z);
+    for (idx_t it=0;it<10*n;it++) {
+        if (sqrt(dot(r,r))<=0.01*tol*b_norm) return;
+        n_cg++;
+        apply_l(p,q);
+        #pragma omp parallel for schedule(static)
+        for (idx_t i=0;i<n;i++) q[i]+=shift*p[i];
+        double a=rz/dot(p,q);
+        #pragma omp parallel for schedule(static)
+        for (idx_t i=0;i<n;i++) {
+            x[i]+=a*p[i]; r[i]-=a*q[i]; z[i]=r[i]/(diag[i]+shift); }
+        double rz_new=dot(r,z);
+        #pragma omp parallel for schedule(static)
+        for (idx_t i=0;i<n;i++) p[i]=z[i]+(rz_new/rz)*p[i];
+        rz=rz_new;
+    }
+    cout << "spectral> warning: CG solver for shift-invert operator did not converge" << endl;
+}
+
+double SPECTRAL::dot(const vector<double> &x, const vector<double> &y) {
+
+    double xy=0.;
+    #pragma omp parallel for schedule(static) reduction(+:xy)
+    for (idx_t i=0;i<x.size();i++) xy+=x[i]*y[i];
+    return xy;
+}
+
+/* eigenvalues and eigenvectors of the dense symmetric matrix a, by the cyclic Jacobi method. On return, d contains the eigenvalues in
+   decreasing order, and the k-th column of z is the eigenvector for the k-th eigenvalue. The matrix a is overwritten */
+void SPECTRAL::sym_eigen(vector<vector<double>> &a, vector<double> &d, vector<vector<double>> &z) {
+
+    int n=a.size();
+    z.assign(n,vector<double>(n,0.));
+    for (int i=0;i<n;i++) z[i][i]=1.;
+    for (int sweep=0;sweep<100;sweep++) {
+        double off=0., diag_norm=0.; // norms of the off-diagonal and diagonal parts
+        for (int i=0;i<n;i++) {
+            diag_norm+=a[i][i]*a[i][i];
+            for (int j=i+1;j<n;j++) off+=a[i][j]*a[i][j];
+        }
+        if (off<=numeric_limits<double>::epsilon()*numeric_limits<double>::epsilon()*diag_norm) break;
+        for (int p=0;p<n-1;p++) {
+            for (int q=p+1;q<n;q++) {
+                if (a[p][q]==0.) continue;
+                // rotation to annihilate the (p,q) element
+                double theta=(a[q][q]-a[p][p])/(2.*a[p][q]);
+                double t=copysign(1.,theta)/(abs(theta)+sqrt(theta*theta+1.));
+                double c=1./sqrt(t*t+1.), s=t*c;
+                for (int k=0;k<n;k++) {
+                    double akp=a[k][p], akq=a[k][q];
+                    a[k][p]=c*akp-s*akq; a[k][q]=s*akp+c*akq;
+                }
+                for (int k=0;k<n;k++) {
+                    double apk=a[p][k], aqk=a[q][k];
+                    a[p][k]=c*apk-s*aqk; a[q][k]=s*apk+c*aqk;
+                }
+                for (int k=0;k<n;k++) {
+                    double zkp=z[k][p], zkq=z[k][q];
+                    z[k][p]=c*zkp-s*zkq; z[k][q]=s*zkp+c*zkq;
+                }
+            }
+        }
+    }
+    // sort the eigenpairs in order of decreasing eigenvalue
+    vector<int> order(n);
+    iota(order.begin(),order.end(),0);
+    sort(order.begin(),order.end(),[&a](int i, int j) { return a[i][i]>a[j][j]; });
+    d.resize(n);
+    vector<vector<double>> z_sorted(n,vector<double>(n));
+    for (int k=0;k<n;k++) {
+        d[k]=a[order[k]][order[k]];
+        for (int i=0;i<n;i++) z_sorted[i][k]=z[i][order[k]];
+    }
+    z.swap(z_sorted);
+}
@@ -24,6 +24,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <cmath>
 #include <string>
+#include <map>
+#include <algorithm>
 
 using namespace std;
 
@@ -61,7 +63,7 @@ void KPS::calc_committor(const Network& ktn) {
         q_ba_vals[node.node_id-1] = q_ba;
     }
     /* committor probabilities for endpoint nodes */
-    for (int i=0;i<ktn.n_nodes;i++) {
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
         if (nodemask[i] && ktn.nodes[i].aorb==0) { continue; // intermediate nodes have all been accounted for
         } else if (!nodemask[i] && ktn.nodes[i].aorb==-1) { // internal node of A
             q_ab_vals[ktn.nodes[i].node_id-1]=1.; q_ba_vals[ktn.nodes[i].node_id-1]=0.;
@@ -159,6 +161,149 @@ void KPS::calc_gth() {
 }
 
 
+/* sparse representation of the renormalised transition probability matrix used in a batch of state reduction queries.
+   Indices are positions in the nodes vector of the Network from which the matrix is constructed */
+struct SR_Matrix {
+    vector<map<int,long double>> rows; // off-diagonal transition probabilities from each node
+    vector<set<int>> cols;             // nodes with a transition to each node
+    vector<long double> t;             // self-loop transition probabilities
+    vector<long double> t_esc;         // (renormalised) mean waiting times
+};
+
+/* record of a single graph transformation iteration, from which the quantities for the eliminated node are recovered by back-substitution */
+struct SR_Elim {
+    int n;                 // index of eliminated node
+    long double factor;    // (1-T_{nn}) at the point of elimination
+    long double t_esc;     // renormalised mean waiting time at the point of elimination
+    vector<pair<int,long double>> row; // transition probabilities to noneliminated nodes at the point of elimination
+};
+
+/* eliminate the n-th node from the sparse matrix and append the record of the elimination to elims */
+static void sr_eliminate_node(SR_Matrix &mtx, int n, vector<SR_Elim> &elims) {
+    long double factor=0.L; // equal to (1-T_{nn}), cf. Network::calc_gt_factor()
+    if (mtx.t[n]>0.99) { for (const auto &elem: mtx.rows[n]) factor += elem.second;
+    } else { factor = 1.L-mtx.t[n]; }
+    elims.push_back({n,factor,mtx.t_esc[n],vector<pair<int,long double>>(mtx.rows[n].begin(),mtx.rows[n].end())});
+    for (const int i: mtx.cols[n]) { // loop over nodes with transitions to the eliminated node
+        long double t_in = mtx.rows[i][n];
+        mtx.rows[i].erase(n);
+        mtx.t_esc[i] += t_in*mtx.t_esc[n]/factor;
+        for (const auto &elem: mtx.rows[n]) {
+            if (elem.first==i) { mtx.t[i] += t_in*elem.second/factor; continue; }
+            mtx.rows[i][elem.first] += t_in*elem.second/factor;
+            mtx.cols[elem.first].insert(i);
+        }
+    }
+    for (const auto &elem: mtx.rows[n]) mtx.cols[elem.first].erase(n);
+    mtx.rows[n].clear(); mtx.cols[n].clear();
+}
+
+/* recover the values of x for eliminated nodes by back-substitution, in the reverse order of elimination. If mfpt is true,
+   x are the MFPTs, otherwise x are committor probabilities */
+static void sr_back_substitution(const vector<SR_Elim> &elims, vector<long double> &x, bool mfpt) {
+    for (vector<SR_Elim>::const_reverse_iterator it_elim=elims.rbegin();it_elim!=elims.rend();++it_elim) {
+        long double x_n = mfpt?it_elim->t_esc:0.L;
+        for (const auto &elem: it_elim->row) x_n += elem.second*x[elem.first];
+        x[it_elim->n] = x_n/it_elim->factor;
+    }
+}
+
+/* perform a batch of A<-B state reduction queries. The nodes that do not belong to the A or B set of any query are eliminated
+   only once, and the committor probabilities and/or MFPTs for each query are then obtained from the reduced network of endpoint
+   nodes, followed by back-substitution using the stored graph transformation iterations */
+void KPS::calc_batch_queries(const Network &ktn) {
+
+    cout << "kps> eliminating nodes that are not in any endpoint set of the batch of " << ab_queries.size() << " queries" << endl;
+    vector<bool> endpoint(ktn.n_nodes,false);
+    for (const auto &ab_query: ab_queries) {
+        for (const idx_t node_id: ab_query.first) {
+            if (node_id<1 || node_id>ktn.n_nodes) throw Network::Network_exception();
+            endpoint[node_id-1]=true; }
+        for (const idx_t node_id: ab_query.second) {
+            if (node_id<1 || node_id>ktn.n_nodes) throw Network::Network_exception();
+            endpoint[node_id-1]=true; }
+    }
+    // construct sparse transition matrix for the full network
+    SR_Matrix mtx;
+    mtx.rows.resize(ktn.n_nodes); mtx.cols.resize(ktn.n_nodes);
+    mtx.t.resize(ktn.n_nodes); mtx.t_esc.resize(ktn.n_nodes);
+    for (const Node &node: ktn.nodes) {
+        mtx.t[node.node_pos]=node.t; mtx.t_esc[node.node_pos]=node.t_esc;
+        const Edge *edgeptr = node.top_from;
+        while (edgeptr!=nullptr) {
+            if (!edgeptr->deadts) {
+                mtx.rows[node.node_pos][edgeptr->to_node->node_pos]=edgeptr->t;
+                mtx.cols[edgeptr->to_node->node_pos].insert(node.node_pos); }
+            edgeptr=edgeptr->next_from;
+        }
+    }
+    // eliminate the intermediate nodes common to all queries, in order of increasing out-degree
+    vector<int> elim_order;
+    for (const Node &node: ktn.nodes) { if (!endpoint[node.node_pos]) elim_order.push_back(node.node_pos); }
+    stable_sort(elim_order.begin(),elim_order.end(),[&ktn](int l, int r) { return ktn.nodes[l].udeg<ktn.nodes[r].udeg; });
+    vector<SR_Elim> elims_common;
+    elims_common.reserve(elim_order.size());
+    for (const int n: elim_order) sr_eliminate_node(mtx,n,elims_common);
+    cout << "kps> eliminated " << elims_common.size() << " nodes, " << ktn.n_nodes-elims_common.size() \
+         << " endpoint nodes remain in the reduced network" << endl;
+
+    ofstream batch_f;
+    if (sr_args.mfpt) {
+        batch_f.open("batch_mfpt.dat"); batch_f.setf(ios::scientific,ios::floatfield); batch_f.precision(10); }
+    for (int q=0;q<ab_queries.size();q++) {
+        vector<int> aorb(ktn.n_nodes,0); // -1 for A, +1 for B, 0 otherwise, for the current query
+        for (const idx_t node_id: ab_queries[q].first) aorb[node_id-1]=-1;
+        for (const idx_t node_id: ab_queries[q].second) {
+            if (aorb[node_id-1]==-1) {
+                cout << "kps> error: node " << node_id << " belongs to both the A and B sets of query " << q+1 << endl; exit(EXIT_FAILURE); }
+            aorb[node_id-1]=1; }
+        if (sr_args.mfpt) { // eliminate all remaining endpoint nodes not in A, then back-substitute for MFPTs to A
+            SR_Matrix mtx_q = mtx;
+            vector<SR_Elim> elims_q;
+            for (idx_t i=0;i<ktn.n_nodes;i++) { if (endpoint[i] && aorb[i]!=-1) sr_eliminate_node(mtx_q,i,elims_q); }
+            vector<long double> mfpt_q(ktn.n_nodes,0.L);
+            sr_back_substitution(elims_q,mfpt_q,true);
+            sr_back_substitution(elims_common,mfpt_q,true);
+            // A<-B MFPT given a local equilibrium distribution within B
+            long double pi_B = -numeric_limits<long double>::infinity(), mfpt_ab=0.L;
+            for (const idx_t node_id: ab_queries[q].second) pi_B = log(exp(pi_B)+exp(ktn.nodes[node_id-1].pi));
+            for (const idx_t node_id: ab_queries[q].second) mfpt_ab += exp(ktn.nodes[node_id-1].pi-pi_B)*mfpt_q[node_id-1];
+            batch_f << setw(7) << q+1 << setw(18) << mfpt_ab << endl;
+            ofstream mfpt_f; mfpt_f.open("mfpt."+to_string(q+1)+".dat"); mfpt_f.setf(ios::scientific,ios::floatfield);
+            mfpt_f.precision(10);
+            for (idx_t i=0;i<ktn.n_nodes;i++) {
+                if (aorb[i]==-1) continue; // the MFPT is not defined for absorbing nodes
+                mfpt_f << setw(5) << i+1 << setw(18) << mfpt_q[i] << endl;
+            }
+        }
+        if (sr_args.committor) { // eliminate all remaining endpoint nodes not in A or B, then back-substitute for A<-B committor probs
+            SR_Matrix mtx_q = mtx;
+            vector<SR_Elim> elims_q;
+            for (idx_t i=0;i<ktn.n_nodes;i++) { if (endpoint[i] && aorb[i]==0) sr_eliminate_node(mtx_q,i,elims_q); }
+            vector<long double> q_ab(ktn.n_nodes,0.L);
+            for (idx_t i=0;i<ktn.n_nodes;i++) { if (aorb[i]==-1) q_ab[i]=1.L; }
+            sr_back_substitution(elims_q,q_ab,false);
+            sr_back_substitution(elims_common,q_ab,false);
+            /* as in calc_committor(), the committor probability of an initial node is that of escaping B and then reaching A
+               before returning to B */
+            vector<long double> q_ab_b(ab_queries[q].second.size());
+            for (int j=0;j<ab_queries[q].second.size();j++) {
+                const Node &node = ktn.nodes[ab_queries[q].second[j]-1];
+                q_ab_b[j]=0.L;
+                const Edge *edgeptr = node.top_from;
+                while (edgeptr!=nullptr) {
+                    if (!(edgeptr->deadts || aorb[edgeptr->to_node->node_pos]==1)) {
+                        q_ab_b[j] += edgeptr->t*q_ab[edgeptr->to_node->node_pos]; }
+                    edgeptr=edgeptr->next_from;
+                }
+            }
+            for (int j=0;j<ab_queries[q].second.size();j++) q_ab[ab_queries[q].second[j]-1]=q_ab_b[j];
+            Wrapper_Method::write_vec<long double>(q_ab,"committor_AB."+to_string(q+1)+".dat");
+        }
+    }
+    cout << "kps> finished batch of state reduction queries" << endl;
+}
+
 /* rewrite the stationary probabilities of the ktn_kps network to reflect the initial distribution */
 void KPS::rewrite_stat_probs(const Network &ktn) {
     set<const Node*>::iterator it_set = ktn.nodesB.begin();
@@ -190,7 +335,7 @@ void KPS::write_renormalised_probs(string fname) {
     elems_f.setf(ios::right,ios::adjustfield); elems_f.setf(ios::scientific,ios::floatfield);
     elems_f.precision(10);
     for (vector<Node>::iterator it_nodevec=ktn_kps->nodes.begin();it_nodevec!=ktn_kps->nodes.end();++it_nodevec) {
-        if (sr_args.fundamentalred && !it_nodevec->flag) continue;
+        if (sr_args.fundamentalred && !gt_flag(&*it_nodevec)) continue;
         if (!it_nodevec->eliminated && it_nodevec->aorb!=-1) { // print self-loop of non-absorbing node if node is non-eliminated
             elems_f << setw(5) << it_nodevec->node_id << setw(5) << it_nodevec->node_id << setw(18) << it_nodevec->t << endl;
         }
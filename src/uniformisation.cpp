@@ -0,0 +1,225 @@
+/*
+File containing functions relating to the deterministic computation of transient (time-dependent) probability distributions by
+uniformisation.
+
+For a CTMC with generator matrix Q, the uniformised DTMC has transition matrix P = I + Q/lambda, where lambda is not less than the
+largest escape rate of any node. The occupation probability distribution after time t is then an average of the distributions after
+n steps of the uniformised chain, weighted by the Poisson probabilities with mean lambda*t. The Poisson series is truncated on both
+sides so that the neglected probability mass is below a given tolerance, following:
+B. L. Fox and P. W. Glynn, Commun. ACM 31, 440-445 (1988).
+See also:
+W. K. Grassmann, Comput. Oper. Res. 4, 47-53 (1977).
+W. J. Stewart, Introduction to the Numerical Solution of Markov Chains (Princeton University Press, 1994), ch. 8.
+
+This file is a part of DISCOTRESS, a software package to simulate the dynamics on arbitrary continuous- and discrete-time Markov chains (CTMCs and DTMCs).
+Copyright (C) 2020 Daniel J. Sharpe
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "kmc_methods.h"
+#include <cmath>
+#include <omp.h>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+/* constructor for UNIF derived class. The transition matrix of the uniformised chain is constructed from the incoming edges of each
+   node, so that each element of the propagated vectors is written by a single thread in the matrix-vector product */
+UNIF::UNIF(const Network &ktn, bool discretetime, long double trajt, double unifeps, const vector<idx_t> &out_nodes, \
+           const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+
+    cout << "\n\nunif> computing transient probability distributions by uniformisation, up to time: " << trajt \
+         << "   at time intervals: " << tintvl << endl;
+    this->discretetime=discretetime; this->trajt=trajt; this->unifeps=unifeps;
+    for (idx_t node_id: out_nodes) {
+        if (node_id<1 || node_id>ktn.n_nodes) {
+            cout << "unif> error: invalid node ID in file of nodes for which occupation probabilities are written" << endl;
+            exit(EXIT_FAILURE); }
+        this->out_nodes.push_back(node_id-1);
+    }
+    // escape rates of nodes (CTMC), and the uniformisation rate
+    vector<long double> k_esc(ktn.n_nodes,0.L);
+    if (discretetime) {
+        lambda=1.L/ktn.nodes[0].t_esc; // lag time is the same for all nodes
+        if (abs(tintvl*lambda-round(tintvl*lambda))>1.E-08*tintvl*lambda) {
+            cout << "unif> error: for a DTMC, the time interval must be a multiple of the lag time" << endl; exit(EXIT_FAILURE); }
+    } else {
+        lambda=0.L;
+        for (const Edge &edge: ktn.edges) {
+            if (edge.deadts) continue;
+            k_esc[edge.from_node->node_pos]+=edge.t/edge.from_node->t_esc; }
+        for (idx_t i=0;i<ktn.n_nodes;i++) {
+            if (k_esc[i]>lambda) lambda=k_esc[i]; }
+        cout << "unif> uniformisation rate: " << lambda << endl;
+    }
+    // check that the uniformised transition matrix fits within the memory budget before allocating it
+    idx_t n_in=0;
+    for (const Edge &edge: ktn.edges) {
+        if (!edge.deadts) n_in++; }
+    mtx_bytes = static_cast<long long int>(ktn.n_nodes+1)*sizeof(idx_t)+static_cast<long long int>(n_in)*(sizeof(idx_t)+sizeof(double))+ \
+                3*static_cast<long long int>(ktn.n_nodes)*sizeof(double);
+    if (mtx_bytes>Mem_Accounting::available()) {
+        cout << "unif> error: the uniformised transition matrix requires " << mtx_bytes/1.e6 \
+             << " MB, which exceeds the memory budget" << endl; exit(EXIT_FAILURE); }
+    in_offsets.resize(ktn.n_nodes+1); in_from.resize(n_in); in_p.resize(n_in);
+    p_diag.resize(ktn.n_nodes); p_absorb.resize(ktn.n_nodes,0.); p_init.resize(ktn.n_nodes,0.);
+    Mem_Accounting::alloc(Mem_Accounting::UNIF_MATRIX,mtx_bytes);
+    idx_t pos=0;
+    for (idx_t j=0;j<ktn.n_nodes;j++) {
+        in_offsets[j]=pos;
+        const Node &node=ktn.nodes[j];
+        p_diag[j]=discretetime?node.t:1.L-(k_esc[j]/lambda);
+        const Edge *edgeptr=node.top_to;
+        while (edgeptr!=nullptr) {
+            if (!edgeptr->deadts) {
+                const Node *from_node=edgeptr->from_node;
+                double p=discretetime?edgeptr->t:(edgeptr->t/from_node->t_esc)/lambda;
+                in_from[pos]=from_node->node_pos; in_p[pos]=p; pos++;
+                if (node.aorb==-1) p_absorb[from_node->node_pos]+=p;
+            }
+            edgeptr=edgeptr->next_to;
+        }
+    }
+    in_offsets[ktn.n_nodes]=pos;
+    // initial distribution is the specified initial condition for B, or otherwise a local equilibrium within B
+    long double pi_B=-numeric_limits<long double>::infinity();
+    for (const Node *nodeptr: ktn.nodesB) {
+        if (nodeptr->pi>pi_B) pi_B=nodeptr->pi; }
+    long double sum_p=0.L;
+    for (const Node *nodeptr: ktn.nodesB) sum_p+=exp(nodeptr->pi-pi_B);
+    idx_t i=0;
+    for (const Node *nodeptr: ktn.nodesB) {
+        p_init[nodeptr->node_pos]=ktn.initcond?ktn.init_probs[i]:exp(nodeptr->pi-pi_B)/sum_p;
+        i++;
+    }
+}
+
+UNIF::~UNIF() {
+    Mem_Accounting::alloc(Mem_Accounting::UNIF_MATRIX,-mtx_bytes);
+}
+
+/* main loop of the uniformisation method. The occupation probability distribution is propagated for the unrestricted dynamics, and
+   simultaneously for the dynamics where A is absorbing. The total probability that has not been absorbed is the survival probability,
+   from which the first passage time distribution is obtained. The distributions are propagated from one point of the time grid to
+   the next, so that the same truncated set of Poisson weights is used for each time interval */
+void UNIF::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
+
+    int n_intvls=static_cast<int>(floor((trajt/tintvl)+1.E-08)); // number of time intervals
+    vector<double> p_occ(p_init), p_surv(p_init); // distributions for unrestricted dynamics and dynamics where A is absorbing
+    for (const Node *nodeptr: ktn.nodesA) p_surv[nodeptr->node_pos]=0.;
+    vector<double> p_occ_next(ktn.n_nodes), p_surv_next(ktn.n_nodes), p_occ_acc(ktn.n_nodes), p_surv_acc(ktn.n_nodes);
+    int left=0, right=static_cast<int>(round(tintvl*lambda)); // truncation points of the Poisson series
+    vector<double> weights; // Poisson weights for a single time interval (CTMC)
+    if (!discretetime) {
+        poisson_weights(lambda*tintvl,unifeps/static_cast<double>(n_intvls),left,right,weights);
+        cout << "unif> Poisson series for each time interval is truncated to the terms: " << left << " to " << right << endl;
+    }
+    ofstream occ_f, fpt_f;
+    occ_f.open("unif_occprobs.dat"); fpt_f.open("unif_fpt.dat");
+    occ_f.setf(ios::right,ios::adjustfield); occ_f.setf(ios::scientific,ios::floatfield); occ_f.precision(10);
+    fpt_f.setf(ios::right,ios::adjustfield); fpt_f.setf(ios::scientific,ios::floatfield); fpt_f.precision(10);
+    write_grid_point(occ_f,fpt_f,0.L,p_occ,p_surv,ktn);
+    for (int n=1;n<n_intvls+1;n++) {
+        if (discretetime) { // the distributions at the next point of the time grid are given after a fixed no. of steps
+            for (int k=0;k<right;k++) {
+                matvec(p_occ,p_surv,p_occ_next,p_surv_next,ktn);
+                p_occ.swap(p_occ_next); p_surv.swap(p_surv_next);
+            }
+        } else { // the distributions at the next point of the time grid are Poisson-weighted averages over steps of the uniformised chain
+            fill(p_occ_acc.begin(),p_occ_acc.end(),0.); fill(p_surv_acc.begin(),p_surv_acc.end(),0.);
+            for (int k=0;k<right+1;k++) {
+                if (k>=left) {
+                    double w=weights[k-left];
+                    #pragma omp parallel for schedule(static)
+                    for (idx_t j=0;j<ktn.n_nodes;j++) {
+                        p_occ_acc[j]+=w*p_occ[j]; p_surv_acc[j]+=w*p_surv[j]; }
+                }
+                if (k==right) break;
+                matvec(p_occ,p_surv,p_occ_next,p_surv_next,ktn);
+                p_occ.swap(p_occ_next); p_surv.swap(p_surv_next);
+            }
+            p_occ.swap(p_occ_acc); p_surv.swap(p_surv_acc);
+        }
+        write_grid_point(occ_f,fpt_f,static_cast<long double>(n)*tintvl,p_occ,p_surv,ktn);
+    }
+    cout << "unif> finished propagating probability distributions over " << n_intvls << " time intervals. Total no. of " \
+         << "matrix-vector products: " << n_matvec << endl;
+}
+
+/* propagate the distributions for the unrestricted dynamics and for the dynamics where A is absorbing by a single step of the
+   uniformised chain. Probability in A is not propagated for the latter, hence the probability that remains in the transient
+   nodes is the survival probability */
+void UNIF::matvec(const vector<double> &p_occ, const vector<double> &p_surv, vector<double> &p_occ_next, \
+                  vector<double> &p_surv_next, const Network &ktn) {
+
+    PROF_SCOPE(PROF_UNIF_MATVEC);
+    #pragma omp parallel for schedule(static)
+    for (idx_t j=0;j<ktn.n_nodes;j++) {
+        double p_occ_j=p_diag[j]*p_occ[j], p_surv_j=p_diag[j]*p_surv[j];
+        for (idx_t l=in_offsets[j];l<in_offsets[j+1];l++) {
+            p_occ_j+=in_p[l]*p_occ[in_from[l]]; p_surv_j+=in_p[l]*p_surv[in_from[l]]; }
+        p_occ_next[j]=p_occ_j;
+        p_surv_next[j]=ktn.nodes[j].aorb==-1?0.:p_surv_j;
+    }
+    n_matvec++;
+}
+
+/* compute the Poisson probabilities with mean lam, truncated on the left and right so that the neglected probability mass is at
+   most eps. The weights are computed relative to the weight of the mode, to avoid underflow, and are then normalised. The tail
+   beyond a truncation point is bounded by a geometric series, since the ratio of successive weights is decreasing */
+void UNIF::poisson_weights(long double lam, double eps, int &left, int &right, vector<double> &weights) {
+
+    int mode=static_cast<int>(floor(lam));
+    vector<long double> w_left{1.L}, w_right; // weights to the left of (and including) the mode, and to the right of the mode
+    long double w_tot=1.L;
+    left=mode; right=mode;
+    while (true) { // extend the series to the right of the mode
+        long double w=(w_right.empty()?1.L:w_right.back())*lam/static_cast<long double>(right+1);
+        long double r=lam/static_cast<long double>(right+2);
+        if (r<1.L && w/(1.L-r)<0.5L*eps*w_tot) break; // the neglected tail includes the candidate weight w itself
+        w_right.push_back(w); w_tot+=w; right++;
+    }
+    while (left>0) { // extend the series to the left of the mode
+        long double w=w_left.back()*static_cast<long double>(left)/lam;
+        long double r=static_cast<long double>(left-1)/lam;
+        w_left.push_back(w); w_tot+=w; left--;
+        if (w*r/(1.L-r)<0.5L*eps*w_tot) break; // w is retained, the neglected tail begins at the next weight w*r
+    }
+    weights.resize(right-left+1);
+    for (int k=0;k<w_left.size();k++) weights[w_left.size()-1-k]=static_cast<double>(w_left[k]/w_tot);
+    for (int k=0;k<w_right.size();k++) weights[w_left.size()+k]=static_cast<double>(w_right[k]/w_tot);
+}
+
+/* write the occupation probabilities of the A and B sets, of communities and of the chosen nodes, and the first passage time
+   distribution (cumulative probability and probability flux into A), at a single point of the time grid */
+void UNIF::write_grid_point(ofstream &occ_f, ofstream &fpt_f, long double t, const vector<double> &p_occ, const vector<double> &p_surv, \
+                            const Network &ktn) {
+
+    PROF_SCOPE(PROF_OUTPUT);
+    long double p_A=0.L, p_B=0.L, s=0.L, f=0.L; // occupation probabilities of A and B, survival probability and flux into A
+    vector<long double> p_comms(ktn.ncomms>0?ktn.ncomms:0,0.L);
+    for (idx_t i=0;i<ktn.n_nodes;i++) {
+        const Node &node=ktn.nodes[i];
+        if (node.aorb==-1) { p_A+=p_occ[i]; } else if (node.aorb==1) { p_B+=p_occ[i]; }
+        if (node.comm_id>=0 && node.comm_id<p_comms.size()) p_comms[node.comm_id]+=p_occ[i];
+        s+=p_surv[i]; f+=p_surv[i]*p_absorb[i];
+    }
+    occ_f << setw(25) << t << setw(25) << p_A << setw(25) << p_B;
+    for (long double p: p_comms) occ_f << setw(25) << p;
+    for (idx_t i: out_nodes) occ_f << setw(25) << p_occ[i];
+    occ_f << endl;
+    fpt_f << setw(25) << t << setw(25) << 1.L-s << setw(25) << f*lambda << endl;
+}
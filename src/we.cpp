@@ -24,37 +24,134 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "kmc_methods.h"
+#include <queue>
+#include <functional>
 #include <omp.h>
+#include <fstream>
 #include <iostream>
 
 using namespace std;
 
-WE::WE(const Network &ktn, double taure, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
+WE::WE(const Network &ktn, const vector<int> &commstargs, double taure, const Wrapper_args &wrapper_args) : Wrapper_Method(wrapper_args) {
 
     cout << "wekmc> running WE-kMC with parameters:\n  resampling time: " << taure << " \tno. of communities: " \
-         << ktn.ncomms << endl;
-    this->taure=taure;
+         << ktn.ncomms << " \tinitial no. of walkers: " << walkers.size() << endl;
+    this->taure=taure; this->commstargs=commstargs;
+    for (int target: commstargs) {
+        if (target<1) {
+            cout << "wekmc> error: target number of walkers in each community must be at least one" << endl; exit(EXIT_FAILURE); }
+    }
 }
 
 WE::~WE() {}
 
+/* main loop of WE-kMC. Between resampling times, all walkers are propagated in parallel. A walker that reaches the absorbing
+   macrostate A is recycled to the initial macrostate B, retaining its weight, and the recycled weight gives the probability flux
+   A<-B in the nonequilibrium steady state. After each time interval, the walkers are resampled within each community */
 void WE::run_enhanced_kmc(const Network &ktn, Traj_Method *traj_method_obj) {
 
-    cout << "wekmc> beginning WE-kMC simulation" << endl;
+    cout << "\n\nwekmc> beginning WE-kMC simulation" << endl;
     n_ab=0; int n_wekmcit=0;
+    for (auto &walker: walkers) { // all walkers are initialised in B with equal weight
+        walker.w=1.L/static_cast<long double>(walkers.size());
+        get_initial_node(ktn,walker,seed);
+    }
     long double tau_r=static_cast<long double>(taure); // next resampling time
+    long double tot_flux=0.L; // accumulated A<-B flux (ie weight recycled per unit time) over all iterations
+    ofstream we_f; we_f.open("we_flux.dat");
+    we_f.setf(ios::right,ios::adjustfield); we_f.setf(ios::scientific,ios::floatfield);
+    we_f.precision(10);
     while ((n_ab<nabpaths) and (n_wekmcit<maxit)) { // algorithm terminates when max. no. of iterations of resampling procedure have been performed
-        for (auto &walker: walkers) {
-//            if (!walker.active) continue;
-//            while (walker.t<tau_r) // quack simulate
+        long double flux_it=0.L; // weight recycled in the current iteration
+        int n_ab_it=0; // number of walkers recycled in the current iteration
+        #pragma omp parallel reduction(+:flux_it,n_ab_it)
+        {
+        Traj_Method *traj_method_local = traj_method_obj->clone(); // copy required within thread because reference types cannot be made firstprivate
+        #pragma omp for schedule(dynamic,64)
+        for (int i=0;i<walkers.size();i++) {
+            Walker &walker=walkers[i];
+            while (walker.t<tau_r) {
+                traj_method_local->kmc_iteration(ktn,walker);
+                if (walker.curr_node->aorb!=-1) continue;
+                // walker has reached A, recycle to B retaining its weight and the time of the ensemble
+                flux_it+=walker.w; n_ab_it++;
+                long double t=walker.t;
+                walker.reset_walker_info(); walker.t=t;
+                get_initial_node(ktn,walker,seed);
+            }
+        }
+        delete traj_method_local;
         }
+        n_ab+=n_ab_it; n_wekmcit++;
+        flux_it/=static_cast<long double>(taure); tot_flux+=flux_it;
+        we_f << setw(10) << n_wekmcit << setw(20) << tau_r << setw(20) << flux_it << setw(20) << tot_flux/n_wekmcit \
+             << setw(10) << n_ab_it << setw(10) << walkers.size() << endl;
+        if (debug) cout << "wekmc> iteration: " << n_wekmcit << " time: " << tau_r << " flux: " << flux_it << endl;
+        we_resampling(ktn);
         tau_r += taure;
-        break;
     }
-    cout << "wekmc> finished WE-kMC simulation" << endl;
+    we_f.close();
+    cout << "wekmc> finished WE-kMC simulation after " << n_wekmcit << " iterations. No. of walkers recycled: " << n_ab << endl;
+    cout << "wekmc> mean A<-B flux (rate constant): " << tot_flux/n_wekmcit << " \tmean first passage time: " \
+         << n_wekmcit/tot_flux << endl;
 }
 
-void WE::we_resampling() {
+/* split and merge the walkers in each community so that the number of walkers in each community is equal to the target number
+   (if the community is occupied), conserving the total weight. The communities are resampled in parallel */
+void WE::we_resampling(const Network &ktn) {
 
     if (debug) cout << "wekmc> resampling trajectories" << endl;
+    vector<vector<int>> comm_walkers(ktn.ncomms); // indices of walkers in each community
+    for (int i=0;i<walkers.size();i++) comm_walkers[walkers[i].curr_node->comm_id].push_back(i);
+    vector<vector<Walker>> new_walkers(ktn.ncomms); // resampled walkers of each community
+    #pragma omp parallel for schedule(dynamic)
+    for (int i=0;i<ktn.ncomms;i++) {
+        if (comm_walkers[i].empty()) continue;
+        resample_comm(comm_walkers[i],commstargs[i],new_walkers[i]);
+    }
+    int nwalkers=0;
+    for (const auto &comm_walkers_new: new_walkers) nwalkers+=comm_walkers_new.size();
+    vector<Walker> resampled_walkers; resampled_walkers.reserve(nwalkers);
+    for (auto &comm_walkers_new: new_walkers) {
+        for (auto &walker: comm_walkers_new) resampled_walkers.emplace_back(move(walker)); }
+    walkers.swap(resampled_walkers);
+    for (int i=0;i<walkers.size();i++) walkers[i].path_no=i;
+}
+
+/* resample the walkers of a single community (with the given indices in the set of walkers) to the target number using the
+   procedure of Huber and Kim. While there are too many walkers, the two walkers of lowest weight are merged, with the merged walker
+   being either of the two with probability proportional to its weight. While there are too few walkers, the walker of highest
+   weight is split into two walkers of equal weight */
+void WE::resample_comm(const vector<int> &walker_idcs, int target, vector<Walker> &new_walkers) {
+
+    typedef pair<long double,int> Weighted_walker; // weight and index of a walker
+    vector<Weighted_walker> weighted_walkers; weighted_walkers.reserve(max(static_cast<int>(walker_idcs.size()),target));
+    for (int idx: walker_idcs) weighted_walkers.emplace_back(make_pair(walkers[idx].w,idx));
+    if (weighted_walkers.size()>target) { // merge walkers of lowest weight
+        priority_queue<Weighted_walker,vector<Weighted_walker>,greater<Weighted_walker>> min_heap( \
+            greater<Weighted_walker>(),move(weighted_walkers));
+        while (min_heap.size()>target) {
+            Weighted_walker walker1=min_heap.top(); min_heap.pop();
+            Weighted_walker walker2=min_heap.top(); min_heap.pop();
+            long double w=walker1.first+walker2.first;
+            int idx = (rand_unif_met(seed)*w<walker1.first)?walker1.second:walker2.second;
+            min_heap.push(make_pair(w,idx));
+        }
+        weighted_walkers.clear();
+        while (!min_heap.empty()) { weighted_walkers.emplace_back(min_heap.top()); min_heap.pop(); }
+    } else if (weighted_walkers.size()<target) { // split walkers of highest weight
+        priority_queue<Weighted_walker> max_heap(less<Weighted_walker>(),move(weighted_walkers));
+        while (max_heap.size()<target) {
+            Weighted_walker walker=max_heap.top(); max_heap.pop();
+            walker.first*=0.5L;
+            max_heap.push(walker); max_heap.push(walker);
+        }
+        weighted_walkers.clear();
+        while (!max_heap.empty()) { weighted_walkers.emplace_back(max_heap.top()); max_heap.pop(); }
+    }
+    new_walkers.reserve(weighted_walkers.size());
+    for (const Weighted_walker &weighted_walker: weighted_walkers) {
+        new_walkers.emplace_back(walkers[weighted_walker.second]);
+        new_walkers.back().w=weighted_walker.first;
+    }
 }